@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) 2015 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jsrun.h"
+
+/**
+ * The granularity of pool blocks.  Every block size is a multiple of this.
+ */
+#define POOL_GRANULE 16
+/**
+ * The number of size classes.  Allocations larger than the biggest class go
+ * directly to malloc().
+ */
+#define POOL_CLASSES 32
+/**
+ * The size of the chunks that pool blocks are carved from.
+ */
+#define POOL_CHUNK_SIZE (64 * 1024)
+/**
+ * The number of bytes allocated between samples of the heap.  At each sample
+ * the live heap size is recorded in the trace (if tracing is enabled) and the
+ * allocating JavaScript call stack is charged with this many bytes (if
+ * allocation profiling is enabled).  The live heap size is also recorded each
+ * time this many bytes have been freed, so that the trace shows the heap
+ * shrinking.
+ */
+#define ALLOC_SAMPLE_BYTES (64 * 1024)
+
+/**
+ * Header placed in front of every allocation.  Duktape doesn't pass the size
+ * to its free function, so we need to record it.
+ */
+struct block_header
+{
+	/**
+	 * The usable size of the allocation.  Values up to `POOL_MAX` are pool
+	 * blocks, anything larger came from malloc().
+	 */
+	size_t size;
+};
+
+/**
+ * The largest request that is served from the pools.
+ */
+#define POOL_MAX ((POOL_CLASSES * POOL_GRANULE) - sizeof(struct block_header))
+
+/**
+ * A free pool block.  The link is stored in the space that the allocation
+ * would use.
+ */
+struct free_block
+{
+	struct free_block *next;
+};
+
+/**
+ * A chunk of memory that pool blocks are allocated from.  The blocks follow
+ * the header.
+ */
+struct chunk
+{
+	struct chunk *next;
+	/**
+	 * Padding so that the first block keeps malloc()'s alignment.
+	 */
+	void *pad;
+};
+
+/**
+ * Per-heap allocator state.  Each Duktape heap is only used by one thread at
+ * a time, so none of this needs locking.
+ */
+struct heap_allocator
+{
+	/**
+	 * Free lists of recycled blocks, one per size class.
+	 */
+	struct free_block *free_lists[POOL_CLASSES];
+	/**
+	 * All chunks owned by this allocator, released when the heap is
+	 * destroyed.
+	 */
+	struct chunk *chunks;
+	/**
+	 * The next unused byte in the current chunk.
+	 */
+	char *bump;
+	/**
+	 * The end of the current chunk.
+	 */
+	char *bump_end;
+	/**
+	 * The context for this heap, once it has been created.  Used to find the
+	 * JavaScript call stack for allocation samples.
+	 */
+	duk_context *ctx;
+	/**
+	 * The number of bytes currently allocated by the heap.
+	 */
+	size_t live;
+	/**
+	 * The number of bytes to allocate before the next sample.
+	 */
+	size_t until_sample;
+	/**
+	 * The number of bytes to free before the live heap size is next recorded.
+	 */
+	size_t until_free_sample;
+};
+
+/**
+ * Record an allocation of `size` bytes, sampling the heap if enough has been
+ * allocated since the last sample.
+ */
+static inline void
+account_alloc(struct heap_allocator *a, size_t size)
+{
+	a->live += size;
+	if (size < a->until_sample)
+	{
+		a->until_sample -= size;
+		return;
+	}
+	a->until_sample = ALLOC_SAMPLE_BYTES;
+	TRACE('C', "heap_bytes", a->live);
+	if (alloc_profile_enabled && (a->ctx != NULL))
+	{
+		profile_allocation(a->ctx, ALLOC_SAMPLE_BYTES);
+	}
+}
+
+/**
+ * Record that `size` bytes have been freed, recording the live heap size in
+ * the trace if enough has been freed since it was last recorded.
+ */
+static inline void
+account_free(struct heap_allocator *a, size_t size)
+{
+	a->live -= size;
+	if (size < a->until_free_sample)
+	{
+		a->until_free_sample -= size;
+		return;
+	}
+	a->until_free_sample = ALLOC_SAMPLE_BYTES;
+	TRACE('C', "heap_bytes", a->live);
+}
+
+/**
+ * Returns the size class that an allocation of `size` bytes uses.
+ */
+static inline int
+size_class(size_t size)
+{
+	return (size + sizeof(struct block_header) - 1) / POOL_GRANULE;
+}
+
+/**
+ * Returns the usable size of blocks in the specified size class.
+ */
+static inline size_t
+class_size(int cls)
+{
+	return ((cls + 1) * POOL_GRANULE) - sizeof(struct block_header);
+}
+
+/**
+ * Allocate a new block in the specified size class, either by recycling a
+ * free block or by bumping the pointer in the current chunk.
+ */
+static struct block_header *
+pool_alloc(struct heap_allocator *a, int cls)
+{
+	struct free_block *f = a->free_lists[cls];
+	if (f != NULL)
+	{
+		a->free_lists[cls] = f->next;
+		return (struct block_header*)f;
+	}
+	size_t block_size = (cls + 1) * POOL_GRANULE;
+	if ((size_t)(a->bump_end - a->bump) < block_size)
+	{
+		// Any space at the end of the old chunk is wasted.  It's at most
+		// one block of the largest class.
+		struct chunk *c = malloc(POOL_CHUNK_SIZE);
+		if (c == NULL)
+		{
+			return NULL;
+		}
+		c->next = a->chunks;
+		a->chunks = c;
+		a->bump = (char*)(c+1);
+		a->bump_end = (char*)c + POOL_CHUNK_SIZE;
+	}
+	struct block_header *h = (struct block_header*)a->bump;
+	a->bump += block_size;
+	return h;
+}
+
+/**
+ * Duktape allocation function.
+ */
+static void *
+heap_alloc(void *udata, duk_size_t size)
+{
+	struct heap_allocator *a = udata;
+	struct block_header *h;
+	if (size <= POOL_MAX)
+	{
+		int cls = size_class(size);
+		h = pool_alloc(a, cls);
+		size = class_size(cls);
+	}
+	else
+	{
+		h = malloc(sizeof(struct block_header) + size);
+	}
+	if (h == NULL)
+	{
+		return NULL;
+	}
+	h->size = size;
+	account_alloc(a, size);
+	return h+1;
+}
+
+/**
+ * Duktape free function.
+ */
+static void
+heap_free(void *udata, void *ptr)
+{
+	struct heap_allocator *a = udata;
+	if (ptr == NULL)
+	{
+		return;
+	}
+	struct block_header *h = (struct block_header*)ptr - 1;
+	account_free(a, h->size);
+	if (h->size > POOL_MAX)
+	{
+		free(h);
+		return;
+	}
+	int cls = size_class(h->size);
+	struct free_block *f = (struct free_block*)h;
+	f->next = a->free_lists[cls];
+	a->free_lists[cls] = f;
+}
+
+/**
+ * Duktape reallocation function.
+ */
+static void *
+heap_realloc(void *udata, void *ptr, duk_size_t size)
+{
+	if (ptr == NULL)
+	{
+		return heap_alloc(udata, size);
+	}
+	struct block_header *h = (struct block_header*)ptr - 1;
+	size_t old_size = h->size;
+	// Growing or shrinking a large allocation stays in malloc().
+	if ((old_size > POOL_MAX) && (size > POOL_MAX))
+	{
+		h = realloc(h, sizeof(struct block_header) + size);
+		if (h == NULL)
+		{
+			return NULL;
+		}
+		h->size = size;
+		struct heap_allocator *a = udata;
+		if (size < old_size)
+		{
+			account_free(a, old_size - size);
+		}
+		else
+		{
+			account_alloc(a, size - old_size);
+		}
+		return h+1;
+	}
+	// If the new size is in the same class, then there's nothing to do.
+	if ((old_size <= POOL_MAX) && (size <= POOL_MAX) &&
+	    (size_class(size) == size_class(old_size)))
+	{
+		return ptr;
+	}
+	void *new_ptr = heap_alloc(udata, size);
+	if (new_ptr == NULL)
+	{
+		return NULL;
+	}
+	memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+	heap_free(udata, ptr);
+	return new_ptr;
+}
+
+duk_context *
+create_heap(void)
+{
+	struct heap_allocator *a = calloc(sizeof(struct heap_allocator), 1);
+	if (a == NULL)
+	{
+		return NULL;
+	}
+	a->until_sample = ALLOC_SAMPLE_BYTES;
+	a->until_free_sample = ALLOC_SAMPLE_BYTES;
+	duk_context *ctx =
+		duk_create_heap(heap_alloc, heap_realloc, heap_free, a, NULL);
+	if (ctx == NULL)
+	{
+		free(a);
+		return NULL;
+	}
+	a->ctx = ctx;
+	return ctx;
+}
+
+void
+destroy_heap(duk_context *ctx)
+{
+	if (ctx == NULL)
+	{
+		return;
+	}
+	duk_memory_functions funcs;
+	duk_get_memory_functions(ctx, &funcs);
+	struct heap_allocator *a = funcs.udata;
+	assert(funcs.alloc_func == heap_alloc);
+	// Finalisers may run during destruction, but the call stack can't be
+	// inspected once teardown has started.
+	a->ctx = NULL;
+	// Plain buffers in the heap may point at shared memory until it is
+	// destroyed.
+	struct shared_buffer **shared = take_heap_shared_buffers(ctx);
+	// Objects still alive are freed back into the pools when the heap is
+	// destroyed, so the chunks can only be released afterwards.
+	duk_destroy_heap(ctx);
+	release_shared_buffers(shared);
+	struct chunk *c = a->chunks;
+	while (c != NULL)
+	{
+		struct chunk *next = c->next;
+		free(c);
+		c = next;
+	}
+	free(a);
+}
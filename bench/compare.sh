@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# Run bench/harness.js with two jsrun binaries and print their results side
+# by side.  Run it from the top of the tree:
+#
+#	$ bench/compare.sh ./jsrun-old ./jsrun [runs] [warmup]
+#
+# Each benchmark row shows the median and 90th percentile run times for both
+# builds and the change in the median from the first to the second.
+
+if [ $# -lt 2 ] ; then
+	echo "Usage: $0 jsrun-a jsrun-b [runs] [warmup]" >&2
+	exit 1
+fi
+JSRUN_A=$1
+JSRUN_B=$2
+shift 2
+
+OUT_A=`mktemp`
+OUT_B=`mktemp`
+trap 'rm -f $OUT_A $OUT_B' EXIT
+
+$JSRUN_A bench/harness.js "$@" > $OUT_A || exit 1
+$JSRUN_B bench/harness.js "$@" > $OUT_B || exit 1
+
+echo "A: $JSRUN_A"
+echo "B: $JSRUN_B"
+awk -F, '
+	FNR == 1 { next }
+	NR == FNR { median[$1] = $4; p90[$1] = $6; next }
+	$1 in median {
+		change = median[$1] > 0 ? ($4 - median[$1]) * 100 / median[$1] : 0
+		printf "%-18s %10.2f %10.2f %10.2f %10.2f %+8.1f%%\n", $1,
+		       median[$1], p90[$1], $4, $6, change
+	}
+	BEGIN {
+		printf "%-18s %10s %10s %10s %10s %9s\n", "benchmark",
+		       "A median", "A p90", "B median", "B p90", "change"
+	}' $OUT_A $OUT_B
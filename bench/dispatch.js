@@ -0,0 +1,77 @@
+/*
+ * CPU-bound scripts that spend almost all of their time in the bytecode
+ * dispatch loop, for comparing switch and threaded dispatch (see the
+ * bench-dispatch make target).  Each test prints its run time in
+ * milliseconds.
+ */
+
+function time(name, fn)
+{
+	var start = Date.now();
+	var result = fn();
+	print(name, Date.now() - start, 'ms', '(' + result + ')');
+}
+
+time('fib', function() {
+	function fib(n)
+	{
+		return n < 2 ? n : fib(n - 1) + fib(n - 2);
+	}
+	return fib(27);
+});
+
+time('loops', function() {
+	var total = 0;
+	for (var i=0 ; i<3000000 ; i++)
+	{
+		total = (total + (i ^ (i >> 3))) & 0xffffff;
+	}
+	return total;
+});
+
+time('sieve', function() {
+	var count = 0;
+	for (var round=0 ; round<10 ; round++)
+	{
+		var composite = [];
+		count = 0;
+		for (var i=2 ; i<100000 ; i++)
+		{
+			if (!composite[i])
+			{
+				count++;
+				for (var j=i*2 ; j<100000 ; j+=i)
+				{
+					composite[j] = true;
+				}
+			}
+		}
+	}
+	return count;
+});
+
+time('properties', function() {
+	var o = { a: 1, b: 2, c: 3 };
+	for (var i=0 ; i<1000000 ; i++)
+	{
+		o.a = o.b + o.c;
+		o.b = o.a - o.c;
+		o.c = (o.c + 1) % 7;
+	}
+	return o.a + o.b + o.c;
+});
+
+time('closures', function() {
+	function counter()
+	{
+		var n = 0;
+		return function() { return ++n; };
+	}
+	var c = counter();
+	var total = 0;
+	for (var i=0 ; i<1000000 ; i++)
+	{
+		total += c() & 1;
+	}
+	return total;
+});
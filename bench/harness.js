@@ -0,0 +1,218 @@
+/*
+ * Interpreter and startup benchmarks.  Each benchmark is run a few times to
+ * warm up and then timed over repeated runs, and the distribution of run
+ * times is printed as CSV:
+ *
+ *	benchmark,runs,min_ms,median_ms,mean_ms,p90_ms,max_ms
+ *
+ * The startup benchmark times creating a worker (a new heap, the default
+ * objects and a trivial script) until its first message arrives.  The
+ * require benchmarks load a JavaScript module and, if it has been built, a
+ * native module.  The remaining benchmarks are CPU-bound kernels.
+ *
+ * Run it from the top of the tree, with optional run and warmup counts:
+ *
+ *	$ ./jsrun bench/harness.js [runs] [warmup]
+ *
+ * `make bench-interp` builds the native module and runs this, and
+ * bench/compare.sh compares two builds.
+ */
+
+var RUNS = program_arguments.length > 0 ? parseInt(program_arguments[0]) : 10;
+var WARMUP = program_arguments.length > 1 ? parseInt(program_arguments[1]) : 2;
+var JS_MODULE = 'bench/harness_module';
+var NATIVE_MODULE = 'bench/native_module';
+var STARTUP_WORKER = 'bench/harness_worker.js';
+var STARTUP_BATCH = 16;
+
+function percentile(sorted, p)
+{
+	return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+}
+
+function report(name, times)
+{
+	var sorted = times.slice().sort(function(a, b) { return a - b; });
+	var total = 0;
+	sorted.forEach(function(t) { total += t; });
+	print([ name, sorted.length, sorted[0].toFixed(2),
+	        percentile(sorted, 0.5).toFixed(2),
+	        (total / sorted.length).toFixed(2),
+	        percentile(sorted, 0.9).toFixed(2),
+	        sorted[sorted.length - 1].toFixed(2) ].join(','));
+}
+
+/**
+ * Time a synchronous benchmark.  `fn` is called once per run and should take
+ * a few tens of milliseconds, as the timer has millisecond resolution.
+ */
+function measure(name, fn)
+{
+	var times = [];
+	for (var i=0 ; i<WARMUP + RUNS ; i++)
+	{
+		var start = Date.now();
+		fn();
+		if (i >= WARMUP)
+		{
+			times.push(Date.now() - start);
+		}
+	}
+	report(name, times);
+}
+
+function requireFresh(id)
+{
+	delete Duktape.modLoaded[id];
+	return require(id);
+}
+
+var kernels = {
+	'require-js': function() {
+		for (var i=0 ; i<200 ; i++)
+		{
+			requireFresh(JS_MODULE);
+		}
+	},
+	'require-native': function() {
+		for (var i=0 ; i<2000 ; i++)
+		{
+			requireFresh(NATIVE_MODULE);
+		}
+	},
+	'property-access': function() {
+		var objects = [];
+		for (var i=0 ; i<1000 ; i++)
+		{
+			objects.push({ id: i, size: i * 512, mode: i & 0777, name: 'f' + i });
+		}
+		var total = 0;
+		for (var round=0 ; round<200 ; round++)
+		{
+			for (var i=0 ; i<objects.length ; i++)
+			{
+				var o = objects[i];
+				total = (total + o.id + o.size + o.mode) & 0xffffff;
+			}
+		}
+		return total;
+	},
+	'string-building': function() {
+		var s = '';
+		for (var i=0 ; i<5000 ; i++)
+		{
+			s += 'item ' + i + ';';
+		}
+		var parts = [];
+		for (var i=0 ; i<50000 ; i++)
+		{
+			parts.push(String.fromCharCode(97 + (i % 26)));
+		}
+		return s.length + parts.join('').length;
+	},
+	'json': function() {
+		var records = [];
+		for (var i=0 ; i<2000 ; i++)
+		{
+			records.push({ id: i, name: 'record ' + i, tags: [ 'a', 'b', 'c' ],
+			               nested: { x: i * 0.5, ok: (i & 1) == 0 } });
+		}
+		var total = 0;
+		for (var round=0 ; round<5 ; round++)
+		{
+			total += JSON.parse(JSON.stringify(records)).length;
+		}
+		return total;
+	},
+	'regexp': function() {
+		var lines = [];
+		for (var i=0 ; i<2000 ; i++)
+		{
+			lines.push('2015-06-' + (10 + (i % 20)) + ' host' + i +
+			           ' GET /index.html 200 ' + (i * 7));
+		}
+		var re = /^(\d+)-(\d+)-(\d+) (\w+) (GET|POST) (\S+) (\d+) (\d+)$/;
+		var total = 0;
+		for (var round=0 ; round<3 ; round++)
+		{
+			for (var i=0 ; i<lines.length ; i++)
+			{
+				var m = re.exec(lines[i]);
+				total += m[8].length;
+				total += lines[i].replace(/host/g, 'node').length;
+			}
+		}
+		return total;
+	},
+	'array-sort': function() {
+		var numbers = [];
+		var seed = 42;
+		for (var i=0 ; i<20000 ; i++)
+		{
+			seed = (seed * 1103515245 + 12345) & 0x7fffffff;
+			numbers.push(seed);
+		}
+		numbers.sort(function(a, b) { return a - b; });
+		var strings = numbers.slice(0, 10000).map(function(n) { return 'k' + n; });
+		strings.sort();
+		return numbers[0] + strings.length;
+	}
+};
+
+/**
+ * Time worker startup.  Workers are started one at a time, and each run
+ * reports the mean time from construction to first message over a batch.
+ */
+function startup(done)
+{
+	var times = [];
+	var run = 0;
+	var batch = [];
+	var batchStart;
+	function next()
+	{
+		if (batch.length == 0)
+		{
+			batchStart = Date.now();
+		}
+		var w = new Worker(STARTUP_WORKER);
+		batch.push(w);
+		w.onMessage = function() {
+			if (batch.length < STARTUP_BATCH)
+			{
+				next();
+				return;
+			}
+			if (run++ >= WARMUP)
+			{
+				times.push((Date.now() - batchStart) / STARTUP_BATCH);
+			}
+			batch.forEach(function(w) {
+				w.terminate();
+				w.postMessage('exit');
+			});
+			batch = [];
+			if (run < WARMUP + RUNS)
+			{
+				next();
+				return;
+			}
+			report('startup', times);
+			done();
+		};
+	}
+	next();
+}
+
+print('benchmark,runs,min_ms,median_ms,mean_ms,p90_ms,max_ms');
+startup(function() {
+	for (var name in kernels)
+	{
+		if (name == 'require-native' && !Duktape.loadNativeModule(NATIVE_MODULE + '.so'))
+		{
+			alert('skipping require-native: build it with make bench-interp');
+			continue;
+		}
+		measure(name, kernels[name]);
+	}
+});
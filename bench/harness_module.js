@@ -0,0 +1,47 @@
+/*
+ * Module loaded by the require-js benchmark in bench/harness.js.  It is
+ * representative of a small library: a handful of functions and some
+ * top-level initialisation.
+ */
+
+var table = [];
+for (var i=0 ; i<64 ; i++)
+{
+	table.push(i * i);
+}
+
+function clamp(value, min, max)
+{
+	return value < min ? min : (value > max ? max : value);
+}
+
+function pad(str, width)
+{
+	while (str.length < width)
+	{
+		str = ' ' + str;
+	}
+	return str;
+}
+
+function Counter(name)
+{
+	this.name = name;
+	this.count = 0;
+}
+
+Counter.prototype.increment = function(n)
+{
+	this.count += n === undefined ? 1 : n;
+	return this;
+};
+
+Counter.prototype.toString = function()
+{
+	return pad(this.name, 16) + ': ' + this.count;
+};
+
+exports.clamp = clamp;
+exports.pad = pad;
+exports.Counter = Counter;
+exports.square = function(i) { return table[clamp(i, 0, 63)]; };
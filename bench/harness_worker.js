@@ -0,0 +1,4 @@
+/*
+ * Worker used by the startup benchmark in bench/harness.js.
+ */
+postMessage('ready');
@@ -0,0 +1,40 @@
+/*
+ * JSON throughput on documents shaped like our worker messages: an array of
+ * a few thousand records (a few hundred KB of text) with string, integer,
+ * floating point and boolean fields.  Prints the time taken to parse and to
+ * serialise the document repeatedly, in milliseconds.  Run it from the top of
+ * the tree:
+ *
+ *	$ ./jsrun bench/json.js
+ */
+
+var records = [];
+for (var i=0 ; i<2500 ; i++)
+{
+	records.push({
+		id: i,
+		name: 'record number ' + i,
+		description: 'a somewhat longer string value, as found in real data',
+		path: '/var/db/records/' + (i % 97) + '/' + i + '.json',
+		score: i * 0.25,
+		count: i * 1000,
+		active: (i % 2) == 0,
+		tags: ['alpha', 'beta', 'gamma']
+	});
+}
+var text = JSON.stringify(records);
+var start = Date.now();
+var total = 0;
+for (var j=0 ; j<50 ; j++)
+{
+	total += JSON.parse(text).length;
+}
+print('json', text.length, 'bytes', total, 'records', Date.now() - start, 'ms');
+
+start = Date.now();
+total = 0;
+for (var j=0 ; j<50 ; j++)
+{
+	total += JSON.stringify(records).length;
+}
+print('stringify', total, 'bytes', Date.now() - start, 'ms');
@@ -0,0 +1,50 @@
+/*
+ * Message dispatch tail latency with a large, long-lived heap.  The main
+ * thread holds a routing table of many small objects (which every full
+ * collection must mark) and a worker sends it bursts of timestamped
+ * messages separated by idle periods.  Handling each message allocates
+ * garbage, including reference cycles that only the mark-and-sweep
+ * collector can free, so collections happen while messages are being
+ * dispatched.  Prints latency percentiles in milliseconds.  Run it from
+ * the top of the tree:
+ *
+ *	$ ./jsrun bench/latency.js
+ */
+
+var routes = {};
+for (var i=0 ; i<200000 ; i++)
+{
+	var r = { id: i, name: 'route' + i, next: null };
+	r.self = r;
+	routes['r' + i] = r;
+}
+
+var latencies = [];
+var expected = 0;
+
+var worker = new Worker('bench/latency_worker.js');
+worker.onMessage = function(msg) {
+	if (msg.done)
+	{
+		latencies.sort(function(a, b) { return a - b; });
+		function percentile(p)
+		{
+			return latencies[Math.min(latencies.length - 1,
+			                          Math.floor(latencies.length * p))];
+		}
+		print('messages', latencies.length);
+		print('p50', percentile(0.5), 'ms');
+		print('p99', percentile(0.99), 'ms');
+		print('p99.9', percentile(0.999), 'ms');
+		print('max', latencies[latencies.length - 1], 'ms');
+		worker = null;
+		return;
+	}
+	latencies.push(Date.now() - msg.sent);
+	// Look up a route and create some cyclic garbage.
+	var r = routes['r' + (msg.seq % 200000)];
+	var a = { route: r.name, payload: msg.payload };
+	var b = { peer: a };
+	a.peer = b;
+};
+worker.postMessage({ bursts: 50, burstSize: 200, idleMs: 30 });
@@ -0,0 +1,23 @@
+onMessage = function(cfg) {
+	var payload = [];
+	for (var i=0 ; i<16 ; i++)
+	{
+		payload.push('field' + i);
+	}
+	var seq = 0;
+	var due = Date.now();
+	for (var b=0 ; b<cfg.bursts ; b++)
+	{
+		// Stamp messages with the time that the burst was due, rather than
+		// the time that they were sent, so that time spent blocked sending
+		// (while the receiver holds its queue lock) counts as latency.
+		for (var i=0 ; i<cfg.burstSize ; i++)
+		{
+			postMessage({ seq: seq++, sent: due, payload: payload });
+		}
+		// Stay idle (from the receiver's point of view) between bursts.
+		due += cfg.idleMs;
+		while (Date.now() < due) {}
+	}
+	postMessage({ done: true });
+};
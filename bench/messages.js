@@ -0,0 +1,26 @@
+/*
+ * Message throughput.  A worker streams structured messages to the main
+ * thread, which decodes each one, reads a few fields and drops it, so almost
+ * every allocation is short-lived.  Prints the elapsed time in milliseconds.
+ * Run it from the top of the tree:
+ *
+ *	$ ./jsrun bench/messages.js
+ */
+
+var start = Date.now();
+var received = 0;
+var total = 0;
+var worker = new Worker('bench/messages_worker.js');
+worker.onMessage = function(msg) {
+	if (msg.done)
+	{
+		print('messages', received, 'checksum', total,
+		      Date.now() - start, 'ms');
+		worker = null;
+		return;
+	}
+	received++;
+	msg.items.forEach(function(item) {
+		total += item.id + item.tags.length + item.name.length;
+	});
+};
@@ -0,0 +1,11 @@
+var count = 20000;
+for (var i=0 ; i<count ; i++)
+{
+	var items = [];
+	for (var j=0 ; j<8 ; j++)
+	{
+		items.push({ id: j, name: 'item ' + i + '.' + j, tags: ['a', 'b', j] });
+	}
+	postMessage({ seq: i, items: items });
+}
+postMessage({ done: true });
@@ -0,0 +1,220 @@
+/*
+ * Microbenchmarks for the worker message ports.  Each benchmark runs for
+ * several payload sizes and prints one CSV row:
+ *
+ *	benchmark,payload_bytes,workers,messages,total_ms,us_per_message
+ *
+ * The benchmarks are:
+ *
+ *	roundtrip	ping-pong between the main thread and one worker
+ *	throughput	one-way stream from one worker to the main thread
+ *	fan-in		streams from several workers to the main thread
+ *	fan-out		streams from the main thread to several workers
+ *	spawn		time from `new Worker()` to the worker's first message
+ *	idle-gc		ping-pong while other (idle, still referenced) workers
+ *			exist, so every drained queue runs the worker collector
+ *
+ * Run it from the top of the tree, or with `make bench-messaging`:
+ *
+ *	$ ./jsrun bench/messaging.js > messaging.csv
+ */
+
+var WORKER = 'bench/messaging_worker.js';
+var SIZES = [ 16, 1024, 65536 ];
+var FANOUT_WORKERS = 4;
+var IDLE_WORKERS = 8;
+var SPAWN_WORKERS = 16;
+
+/**
+ * Number of messages to send for a payload size, so that each benchmark
+ * takes a similar amount of time.
+ */
+function messagesFor(size)
+{
+	return size <= 16 ? 4000 : (size <= 1024 ? 2000 : 200);
+}
+
+function payload(size)
+{
+	return new Array(size + 1).join('x');
+}
+
+function report(name, size, workers, messages, ms)
+{
+	print([ name, size, workers, messages, ms,
+	        (ms * 1000 / messages).toFixed(2) ].join(','));
+}
+
+/**
+ * Create a worker and call `ready` with it once it has started.
+ */
+function spawn(ready)
+{
+	var w = new Worker(WORKER);
+	w.onMessage = function(msg) {
+		if (msg.ready)
+		{
+			ready(w);
+		}
+	};
+	return w;
+}
+
+function stop(workers)
+{
+	workers.forEach(function(w) {
+		w.terminate();
+		w.postMessage({ cmd: 'exit' });
+	});
+}
+
+function roundtrip(name, size, idle, next)
+{
+	var count = messagesFor(size);
+	var idleWorkers = [];
+	var started = 0;
+	function run(w)
+	{
+		var data = payload(size);
+		var remaining = count;
+		var start = Date.now();
+		w.onMessage = function(msg) {
+			if (--remaining > 0)
+			{
+				w.postMessage(msg);
+				return;
+			}
+			report(name, size, idle + 1, count, Date.now() - start);
+			stop(idleWorkers.concat([ w ]));
+			next();
+		};
+		w.postMessage({ cmd: 'echo', data: data });
+	}
+	if (idle == 0)
+	{
+		spawn(run);
+		return;
+	}
+	for (var i=0 ; i<idle ; i++)
+	{
+		idleWorkers.push(spawn(function() {
+			if (++started == idle)
+			{
+				spawn(run);
+			}
+		}));
+	}
+}
+
+function fanIn(name, size, workers, next)
+{
+	var count = messagesFor(size);
+	var per = Math.ceil(count / workers);
+	var all = [];
+	var started = 0;
+	var received = 0;
+	var start;
+	function onData(msg)
+	{
+		if (++received == per * workers)
+		{
+			report(name, size, workers, per * workers, Date.now() - start);
+			stop(all);
+			next();
+		}
+	}
+	for (var i=0 ; i<workers ; i++)
+	{
+		all.push(spawn(function(w) {
+			w.onMessage = onData;
+			if (++started == workers)
+			{
+				start = Date.now();
+				all.forEach(function(w) {
+					w.postMessage({ cmd: 'stream', count: per, size: size });
+				});
+			}
+		}));
+	}
+}
+
+function fanOut(name, size, workers, next)
+{
+	var count = messagesFor(size);
+	var per = Math.ceil(count / workers);
+	var all = [];
+	var started = 0;
+	var finished = 0;
+	var start;
+	function onDone(msg)
+	{
+		if (++finished == workers)
+		{
+			report(name, size, workers, per * workers, Date.now() - start);
+			stop(all);
+			next();
+		}
+	}
+	for (var i=0 ; i<workers ; i++)
+	{
+		all.push(spawn(function(w) {
+			w.onMessage = onDone;
+			if (++started == workers)
+			{
+				var data = payload(size);
+				start = Date.now();
+				for (var j=0 ; j<per ; j++)
+				{
+					all.forEach(function(w) {
+						w.postMessage({ cmd: 'sink', data: data,
+						                last: j == per - 1 });
+					});
+				}
+			}
+		}));
+	}
+}
+
+function spawnLatency(next)
+{
+	var total = 0;
+	var done = 0;
+	var all = [];
+	function one()
+	{
+		var start = Date.now();
+		all.push(spawn(function(w) {
+			total += Date.now() - start;
+			if (++done < SPAWN_WORKERS)
+			{
+				one();
+				return;
+			}
+			report('spawn', 0, SPAWN_WORKERS, SPAWN_WORKERS, total);
+			stop(all);
+			next();
+		}));
+	}
+	one();
+}
+
+var benchmarks = [];
+SIZES.forEach(function(size) {
+	benchmarks.push(function(next) { roundtrip('roundtrip', size, 0, next); });
+	benchmarks.push(function(next) { fanIn('throughput', size, 1, next); });
+	benchmarks.push(function(next) { fanIn('fan-in', size, FANOUT_WORKERS, next); });
+	benchmarks.push(function(next) { fanOut('fan-out', size, FANOUT_WORKERS, next); });
+	benchmarks.push(function(next) { roundtrip('idle-gc', size, IDLE_WORKERS, next); });
+});
+benchmarks.push(spawnLatency);
+
+print('benchmark,payload_bytes,workers,messages,total_ms,us_per_message');
+function runNext()
+{
+	var b = benchmarks.shift();
+	if (b)
+	{
+		b(runNext);
+	}
+}
+runNext();
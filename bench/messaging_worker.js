@@ -0,0 +1,31 @@
+/*
+ * Worker side of bench/messaging.js.
+ */
+
+function payload(size)
+{
+	return new Array(size + 1).join('x');
+}
+
+onMessage = function(msg) {
+	switch (msg.cmd)
+	{
+		case 'echo':
+			postMessage(msg);
+			break;
+		case 'stream':
+			var data = payload(msg.size);
+			for (var i=0 ; i<msg.count ; i++)
+			{
+				postMessage({ data: data });
+			}
+			break;
+		case 'sink':
+			if (msg.last)
+			{
+				postMessage({ done: true });
+			}
+			break;
+	}
+};
+postMessage({ ready: true });
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2015 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * Native module loaded by the require-native benchmark in bench/harness.js.
+ * It has the same shape as the modules that ffigen generates: an object with
+ * some functions and constants.
+ */
+#include "duktape.h"
+
+static duk_ret_t
+js_add(duk_context *ctx)
+{
+	duk_push_number(ctx, duk_require_number(ctx, 0) + duk_require_number(ctx, 1));
+	return 1;
+}
+
+static duk_ret_t
+js_length(duk_context *ctx)
+{
+	duk_size_t len;
+	duk_require_lstring(ctx, 0, &len);
+	duk_push_uint(ctx, len);
+	return 1;
+}
+
+static const duk_function_list_entry js_funcs[] = {
+	{ "add", js_add, 2 },
+	{ "length", js_length, 1 },
+	{ NULL, NULL, 0 }
+};
+
+static const duk_number_list_entry js_constants[] = {
+	{ "ANSWER", 42 },
+	{ "PAGE_SIZE", 4096 },
+	{ NULL, 0 }
+};
+
+duk_ret_t
+dukopen_module(duk_context *ctx)
+{
+	duk_push_object(ctx);
+	duk_put_function_list(ctx, -1, js_funcs);
+	duk_put_number_list(ctx, -1, js_constants);
+	return 1;
+}
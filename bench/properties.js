@@ -0,0 +1,152 @@
+/*
+ * Property reads on many objects that share a layout, as produced by FFI
+ * struct wrappers and JSON.parse(), and on objects with differing layouts,
+ * followed by a directory walk in the style of example/find_worker.js.
+ * Each test prints its run time in milliseconds.
+ */
+
+function time(name, fn)
+{
+	var start = Date.now();
+	var result = fn();
+	print(name, Date.now() - start, 'ms', '(' + result + ')');
+}
+
+function makeStat(i)
+{
+	return { st_dev: 1, st_ino: i, st_nlink: 1, st_mode: i & 0777, st_uid: 0,
+	         st_gid: 0, st_rdev: 0, st_size: i * 512, st_blksize: 4096,
+	         st_blocks: i, d_name: 'f' + i };
+}
+
+var stats = [];
+for (var i=0 ; i<1000 ; i++)
+{
+	stats.push(makeStat(i));
+}
+
+time('same layout', function() {
+	var total = 0;
+	for (var round=0 ; round<300 ; round++)
+	{
+		for (var i=0 ; i<stats.length ; i++)
+		{
+			var sb = stats[i];
+			total = (total + sb.st_mode + sb.st_size + sb.st_blocks) & 0xffffff;
+		}
+	}
+	return total;
+});
+
+var mixed = [];
+for (var i=0 ; i<1000 ; i++)
+{
+	var o = {};
+	// Four different insertion orders.
+	if (i & 1) { o.a = i; o.b = 2; } else { o.b = 2; o.a = i; }
+	if (i & 2) { o.c = 3; o.x = 0; } else { o.x = 0; o.c = 3; }
+	mixed.push(o);
+}
+
+time('mixed layouts', function() {
+	var total = 0;
+	for (var round=0 ; round<300 ; round++)
+	{
+		for (var i=0 ; i<mixed.length ; i++)
+		{
+			var o = mixed[i];
+			total = (total + o.a + o.b + o.c) & 0xffffff;
+		}
+	}
+	return total;
+});
+
+var derived = [];
+for (var i=0 ; i<1000 ; i++)
+{
+	derived.push(Object.create(stats[i]));
+}
+
+time('inherited and missing', function() {
+	var total = 0;
+	for (var round=0 ; round<300 ; round++)
+	{
+		for (var i=0 ; i<derived.length ; i++)
+		{
+			var sb = derived[i];
+			total = (total + sb.st_mode + sb.st_blocks) & 0xffffff;
+			if (sb.st_flags)
+				total++;
+		}
+	}
+	return total;
+});
+
+// A directory walk like example/find_worker.js: struct wrappers are built
+// field by field, names are read from a char array, and the walk reads
+// options and defaults that are inherited or missing.
+function Dirent(name, isdir)
+{
+	this.d_ino = name.length;
+	this.d_type = isdir ? 4 : 8;
+	this.d_name = [];
+	for (var i=0 ; i<name.length ; i++)
+	{
+		this.d_name.push(name.charCodeAt(i));
+	}
+	this.d_name.push(0);
+}
+Dirent.prototype.d_reclen = 24;
+
+var fs = { opendir: function(dir) { return dir.depth < 4 ? dir : null; } };
+fs.readdir = function(d)
+{
+	if (d.pos >= 8)
+	{
+		return null;
+	}
+	d.pos++;
+	return new Dirent('entry' + d.pos, d.pos & 1);
+};
+
+function visit(dir, options, func)
+{
+	var d = fs.opendir(dir);
+	if (!d)
+	{
+		return 0;
+	}
+	var count = 0;
+	var file = fs.readdir(d);
+	while (file)
+	{
+		var fname = '';
+		var len = file.d_name.length;
+		for (var i=0 ; i<len ; i++)
+		{
+			var c = file.d_name[i];
+			if (c == 0)
+				break;
+			fname = fname + String.fromCharCode(c);
+		}
+		count += file.d_reclen + fname.length;
+		if (options.verbose || options.filter)
+			fname = '';
+		if (file.d_type == 4)
+			count += func({ depth: dir.depth + 1, pos: 0 });
+		file = fs.readdir(d);
+	}
+	return count;
+}
+
+time('directory walk', function() {
+	var options = Object.create({ recursive: true });
+	var total = 0;
+	for (var round=0 ; round<30 ; round++)
+	{
+		total += visit({ depth: 0, pos: 0 }, options, function walk(dir) {
+			return visit(dir, options, walk);
+		});
+	}
+	return total;
+});
@@ -0,0 +1,68 @@
+/*
+ * Regular expression benchmarks, modelled on the log-scanning workers:
+ * searching for literal-prefixed patterns, splitting, anchored tests,
+ * case-insensitive matching and patterns compiled at run time.  Prints the
+ * time for each case in milliseconds.  Run it from the top of the tree:
+ *
+ *	$ ./jsrun bench/regexp.js
+ */
+
+var levels = ['INFO', 'DEBUG', 'WARN', 'INFO', 'INFO', 'DEBUG', 'ERROR'];
+var lines = [];
+for (var i=0 ; i<20000 ; i++)
+{
+	var level = levels[i % levels.length];
+	lines.push('2015-11-' + (10 + i % 20) + 'T12:' + (i % 60) + ' ' + level +
+	           ' [worker-' + (i % 8) + '] GET /api/v1/items/' + i +
+	           ' status=' + (i % 13 == 0 ? 500 : 200) + ' time=' + (i % 97) + 'ms');
+}
+var log = lines.join('\n');
+
+function bench(name, iterations, fn)
+{
+	var start = Date.now();
+	var result;
+	for (var i=0 ; i<iterations ; i++)
+	{
+		result = fn();
+	}
+	print(name, result, Date.now() - start, 'ms');
+}
+
+bench('match literal prefix', 20, function() {
+	return log.match(/ERROR \[worker-\d\]/g).length;
+});
+bench('match rare literal', 20, function() {
+	return log.match(/status=500/g).length;
+});
+bench('split lines', 20, function() {
+	return log.split(/\n/).length;
+});
+bench('replace', 10, function() {
+	return log.replace(/-/g, '_').length;
+});
+bench('anchored test', 5, function() {
+	var n = 0;
+	for (var i=0 ; i<lines.length ; i++)
+	{
+		if (/^2015-11-1/.test(lines[i]))
+		{
+			n++;
+		}
+	}
+	return n;
+});
+bench('case-insensitive', 5, function() {
+	return log.match(/error/gi).length;
+});
+bench('compiled at run time', 5, function() {
+	var n = 0;
+	for (var i=0 ; i<lines.length ; i++)
+	{
+		if (lines[i].match('worker-' + (i % 8)))
+		{
+			n++;
+		}
+	}
+	return n;
+});
@@ -0,0 +1,30 @@
+/*
+ * Worker start-up cost.  Starts many workers at once, each of which creates
+ * its own heap (interning all of the builtin names) and compiles a small
+ * script, and waits for all of them to reply.  The workers stay alive until
+ * every one has replied, so all of the heaps exist at the same time.  Prints
+ * the elapsed time in milliseconds.  Run it from the top of the tree:
+ *
+ *	$ ./jsrun bench/workers.js
+ */
+
+var count = 64;
+var start = Date.now();
+var replies = 0;
+var workers = [];
+for (var i=0 ; i<count ; i++)
+{
+	var w = new Worker('bench/workers_worker.js');
+	w.onMessage = function(msg) {
+		if (++replies == count)
+		{
+			print('workers', count, Date.now() - start, 'ms');
+			workers.forEach(function(w) {
+				w.terminate();
+				w.postMessage('exit');
+			});
+			workers = null;
+		}
+	};
+	workers.push(w);
+}
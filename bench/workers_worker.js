@@ -0,0 +1,4 @@
+var point = { x: 1, y: 2, name: 'origin', visible: true };
+var keys = Object.keys(point).concat(Object.getOwnPropertyNames(Math));
+postMessage({ keys: keys.length, length: JSON.stringify(point).length });
+onMessage = function(msg) {};
@@ -0,0 +1,98 @@
+/*
+ * Representative workload for profile-guided builds.  It exercises the
+ * interpreter's hot paths (integer and floating point arithmetic, property
+ * access, closures, strings, JSON, regular expressions and typed arrays) and
+ * round trips messages through a worker.  Run it from the top of the tree:
+ *
+ *	$ ./jsrun bench/workload.js
+ */
+
+function fib(n)
+{
+	return n < 2 ? n : fib(n - 1) + fib(n - 2);
+}
+
+function objects()
+{
+	var points = [];
+	for (var i=0 ; i<20000 ; i++)
+	{
+		points.push({ x: i, y: i * 0.5, name: 'p' + i });
+	}
+	var sum = 0;
+	points.forEach(function(p) { sum += p.x * p.y; });
+	points.sort(function(a, b) { return b.y - a.y; });
+	return sum + points[0].x;
+}
+
+function strings()
+{
+	var parts = [];
+	for (var i=0 ; i<5000 ; i++)
+	{
+		parts.push('item-' + i.toString(16));
+	}
+	var joined = parts.join(',');
+	var matches = joined.match(/item-[a-f]+,/g);
+	return joined.split(',').length + matches.length +
+		joined.replace(/-/g, '_').indexOf('item_ff');
+}
+
+function json()
+{
+	var value = { list: [], map: {} };
+	for (var i=0 ; i<2000 ; i++)
+	{
+		value.list.push({ id: i, label: 'entry ' + i, ok: (i % 3) == 0 });
+		value.map['k' + i] = [i, i * 2, 'v\n' + i];
+	}
+	var total = 0;
+	for (var j=0 ; j<10 ; j++)
+	{
+		total += JSON.parse(JSON.stringify(value)).list.length;
+	}
+	return total;
+}
+
+function typedArrays()
+{
+	var a = new Float64Array(4096);
+	var b = new Float64Array(4096);
+	var c = new Int32Array(4096);
+	for (var i=0 ; i<a.length ; i++)
+	{
+		a[i] = i;
+		b[i] = a.length - i;
+		c[i] = i * 7;
+	}
+	var total = 0;
+	for (var j=0 ; j<200 ; j++)
+	{
+		ArrayOps.fma(a, a, b, a);
+		ArrayOps.mul(b, b, a);
+		total += ArrayOps.sum(c) + ArrayOps.indexOf(c, j * 7);
+	}
+	return total;
+}
+
+var start = Date.now();
+print('fib', fib(27));
+print('objects', objects());
+print('strings', strings());
+print('json', json());
+print('typed arrays', typedArrays());
+
+var worker = new Worker('bench/workload_worker.js');
+var remaining = 1000;
+worker.onMessage = function(msg) {
+	if (--remaining > 0)
+	{
+		worker.postMessage(msg);
+	}
+	else
+	{
+		print('messages', msg.count, Date.now() - start, 'ms');
+		worker = null;
+	}
+};
+worker.postMessage({ count: 0, payload: 'x' });
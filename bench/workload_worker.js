@@ -0,0 +1,4 @@
+onMessage = function(msg) {
+	msg.count++;
+	postMessage(msg);
+};
@@ -1899,6 +1899,9 @@ typedef FILE duk_file;
 #if !defined(DUK_MEMCMP)
 #define DUK_MEMCMP       memcmp
 #endif
+#if !defined(DUK_MEMCHR)
+#define DUK_MEMCHR       memchr
+#endif
 #if !defined(DUK_MEMSET)
 #define DUK_MEMSET       memset
 #endif
@@ -2867,11 +2870,29 @@ typedef FILE duk_file;
 #define DUK_USE_EXEC_INDIRECT_BOUND_CHECK
 #endif
 
+/* Threaded opcode dispatch needs labels-as-values (GCC and Clang).  Debug
+ * and assertion builds check invariants at the top of the dispatch loop
+ * before every instruction, so they always dispatch through the switch.
+ */
+#undef DUK_USE_EXEC_COMPUTED_GOTO
+#if defined(DUK_OPT_EXEC_COMPUTED_GOTO) && (defined(DUK_F_GCC) || defined(DUK_F_CLANG)) && \
+    !defined(DUK_OPT_DEBUG) && !defined(DUK_OPT_ASSERTIONS)
+#define DUK_USE_EXEC_COMPUTED_GOTO
+#endif
+
 #undef DUK_USE_EXEC_TIMEOUT_CHECK
 #if defined(DUK_OPT_EXEC_TIMEOUT_CHECK)
 #define DUK_USE_EXEC_TIMEOUT_CHECK(udata)  DUK_OPT_EXEC_TIMEOUT_CHECK((udata))
 #endif
 
+/* Sampling hook, called from the executor interrupt so that a profiler can
+ * inspect the call stack (with duk_get_stack_frame()) at a safe point.
+ */
+#undef DUK_USE_EXEC_SAMPLE_HOOK
+#if defined(DUK_OPT_EXEC_SAMPLE_HOOK)
+#define DUK_USE_EXEC_SAMPLE_HOOK(udata,ctx)  DUK_OPT_EXEC_SAMPLE_HOOK((udata), (ctx))
+#endif
+
 #undef DUK_USE_EXTSTR_FREE
 #if defined(DUK_OPT_EXTERNAL_STRINGS) && defined(DUK_OPT_EXTSTR_FREE)
 #define DUK_USE_EXTSTR_FREE(udata,ptr) DUK_OPT_EXTSTR_FREE((udata), (ptr))
@@ -2953,6 +2974,13 @@ typedef FILE duk_file;
 #undef DUK_USE_HOBJECT_HASH_PART
 #endif
 
+/* Per-heap cache of entry part indices for property lookups in small objects. */
+#if defined(DUK_OPT_NO_PROPERTY_CACHE)
+#undef DUK_USE_PROPERTY_CACHE
+#else
+#define DUK_USE_PROPERTY_CACHE
+#endif
+
 #if defined(DUK_OPT_EXTERNAL_STRINGS)
 #define DUK_USE_HSTRING_EXTDATA
 #elif defined(DUK_OPT_NO_EXTERNAL_STRINGS)
@@ -2961,7 +2989,7 @@ typedef FILE duk_file;
 #undef DUK_USE_HSTRING_EXTDATA
 #endif
 
-#if defined(DUK_OPT_INTERRUPT_COUNTER)
+#if defined(DUK_OPT_INTERRUPT_COUNTER) || defined(DUK_OPT_EXEC_SAMPLE_HOOK)
 #define DUK_USE_INTERRUPT_COUNTER
 #elif defined(DUK_OPT_NO_INTERRUPT_COUNTER)
 #undef DUK_USE_INTERRUPT_COUNTER
@@ -2977,6 +3005,14 @@ typedef FILE duk_file;
 #define DUK_USE_JC
 #endif
 
+/* Scan JSON string literals 16 bytes at a time with SSE2, which every
+ * x86-64 target has.  Other targets use the scalar loop.
+ */
+#undef DUK_USE_JSON_SIMD
+#if defined(__SSE2__) && !defined(DUK_OPT_NO_JSON_SIMD)
+#define DUK_USE_JSON_SIMD
+#endif
+
 #if defined(DUK_OPT_JSON_STRINGIFY_FASTPATH)
 #define DUK_USE_JSON_STRINGIFY_FASTPATH
 #elif defined(DUK_OPT_NO_JSON_STRINGIFY_FASTPATH)
@@ -3176,6 +3212,15 @@ typedef FILE duk_file;
 #define DUK_USE_REFERENCE_COUNTING
 #endif
 
+/* Cache compiled regexps per heap, keyed by pattern and flags. */
+#if defined(DUK_OPT_REGEXP_CACHE)
+#define DUK_USE_REGEXP_CACHE
+#elif defined(DUK_OPT_NO_REGEXP_CACHE)
+#undef DUK_USE_REGEXP_CACHE
+#else
+#define DUK_USE_REGEXP_CACHE
+#endif
+
 #if defined(DUK_OPT_REGEXP_CANON_WORKAROUND)
 #define DUK_USE_REGEXP_CANON_WORKAROUND
 #elif defined(DUK_OPT_NO_REGEXP_CANON_WORKAROUND)
@@ -276,6 +276,7 @@ struct duk_breakpoint;
 struct duk_activation;
 struct duk_catcher;
 struct duk_strcache;
+struct duk_propcache;
 struct duk_ljstate;
 struct duk_strtab_entry;
 
@@ -331,6 +332,7 @@ typedef struct duk_breakpoint duk_breakpoint;
 typedef struct duk_activation duk_activation;
 typedef struct duk_catcher duk_catcher;
 typedef struct duk_strcache duk_strcache;
+typedef struct duk_propcache duk_propcache;
 typedef struct duk_ljstate duk_ljstate;
 typedef struct duk_strtab_entry duk_strtab_entry;
 
@@ -8628,6 +8630,7 @@ DUK_INTERNAL_DECL duk_hstring *duk_hobject_get_internal_value_string(duk_heap *h
 
 /* hobject management functions */
 DUK_INTERNAL_DECL void duk_hobject_compact_props(duk_hthread *thr, duk_hobject *obj);
+DUK_INTERNAL_DECL void duk_hobject_resize_entrypart(duk_hthread *thr, duk_hobject *obj, duk_uint32_t new_e_size);
 
 /* ES6 proxy */
 #if defined(DUK_USE_ES6_PROXY)
@@ -9210,8 +9213,15 @@ DUK_INTERNAL_DECL void duk_hbufferobject_validated_write(duk_context *ctx, duk_h
  * impact on execution performance low.
  */
 #if defined(DUK_USE_INTERRUPT_COUNTER)
+#if defined(DUK_USE_EXEC_SAMPLE_HOOK)
+/* Sampling needs an interrupt soon after each profiler tick; the hook is
+ * cheap when no sample is due.
+ */
+#define DUK_HTHREAD_INTCTR_DEFAULT     (16L * 1024L)
+#else
 #define DUK_HTHREAD_INTCTR_DEFAULT     (256L * 1024L)
 #endif
+#endif
 
 /*
  *  Assert context is valid: non-NULL pointer, fields look sane.
@@ -9885,6 +9895,15 @@ DUK_INTERNAL_DECL void duk_hbuffer_reset(duk_hthread *thr, duk_hbuffer_dynamic *
 #define DUK_HEAP_STRCACHE_SIZE                            4
 #define DUK_HEAP_STRINGCACHE_NOCACHE_LIMIT                16  /* strings up to the this length are not cached */
 
+/* Property cache is used for speeding up property reads and writes in the
+ * bytecode executor.  Size must be a power of two.  After an instruction
+ * has had to fall back to the generic path, its next BACKOFF cache misses
+ * go straight to the generic path without searching the object first.
+ */
+#define DUK_HEAP_PROPCACHE_SIZE                           1024
+#define DUK_HEAP_PROPCACHE_WAYS                           2
+#define DUK_HEAP_PROPCACHE_BACKOFF                        16
+
 /* helper to insert a (non-string) heap object into heap allocated list */
 #define DUK_HEAP_INSERT_INTO_HEAP_ALLOCATED(heap,hdr)     duk_heap_insert_into_heap_allocated((heap),(hdr))
 
@@ -10056,6 +10075,30 @@ struct duk_strcache {
 	duk_uint32_t cidx;
 };
 
+/*
+ *  Property cache, acting as inline caches for the GETPROP and PUTPROP
+ *  instructions.  Each entry is tagged with the address of an instruction
+ *  and remembers the entry part indices at which that instruction last found
+ *  its key, either in the object itself or in one of its prototypes.
+ *  Objects built in the same order (by the same constructor, object literal
+ *  or FFI struct wrapper) store a key at the same index, so the index acts
+ *  as a cache keyed on object layout: a hit costs one key comparison at the
+ *  cached index instead of a property lookup.  Entries also count down the
+ *  misses to skip after the instruction last needed the generic path.
+ *
+ *  Entries are only hints and are always validated against the object being
+ *  accessed, so they never need to be invalidated when objects or bytecode
+ *  are modified or freed.  The instruction pointer is never dereferenced.
+ */
+
+#if defined(DUK_USE_PROPERTY_CACHE)
+struct duk_propcache {
+	const duk_instr_t *pc;
+	duk_uint32_t e_idx[DUK_HEAP_PROPCACHE_WAYS];  /* most recently used first */
+	duk_uint32_t backoff;                         /* misses left to skip */
+};
+#endif
+
 /*
  *  Longjmp state, contains the information needed to perform a longjmp.
  *  Longjmp related values are written to value1, value2, and iserror.
@@ -10244,6 +10287,21 @@ struct duk_heap {
 	 */
 	duk_strcache strcache[DUK_HEAP_STRCACHE_SIZE];
 
+#if defined(DUK_USE_PROPERTY_CACHE)
+	/* property access cache (instruction -> likely entry part index) */
+	duk_propcache propcache[DUK_HEAP_PROPCACHE_SIZE];
+#endif
+
+	/* decaying size of recent JSON encoder results, used to size the
+	 * output buffer of the next encode
+	 */
+	duk_size_t json_enc_size_hint;
+
+#if defined(DUK_USE_REGEXP_CACHE)
+	/* number of entries in the compiled regexp cache */
+	duk_uint32_t regexp_cache_count;
+#endif
+
 	/* built-in strings */
 #if defined(DUK_USE_HEAPPTR16)
 	duk_uint16_t strs16[DUK_HEAP_NUM_STRINGS];
@@ -11248,6 +11306,14 @@ DUK_INTERNAL_DECL duk_small_int_t duk_unicode_re_is_wordchar(duk_codepoint_t cp)
 /* How large a loop detection stack to use */
 #define DUK_JSON_ENC_LOOPARRAY                64
 
+/* How many nesting levels remember the size of the last decoded object */
+#define DUK_JSON_DEC_SIZEHINTS                8
+
+/* Largest initial output buffer that the encoder sizes from previous
+ * results; buffers are zeroed, so an oversized one costs every encode
+ */
+#define DUK_JSON_ENC_SIZEHINT_MAX             (256L * 1024L)
+
 /* Encoding state.  Heap object references are all borrowed. */
 typedef struct {
 	duk_hthread *thr;
@@ -11291,6 +11357,7 @@ typedef struct {
 #endif
 	duk_int_t recursion_depth;
 	duk_int_t recursion_limit;
+	duk_uint32_t obj_size_hint[DUK_JSON_DEC_SIZEHINTS];  /* indexed by recursion_depth */
 } duk_json_dec_ctx;
 
 #endif  /* DUK_JSON_H_INCLUDED */
@@ -32067,6 +32134,10 @@ DUK_INTERNAL duk_ret_t duk_bi_global_object_require(duk_context *ctx) {
 
 /* include removed: duk_internal.h */
 
+#if defined(DUK_USE_JSON_SIMD)
+#include <emmintrin.h>
+#endif
+
 /*
  *  Local defines and forward declarations.
  */
@@ -32084,6 +32155,7 @@ DUK_LOCAL_DECL duk_uint8_t duk__dec_get(duk_json_dec_ctx *js_ctx);
 DUK_LOCAL_DECL duk_uint8_t duk__dec_get_nonwhite(duk_json_dec_ctx *js_ctx);
 DUK_LOCAL_DECL duk_uint_fast32_t duk__dec_decode_hex_escape(duk_json_dec_ctx *js_ctx, duk_small_uint_t n);
 DUK_LOCAL_DECL void duk__dec_req_stridx(duk_json_dec_ctx *js_ctx, duk_small_uint_t stridx);
+DUK_LOCAL_DECL const duk_uint8_t *duk__dec_string_scan(duk_json_dec_ctx *js_ctx);
 DUK_LOCAL_DECL void duk__dec_string(duk_json_dec_ctx *js_ctx);
 #ifdef DUK_USE_JX
 DUK_LOCAL_DECL void duk__dec_plain_string(duk_json_dec_ctx *js_ctx);
@@ -32111,6 +32183,9 @@ DUK_LOCAL_DECL void duk__emit_stridx(duk_json_enc_ctx *js_ctx, duk_small_uint_t
 DUK_LOCAL_DECL duk_uint8_t *duk__emit_esc_auto_fast(duk_json_enc_ctx *js_ctx, duk_uint_fast32_t cp, duk_uint8_t *q);
 DUK_LOCAL_DECL duk_bool_t duk__enc_key_quotes_needed(duk_hstring *h_key);
 DUK_LOCAL_DECL void duk__enc_key_autoquote(duk_json_enc_ctx *js_ctx, duk_hstring *k);
+#if defined(DUK_USE_JSON_SIMD)
+DUK_LOCAL_DECL const duk_uint8_t *duk__enc_string_scan(const duk_uint8_t *p, const duk_uint8_t *p_end);
+#endif
 DUK_LOCAL_DECL void duk__enc_quote_string(duk_json_enc_ctx *js_ctx, duk_hstring *h_str);
 DUK_LOCAL_DECL void duk__enc_objarr_entry(duk_json_enc_ctx *js_ctx, duk_idx_t *entry_top);
 DUK_LOCAL_DECL void duk__enc_objarr_exit(duk_json_enc_ctx *js_ctx, duk_idx_t *entry_top);
@@ -32118,6 +32193,7 @@ DUK_LOCAL_DECL void duk__enc_object(duk_json_enc_ctx *js_ctx);
 DUK_LOCAL_DECL void duk__enc_array(duk_json_enc_ctx *js_ctx);
 DUK_LOCAL_DECL duk_bool_t duk__enc_value1(duk_json_enc_ctx *js_ctx, duk_idx_t idx_holder);
 DUK_LOCAL_DECL void duk__enc_value2(duk_json_enc_ctx *js_ctx);
+DUK_LOCAL_DECL void duk__enc_update_size_hint(duk_json_enc_ctx *js_ctx);
 DUK_LOCAL_DECL duk_bool_t duk__enc_allow_into_proplist(duk_tval *tv);
 DUK_LOCAL_DECL void duk__enc_double(duk_json_enc_ctx *js_ctx);
 #if defined(DUK_USE_FASTINT)
@@ -32430,12 +32506,60 @@ DUK_LOCAL duk_small_int_t duk__dec_string_escape(duk_json_dec_ctx *js_ctx, duk_u
 	return 0;
 }
 
+/* Find the first byte of a string literal that needs attention: the closing
+ * quote, a backslash, or a control character (including the NUL at the end
+ * of input).  Everything before it is copied as is.
+ */
+DUK_LOCAL const duk_uint8_t *duk__dec_string_scan(duk_json_dec_ctx *js_ctx) {
+	const duk_uint8_t *p;
+	duk_uint8_t b;
+
+	p = js_ctx->p;
+
+#if defined(DUK_USE_JSON_SIMD)
+	{
+		const __m128i quote = _mm_set1_epi8((char) DUK_ASC_DOUBLEQUOTE);
+		const __m128i backslash = _mm_set1_epi8((char) DUK_ASC_BACKSLASH);
+		const __m128i ctrl_max = _mm_set1_epi8(0x1f);
+
+		/* Only full blocks that end at or before the terminating NUL are
+		 * loaded, so we never read past the input.
+		 */
+		while (js_ctx->p_end - p >= 16) {
+			__m128i v, m;
+			int mask;
+
+			v = _mm_loadu_si128((const __m128i *) (const void *) p);
+			m = _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+			                 _mm_cmpeq_epi8(v, backslash));
+			/* Unsigned v <= 0x1f. */
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl_max), ctrl_max));
+			mask = _mm_movemask_epi8(m);
+			if (mask != 0) {
+				return p + __builtin_ctz((unsigned int) mask);
+			}
+			p += 16;
+		}
+	}
+#endif  /* DUK_USE_JSON_SIMD */
+
+	for (;;) {
+		b = *p;
+		if (b == DUK_ASC_DOUBLEQUOTE || b == DUK_ASC_BACKSLASH || b < 0x20) {
+			/* catches EOF (NUL) */
+			return p;
+		}
+		p++;
+	}
+}
+
 DUK_LOCAL void duk__dec_string(duk_json_dec_ctx *js_ctx) {
 	duk_hthread *thr = js_ctx->thr;
 	duk_context *ctx = (duk_context *) thr;
 	duk_bufwriter_ctx bw_alloc;
 	duk_bufwriter_ctx *bw;
 	duk_uint8_t *q;
+	const duk_uint8_t *p_quote;
 
 	/* '"' was eaten by caller */
 
@@ -32444,6 +32568,18 @@ DUK_LOCAL void duk__dec_string(duk_json_dec_ctx *js_ctx) {
 	 * so they'll simply pass through (valid UTF-8 or not).
 	 */
 
+	/* Most strings (and nearly all keys) have no escapes: intern them
+	 * directly from the input, without going through a temporary buffer.
+	 * Strings with escapes (or errors) are decoded from the start by the
+	 * buffered loop below.
+	 */
+	p_quote = duk__dec_string_scan(js_ctx);
+	if (DUK_LIKELY(*p_quote == DUK_ASC_DOUBLEQUOTE)) {
+		duk_push_lstring(ctx, (const char *) js_ctx->p, (duk_size_t) (p_quote - js_ctx->p));
+		js_ctx->p = p_quote + 1;
+		return;
+	}
+
 	bw = &bw_alloc;
 	DUK_BW_INIT_PUSHBUF(js_ctx->thr, bw, DUK__JSON_DECSTR_BUFSIZE);
 	q = DUK_BW_GET_PTR(js_ctx->thr, bw);
@@ -32741,6 +32877,39 @@ DUK_LOCAL void duk__dec_number(duk_json_dec_ctx *js_ctx) {
 	js_ctx->p = p;
 
 	DUK_ASSERT(js_ctx->p > p_start);
+
+	/* Integers are by far the most common numbers in JSON data: convert
+	 * them directly, rather than interning the digits and going through
+	 * the generic number parser.  Up to 15 digits are always exact in an
+	 * IEEE double, as is every intermediate value.  Leading zeros and "-0"
+	 * are left to the generic path.
+	 */
+	{
+		const duk_uint8_t *q = p_start;
+		duk_small_int_t neg = 0;
+		duk_double_t val = 0.0;
+
+		if (*q == DUK_ASC_MINUS) {
+			neg = 1;
+			q++;
+		}
+		if (p - q >= 1 && p - q <= 15 && *q != DUK_ASC_0) {
+			for (; q < p; q++) {
+				if (*q < DUK_ASC_0 || *q > DUK_ASC_9) {
+					break;
+				}
+				val = val * 10.0 + (duk_double_t) (*q - DUK_ASC_0);
+			}
+			if (q == p) {
+				duk_push_number(ctx, neg ? -val : val);
+				return;
+			}
+		} else if (p - q == 1 && *q == DUK_ASC_0 && !neg) {
+			duk_push_int(ctx, 0);
+			return;
+		}
+	}
+
 	duk_push_lstring(ctx, (const char *) p_start, (duk_size_t) (p - p_start));
 
 	s2n_flags = DUK_S2N_FLAG_ALLOW_EXP |
@@ -32786,12 +32955,25 @@ DUK_LOCAL void duk__dec_object(duk_json_dec_ctx *js_ctx) {
 	duk_context *ctx = (duk_context *) js_ctx->thr;
 	duk_int_t key_count;  /* XXX: a "first" flag would suffice */
 	duk_uint8_t x;
+	duk_hobject *obj;
+	duk_int_t depth;
 
 	DUK_DDD(DUK_DDDPRINT("parse_object"));
 
 	duk__dec_objarr_entry(js_ctx);
 
 	duk_push_object(ctx);
+	obj = duk_get_hobject(ctx, -1);
+	DUK_ASSERT(obj != NULL);
+
+	/* Sibling objects (e.g. records in an array) usually have the same
+	 * keys, so allocate the entry part at the size of the previous object
+	 * completed at this depth rather than growing it key by key.
+	 */
+	depth = js_ctx->recursion_depth;
+	if (depth < DUK_JSON_DEC_SIZEHINTS && js_ctx->obj_size_hint[depth] > 0) {
+		duk_hobject_resize_entrypart(js_ctx->thr, obj, js_ctx->obj_size_hint[depth]);
+	}
 
 	/* Initial '{' has been checked and eaten by caller. */
 
@@ -32854,6 +33036,18 @@ DUK_LOCAL void duk__dec_object(duk_json_dec_ctx *js_ctx) {
 
 	/* [ ... obj ] */
 
+	/* Drop spare entries left by growth or a wrong size hint, so the
+	 * object is exactly sized, and remember the size for the next one.
+	 * Decoding never deletes, so all entries up to e_next are used.
+	 */
+	if (depth < DUK_JSON_DEC_SIZEHINTS) {
+		duk_uint32_t e_next = DUK_HOBJECT_GET_ENEXT(obj);
+		js_ctx->obj_size_hint[depth] = e_next;
+		if (DUK_HOBJECT_GET_ESIZE(obj) > e_next) {
+			duk_hobject_resize_entrypart(js_ctx->thr, obj, e_next);
+		}
+	}
+
 	DUK_DDD(DUK_DDDPRINT("parse_object: final object is %!T",
 	                     (duk_tval *) duk_get_tval(ctx, -1)));
 
@@ -33263,6 +33457,46 @@ DUK_LOCAL void duk__enc_key_autoquote(duk_json_enc_ctx *js_ctx, duk_hstring *k)
  * Stack policy: [ ] -> [ ].
  */
 
+#if defined(DUK_USE_JSON_SIMD)
+/* Find the end of the leading run of bytes that are emitted as is: printable
+ * ASCII other than '"' and '\\'.  Control characters, 0x7f and non-ASCII
+ * bytes (which may need escaping, depending on flags) end the run.
+ */
+DUK_LOCAL const duk_uint8_t *duk__enc_string_scan(const duk_uint8_t *p, const duk_uint8_t *p_end) {
+	const __m128i quote = _mm_set1_epi8((char) DUK_ASC_DOUBLEQUOTE);
+	const __m128i backslash = _mm_set1_epi8((char) DUK_ASC_BACKSLASH);
+	const __m128i space = _mm_set1_epi8(0x20);
+	const __m128i del = _mm_set1_epi8(0x7f);
+	duk_uint8_t b;
+
+	while (p_end - p >= 16) {
+		__m128i v, m;
+		int mask;
+
+		v = _mm_loadu_si128((const __m128i *) (const void *) p);
+		/* Signed v < 0x20 catches both control characters and bytes
+		 * >= 0x80.
+		 */
+		m = _mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del));
+		m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+		                                 _mm_cmpeq_epi8(v, backslash)));
+		mask = _mm_movemask_epi8(m);
+		if (mask != 0) {
+			return p + __builtin_ctz((unsigned int) mask);
+		}
+		p += 16;
+	}
+	while (p < p_end) {
+		b = *p;
+		if (b < 0x20 || b >= 0x7f || b == DUK_ASC_DOUBLEQUOTE || b == DUK_ASC_BACKSLASH) {
+			break;
+		}
+		p++;
+	}
+	return p;
+}
+#endif  /* DUK_USE_JSON_SIMD */
+
 DUK_LOCAL void duk__enc_quote_string(duk_json_enc_ctx *js_ctx, duk_hstring *h_str) {
 	duk_hthread *thr = js_ctx->thr;
 	const duk_uint8_t *p, *p_start, *p_end, *p_now, *p_tmp;
@@ -33285,6 +33519,18 @@ DUK_LOCAL void duk__enc_quote_string(duk_json_enc_ctx *js_ctx, duk_hstring *h_st
 	while (p < p_end) {
 		duk_size_t left, now, space;
 
+#if defined(DUK_USE_JSON_SIMD)
+		/* Copy runs that need no escaping in one go. */
+		p_tmp = duk__enc_string_scan(p, p_end);
+		if (p_tmp != p) {
+			DUK_BW_WRITE_ENSURE_BYTES(thr, &js_ctx->bw, p, (duk_size_t) (p_tmp - p));
+			p = p_tmp;
+			if (p >= p_end) {
+				break;
+			}
+		}
+#endif
+
 		left = (duk_size_t) (p_end - p);
 		now = (left > DUK__JSON_ENCSTR_CHUNKSIZE ?
 		       DUK__JSON_ENCSTR_CHUNKSIZE : left);
@@ -34836,6 +35082,24 @@ void duk_bi_json_parse_helper(duk_context *ctx,
 	DUK_ASSERT(duk_get_top(ctx) == entry_top + 1);
 }
 
+/* Update the size hint for the next result from a finished one.  The hint
+ * follows larger results at once but moves only halfway towards smaller
+ * ones, so a single large result is forgotten after a few small ones while
+ * occasional small results don't undersize a stream of large ones.
+ */
+DUK_LOCAL void duk__enc_update_size_hint(duk_json_enc_ctx *js_ctx) {
+	duk_heap *heap;
+	duk_size_t sz;
+
+	heap = js_ctx->thr->heap;
+	sz = DUK_BW_GET_SIZE(js_ctx->thr, &js_ctx->bw);
+	if (sz < heap->json_enc_size_hint) {
+		sz = heap->json_enc_size_hint - (heap->json_enc_size_hint - sz) / 2;
+	}
+	heap->json_enc_size_hint =
+	        (sz > DUK_JSON_ENC_SIZEHINT_MAX ? DUK_JSON_ENC_SIZEHINT_MAX : sz);
+}
+
 DUK_INTERNAL
 void duk_bi_json_stringify_helper(duk_context *ctx,
                                   duk_idx_t idx_value,
@@ -34937,7 +35201,13 @@ void duk_bi_json_stringify_helper(duk_context *ctx,
 		                             DUK_TYPE_MASK_LIGHTFUNC;
 	}
 
-	DUK_BW_INIT_PUSHBUF(thr, &js_ctx->bw, DUK__JSON_STRINGIFY_BUFSIZE);
+	/* Results are often similar in size to the previous ones (e.g. a stream
+	 * of messages), so start from the recent result size plus some slack,
+	 * rather than growing the buffer step by step.
+	 */
+	DUK_BW_INIT_PUSHBUF(thr, &js_ctx->bw,
+	                    DUK__JSON_STRINGIFY_BUFSIZE + thr->heap->json_enc_size_hint +
+	                    (thr->heap->json_enc_size_hint >> 2));
 
 	js_ctx->idx_loop = duk_push_object_internal(ctx);
 	DUK_ASSERT(js_ctx->idx_loop >= 0);
@@ -35090,6 +35360,7 @@ void duk_bi_json_stringify_helper(duk_context *ctx,
 #endif
 		if (pcall_rc == DUK_EXEC_SUCCESS) {
 			DUK_DD(DUK_DDPRINT("fast path successful"));
+			duk__enc_update_size_hint(js_ctx);
 			DUK_BW_PUSH_AS_STRING(thr, &js_ctx->bw);
 			goto replace_finished;
 		}
@@ -35147,6 +35418,7 @@ void duk_bi_json_stringify_helper(duk_context *ctx,
 	} else {
 		/* Finish and convert buffer to result string. */
 		duk__enc_value2(js_ctx);  /* [ ... key val ] -> [ ... ] */
+		duk__enc_update_size_hint(js_ctx);
 		DUK_BW_PUSH_AS_STRING(thr, &js_ctx->bw);
 	}
 
@@ -44135,6 +44407,19 @@ duk_heap *duk_heap_alloc(duk_alloc_function alloc_func,
 	}
 #endif
 
+	/*
+	 *  Init property cache
+	 */
+
+#if defined(DUK_USE_PROPERTY_CACHE) && defined(DUK_USE_EXPLICIT_NULL_INIT)
+	{
+		duk_small_uint_t i;
+		for (i = 0; i < DUK_HEAP_PROPCACHE_SIZE; i++) {
+			res->propcache[i].pc = NULL;
+		}
+	}
+#endif
+
 	/* XXX: error handling is incomplete.  It would be cleanest if
 	 * there was a setjmp catchpoint, so that all init code could
 	 * freely throw errors.  If that were the case, the return code
@@ -49382,6 +49667,57 @@ DUK_INTERNAL duk_uint_fast32_t duk_hobject_pc2line_query(duk_context *ctx, duk_i
 }
 
 #endif  /* DUK_USE_PC2LINE */
+
+/* Describe a call stack entry (-1 is the innermost) without touching the
+ * value stack or allocating, so that this is safe to call from an executor
+ * interrupt hook.  The returned strings are owned by the heap and may be
+ * NULL.  Returns 0 if there is no such entry.
+ */
+DUK_EXTERNAL duk_bool_t duk_get_stack_frame(duk_context *ctx, duk_int_t level, const char **out_name, const char **out_file, duk_int_t *out_line) {
+	duk_hthread *thr = (duk_hthread *) ctx;
+	duk_activation *act;
+	duk_hobject *func;
+	duk_tval *tv;
+
+	DUK_ASSERT_CTX_VALID(ctx);
+	DUK_ASSERT(out_name != NULL);
+	DUK_ASSERT(out_file != NULL);
+	DUK_ASSERT(out_line != NULL);
+
+	*out_name = NULL;
+	*out_file = NULL;
+	*out_line = 0;
+	if (level >= 0 || -level > (duk_int_t) thr->callstack_top) {
+		return 0;
+	}
+	/* Called from an allocation, the executor may not have written curr_pc
+	 * back to the innermost activation.
+	 */
+	duk_hthread_sync_currpc(thr);
+	act = thr->callstack + thr->callstack_top + level;
+	func = DUK_ACT_GET_FUNC(act);
+	if (func == NULL) {
+		return 1;
+	}
+	tv = duk_hobject_find_existing_entry_tval_ptr(thr->heap, func, DUK_HTHREAD_STRING_NAME(thr));
+	if (tv != NULL && DUK_TVAL_IS_STRING(tv)) {
+		*out_name = (const char *) DUK_HSTRING_GET_DATA(DUK_TVAL_GET_STRING(tv));
+	}
+	if (!DUK_HOBJECT_IS_COMPILEDFUNCTION(func)) {
+		return 1;
+	}
+	tv = duk_hobject_find_existing_entry_tval_ptr(thr->heap, func, DUK_HTHREAD_STRING_FILE_NAME(thr));
+	if (tv != NULL && DUK_TVAL_IS_STRING(tv)) {
+		*out_file = (const char *) DUK_HSTRING_GET_DATA(DUK_TVAL_GET_STRING(tv));
+	}
+#if defined(DUK_USE_PC2LINE)
+	tv = duk_hobject_find_existing_entry_tval_ptr(thr->heap, func, DUK_HTHREAD_STRING_INT_PC2LINE(thr));
+	if (tv != NULL && DUK_TVAL_IS_BUFFER(tv)) {
+		*out_line = (duk_int_t) duk__hobject_pc2line_query_raw(thr, (duk_hbuffer_fixed *) DUK_TVAL_GET_BUFFER(tv), duk_hthread_get_act_prev_pc(thr, act));
+	}
+#endif
+	return 1;
+}
 #line 1 "duk_hobject_props.c"
 /*
  *  Hobject property set/get functionality.
@@ -50417,6 +50753,35 @@ DUK_LOCAL void duk__abandon_array_checked(duk_hthread *thr, duk_hobject *obj) {
 	duk__realloc_props(thr, obj, new_e_size, new_a_size, new_h_size, 1);
 }
 
+/*
+ *  Resize the entry part of an object to hold exactly 'new_e_size' entries,
+ *  keeping the array part as is.  Used to allocate objects at their final
+ *  size when the number of properties is known (or predicted) before they
+ *  are added, avoiding the spare entries left by incremental growth.
+ *  'new_e_size' must be at least the number of used entries.
+ *
+ *  The call may fail due to allocation error.
+ */
+
+DUK_INTERNAL void duk_hobject_resize_entrypart(duk_hthread *thr, duk_hobject *obj, duk_uint32_t new_e_size) {
+	duk_uint32_t new_h_size;
+
+	DUK_ASSERT(thr != NULL);
+	DUK_ASSERT(obj != NULL);
+
+#if defined(DUK_USE_HOBJECT_HASH_PART)
+	if (new_e_size >= DUK_HOBJECT_E_USE_HASH_LIMIT) {
+		new_h_size = duk__get_default_h_size(new_e_size);
+	} else {
+		new_h_size = 0;
+	}
+#else
+	new_h_size = 0;
+#endif
+
+	duk__realloc_props(thr, obj, new_e_size, DUK_HOBJECT_GET_ASIZE(obj), new_h_size, 0);
+}
+
 /*
  *  Compact an object.  Minimizes allocation size for objects which are
  *  not likely to be extended.  This is useful for internal and non-
@@ -68984,6 +69349,15 @@ DUK_LOCAL duk_small_uint_t duk__executor_interrupt(duk_hthread *thr) {
 	}
 #endif  /* DUK_USE_EXEC_TIMEOUT_CHECK */
 
+#if defined(DUK_USE_EXEC_SAMPLE_HOOK)
+	/*
+	 *  Profiler sampling.  curr_pc has been synced to the activation, so
+	 *  the hook can walk the call stack.
+	 */
+
+	DUK_USE_EXEC_SAMPLE_HOOK(thr->heap->heap_udata, (duk_context *) thr);
+#endif  /* DUK_USE_EXEC_SAMPLE_HOOK */
+
 #if defined(DUK_USE_DEBUGGER_SUPPORT)
 	if (DUK_HEAP_IS_DEBUGGER_ATTACHED(thr->heap)) {
 		duk__interrupt_handle_debugger(thr, &immediate, &retval);
@@ -69214,6 +69588,159 @@ DUK_LOCAL void duk__executor_recheck_debugger(duk_hthread *thr, duk_activation *
 		thr->ptr_curr_pc = NULL; \
 	} while (0)
 
+/* Opcode dispatch.  With threaded dispatch each opcode handler ends by
+ * fetching the next instruction and jumping straight to its handler through
+ * a table of label addresses, so that every handler has its own indirect
+ * branch for the branch predictor to learn.  The switch is still used for
+ * the first instruction after a restart and whenever the interrupt counter
+ * needs attention (a 'break' out of the switch goes back to the top of the
+ * dispatch loop).  Without threaded dispatch DUK__DISPATCH() is a plain
+ * 'break'.
+ */
+#if defined(DUK_USE_EXEC_COMPUTED_GOTO)
+#define DUK__CASE(op)       case DUK_OP_##op: duk__op_##op
+#define DUK__LABEL(op)      [DUK_OP_##op] = &&duk__op_##op
+#if defined(DUK_USE_INTERRUPT_COUNTER)
+#define DUK__DISPATCH() \
+	if (DUK_UNLIKELY(thr->interrupt_counter <= 0)) { \
+		break; \
+	} \
+	thr->interrupt_counter--; \
+	ins = *curr_pc++; \
+	goto *duk__dispatch_table[DUK_DEC_OP(ins)]
+#else
+#define DUK__DISPATCH() \
+	ins = *curr_pc++; \
+	goto *duk__dispatch_table[DUK_DEC_OP(ins)]
+#endif
+#else  /* DUK_USE_EXEC_COMPUTED_GOTO */
+#define DUK__CASE(op)       case DUK_OP_##op
+#define DUK__DISPATCH()     break
+#endif  /* DUK_USE_EXEC_COMPUTED_GOTO */
+
+#if defined(DUK_USE_PROPERTY_CACHE)
+/*
+ *  Inline cache lookup for GETPROP and PUTPROP.  Looks up a string key in
+ *  the object in 'tv_obj' and its prototype chain like the generic path
+ *  does, as long as none of the objects visited has exotic behavior.
+ *
+ *  For a read ('tv_missing' non-NULL), returns a pointer to the value of the
+ *  own or inherited data property, or 'tv_missing' set to undefined if no
+ *  object in the chain has the key.  For a write ('tv_missing' NULL), returns
+ *  a pointer to the value of an own writable data property.  Returns NULL if
+ *  the instruction must take the generic path: for array index keys and
+ *  'caller', accessors, exotic objects, and writes that would add a property
+ *  or find an inherited or non-writable one.
+ *
+ *  Each object is searched at most once and only before the generic path is
+ *  known to be needed, so a fallback never pays for a second search.  After
+ *  a fallback the next DUK_HEAP_PROPCACHE_BACKOFF misses of the instruction
+ *  skip the search entirely, which keeps e.g. property additions in a
+ *  constructor from searching the object twice.
+ *
+ *  No side effects; the returned pointer is valid until the next operation
+ *  that may have side effects.
+ */
+
+DUK_LOCAL duk_tval *duk__propcache_lookup(duk_hthread *thr, const duk_instr_t *pc, duk_tval *tv_obj, duk_tval *tv_key, duk_tval *tv_missing) {
+	duk_heap *heap;
+	duk_hobject *obj;
+	duk_hobject *curr;
+	duk_hstring *key;
+	duk_propcache *ent;
+	duk_hstring **keys;
+	duk_uint_fast32_t n;
+	duk_uint_fast32_t i;
+	duk_int_t e_idx;
+	duk_int_t h_idx;
+	duk_uint_t sanity;
+	duk_small_uint_t flags;
+
+	if (!DUK_TVAL_IS_OBJECT(tv_obj) || !DUK_TVAL_IS_STRING(tv_key)) {
+		return NULL;
+	}
+	obj = DUK_TVAL_GET_OBJECT(tv_obj);
+	key = DUK_TVAL_GET_STRING(tv_key);
+	if (DUK_HOBJECT_HAS_EXOTIC_BEHAVIOR(obj) || DUK_HSTRING_HAS_ARRIDX(key)) {
+		return NULL;
+	}
+#if !defined(DUK_USE_NONSTD_FUNC_CALLER_PROPERTY)
+	if (key == DUK_HTHREAD_STRING_CALLER(thr)) {
+		/* needs the strict function check of the generic path */
+		return NULL;
+	}
+#endif
+	heap = thr->heap;
+
+	ent = &heap->propcache[((duk_size_t) pc / sizeof(duk_instr_t)) & (DUK_HEAP_PROPCACHE_SIZE - 1)];
+	if (DUK_UNLIKELY(ent->pc != pc)) {
+		ent->pc = pc;
+		ent->e_idx[0] = 0;
+		ent->e_idx[1] = 0;
+		ent->backoff = 0;
+	}
+
+	curr = obj;
+	sanity = DUK_HOBJECT_PROTOTYPE_CHAIN_SANITY;
+	for (;;) {
+		/* Every object closer to 'obj' has been searched, so a key at
+		 * a cached index here is the property the generic path finds.
+		 */
+		keys = DUK_HOBJECT_E_GET_KEY_BASE(heap, curr);
+		n = DUK_HOBJECT_GET_ENEXT(curr);
+		i = ent->e_idx[0];
+		if (DUK_LIKELY(i < n && keys[i] == key)) {
+			goto found;
+		}
+		i = ent->e_idx[1];
+		if (i < n && keys[i] == key) {
+			ent->e_idx[1] = ent->e_idx[0];
+			ent->e_idx[0] = (duk_uint32_t) i;
+			goto found;
+		}
+
+		if (curr == obj && ent->backoff > 0) {
+			ent->backoff--;
+			return NULL;
+		}
+		duk_hobject_find_existing_entry(heap, curr, key, &e_idx, &h_idx);
+		if (e_idx >= 0) {
+			i = (duk_uint_fast32_t) e_idx;
+			ent->e_idx[1] = ent->e_idx[0];
+			ent->e_idx[0] = (duk_uint32_t) i;
+			goto found;
+		}
+		if (tv_missing == NULL) {
+			/* write adding a property or calling an inherited setter */
+			goto generic;
+		}
+
+		curr = DUK_HOBJECT_GET_PROTOTYPE(heap, curr);
+		if (curr == NULL) {
+			DUK_TVAL_SET_UNDEFINED(tv_missing);
+			return tv_missing;
+		}
+		if (DUK_HOBJECT_HAS_EXOTIC_BEHAVIOR(curr) || sanity-- == 0) {
+			goto generic;
+		}
+	}
+
+ found:
+	flags = DUK_HOBJECT_E_GET_FLAGS(heap, curr, i);
+	if (flags & DUK_PROPDESC_FLAG_ACCESSOR) {
+		goto generic;
+	}
+	if (tv_missing == NULL && !(flags & DUK_PROPDESC_FLAG_WRITABLE)) {
+		goto generic;
+	}
+	return DUK_HOBJECT_E_GET_VALUE_TVAL_PTR(heap, curr, i);
+
+ generic:
+	ent->backoff = DUK_HEAP_PROPCACHE_BACKOFF;
+	return NULL;
+}
+#endif  /* DUK_USE_PROPERTY_CACHE */
+
 DUK_LOCAL void duk__handle_executor_error(duk_heap *heap,
                                           duk_hthread *entry_thread,
                                           duk_size_t entry_callstack_top,
@@ -69413,6 +69940,78 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 	duk_size_t valstack_top_base;    /* valstack top, should match before interpreting each op (no leftovers) */
 #endif
 
+#if defined(DUK_USE_EXEC_COMPUTED_GOTO)
+	/* Handler for each opcode, indexed by DUK_DEC_OP(ins).  The opcode
+	 * field is 6 bits wide and every opcode has a handler.
+	 */
+	static const void * const duk__dispatch_table[64] = {
+		DUK__LABEL(LDREG),
+		DUK__LABEL(STREG),
+		DUK__LABEL(LDCONST),
+		DUK__LABEL(LDINT),
+		DUK__LABEL(LDINTX),
+		DUK__LABEL(MPUTOBJ),
+		DUK__LABEL(MPUTOBJI),
+		DUK__LABEL(MPUTARR),
+		DUK__LABEL(MPUTARRI),
+		DUK__LABEL(NEW),
+		DUK__LABEL(NEWI),
+		DUK__LABEL(REGEXP),
+		DUK__LABEL(CSREG),
+		DUK__LABEL(CSREGI),
+		DUK__LABEL(GETVAR),
+		DUK__LABEL(PUTVAR),
+		DUK__LABEL(DECLVAR),
+		DUK__LABEL(DELVAR),
+		DUK__LABEL(CSVAR),
+		DUK__LABEL(CSVARI),
+		DUK__LABEL(CLOSURE),
+		DUK__LABEL(GETPROP),
+		DUK__LABEL(PUTPROP),
+		DUK__LABEL(DELPROP),
+		DUK__LABEL(CSPROP),
+		DUK__LABEL(CSPROPI),
+		DUK__LABEL(ADD),
+		DUK__LABEL(SUB),
+		DUK__LABEL(MUL),
+		DUK__LABEL(DIV),
+		DUK__LABEL(MOD),
+		DUK__LABEL(BAND),
+		DUK__LABEL(BOR),
+		DUK__LABEL(BXOR),
+		DUK__LABEL(BASL),
+		DUK__LABEL(BLSR),
+		DUK__LABEL(BASR),
+		DUK__LABEL(EQ),
+		DUK__LABEL(NEQ),
+		DUK__LABEL(SEQ),
+		DUK__LABEL(SNEQ),
+		DUK__LABEL(GT),
+		DUK__LABEL(GE),
+		DUK__LABEL(LT),
+		DUK__LABEL(LE),
+		DUK__LABEL(IF),
+		DUK__LABEL(JUMP),
+		DUK__LABEL(RETURN),
+		DUK__LABEL(CALL),
+		DUK__LABEL(CALLI),
+		DUK__LABEL(TRYCATCH),
+		DUK__LABEL(PREINCR),
+		DUK__LABEL(PREDECR),
+		DUK__LABEL(POSTINCR),
+		DUK__LABEL(POSTDECR),
+		DUK__LABEL(PREINCV),
+		DUK__LABEL(PREDECV),
+		DUK__LABEL(POSTINCV),
+		DUK__LABEL(POSTDECV),
+		DUK__LABEL(PREINCP),
+		DUK__LABEL(PREDECP),
+		DUK__LABEL(POSTINCP),
+		DUK__LABEL(POSTDECP),
+		DUK__LABEL(EXTRA),
+	};
+#endif
+
 	/*
 	 *  Restart execution by reloading thread state.
 	 *
@@ -69626,7 +70225,7 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 		switch ((int) DUK_DEC_OP(ins)) {
 		/* XXX: switch cast? */
 
-		case DUK_OP_LDREG: {
+		DUK__CASE(LDREG): {
 			duk_small_uint_fast_t a;
 			duk_uint_fast_t bc;
 			duk_tval *tv1, *tv2;
@@ -69634,10 +70233,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			a = DUK_DEC_A(ins); tv1 = DUK__REGP(a);
 			bc = DUK_DEC_BC(ins); tv2 = DUK__REGP(bc);
 			DUK_TVAL_SET_TVAL_UPDREF_FAST(thr, tv1, tv2);  /* side effects */
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_STREG: {
+		DUK__CASE(STREG): {
 			duk_small_uint_fast_t a;
 			duk_uint_fast_t bc;
 			duk_tval *tv1, *tv2;
@@ -69645,10 +70244,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			a = DUK_DEC_A(ins); tv1 = DUK__REGP(a);
 			bc = DUK_DEC_BC(ins); tv2 = DUK__REGP(bc);
 			DUK_TVAL_SET_TVAL_UPDREF_FAST(thr, tv2, tv1);  /* side effects */
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_LDCONST: {
+		DUK__CASE(LDCONST): {
 			duk_small_uint_fast_t a;
 			duk_uint_fast_t bc;
 			duk_tval *tv1, *tv2;
@@ -69656,10 +70255,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			a = DUK_DEC_A(ins); tv1 = DUK__REGP(a);
 			bc = DUK_DEC_BC(ins); tv2 = DUK__CONSTP(bc);
 			DUK_TVAL_SET_TVAL_UPDREF_FAST(thr, tv1, tv2);  /* side effects */
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_LDINT: {
+		DUK__CASE(LDINT): {
 			duk_small_uint_fast_t a;
 			duk_int_fast_t bc;
 			duk_tval *tv1;
@@ -69678,10 +70277,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			bc = DUK_DEC_BC(ins); val = (duk_double_t) (bc - DUK_BC_LDINT_BIAS);
 			DUK_TVAL_SET_NUMBER_UPDREF(thr, tv1, val);  /* side effects */
 #endif
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_LDINTX: {
+		DUK__CASE(LDINTX): {
 			duk_small_uint_fast_t a;
 			duk_tval *tv1;
 			duk_double_t val;
@@ -69702,11 +70301,11 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 #else
 			DUK_TVAL_SET_NUMBER(tv1, val);
 #endif
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_MPUTOBJ:
-		case DUK_OP_MPUTOBJI: {
+		DUK__CASE(MPUTOBJ):
+		DUK__CASE(MPUTOBJI): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a;
 			duk_tval *tv1;
@@ -69740,6 +70339,15 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			}
 #endif
 
+			/* Size a fresh object literal for its properties up front
+			 * instead of growing it with spare entries.  Literals with
+			 * many properties are split over several MPUTOBJs, and
+			 * only the first one sizes the object.
+			 */
+			if (DUK_HOBJECT_GET_ENEXT(obj) == 0 && DUK_HOBJECT_GET_ESIZE(obj) < count) {
+				duk_hobject_resize_entrypart(thr, obj, (duk_uint32_t) count);
+			}
+
 			duk_push_hobject(ctx, obj);
 
 			while (count > 0) {
@@ -69755,11 +70363,11 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			}
 
 			duk_pop(ctx);  /* [... obj] -> [...] */
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_MPUTARR:
-		case DUK_OP_MPUTARRI: {
+		DUK__CASE(MPUTARR):
+		DUK__CASE(MPUTARRI): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a;
 			duk_tval *tv1;
@@ -69831,11 +70439,11 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			duk_hobject_set_length(thr, obj, (duk_uint32_t) arr_idx);
 
 			duk_pop(ctx);  /* [... obj] -> [...] */
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_NEW:
-		case DUK_OP_NEWI: {
+		DUK__CASE(NEW):
+		DUK__CASE(NEWI): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t c = DUK_DEC_C(ins);
 			duk_uint_fast_t idx;
@@ -69888,10 +70496,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			 * status after returning.  This is now handled by call handling
 			 * and heap->dbg_force_restart.
 			 */
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_REGEXP: {
+		DUK__CASE(REGEXP): {
 #ifdef DUK_USE_REGEXP_SUPPORT
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
@@ -69915,11 +70523,11 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			DUK__INTERNAL_ERROR("no regexp support");
 #endif
 
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_CSREG:
-		case DUK_OP_CSREGI: {
+		DUK__CASE(CSREG):
+		DUK__CASE(CSREGI): {
 			/*
 			 *  Assuming a register binds to a variable declared within this
 			 *  function (a declarative binding), the 'this' for the call
@@ -69960,10 +70568,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			duk_replace(ctx, (duk_idx_t) idx);
 			duk_push_undefined(ctx);
 			duk_replace(ctx, (duk_idx_t) (idx + 1));
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_GETVAR: {
+		DUK__CASE(GETVAR): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_activation *act;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
@@ -69981,10 +70589,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 
 			duk_pop(ctx);  /* 'this' binding is not needed here */
 			duk_replace(ctx, (duk_idx_t) a);
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_PUTVAR: {
+		DUK__CASE(PUTVAR): {
 			duk_activation *act;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_uint_fast_t bc = DUK_DEC_BC(ins);
@@ -70003,10 +70611,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			tv1 = DUK__REGP(a);  /* val */
 			act = thr->callstack + thr->callstack_top - 1;
 			duk_js_putvar_activation(thr, act, name, tv1, DUK__STRICT());
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_DECLVAR: {
+		DUK__CASE(DECLVAR): {
 			duk_activation *act;
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
@@ -70050,10 +70658,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			}
 
 			duk_pop(ctx);
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_DELVAR: {
+		DUK__CASE(DELVAR): {
 			duk_activation *act;
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
@@ -70072,11 +70680,11 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 
 			duk_push_boolean(ctx, rc);
 			duk_replace(ctx, (duk_idx_t) a);
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_CSVAR:
-		case DUK_OP_CSVARI: {
+		DUK__CASE(CSVAR):
+		DUK__CASE(CSVARI): {
 			/* 'this' value:
 			 * E5 Section 6.b.i
 			 *
@@ -70121,10 +70729,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 
 			duk_replace(ctx, (duk_idx_t) (idx + 1));  /* 'this' binding */
 			duk_replace(ctx, (duk_idx_t) idx);        /* variable value (function, we hope, not checked here) */
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_CLOSURE: {
+		DUK__CASE(CLOSURE): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_activation *act;
 			duk_hcompiledfunction *fun;
@@ -70168,10 +70776,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			                    act->lex_env);
 			duk_replace(ctx, (duk_idx_t) a);
 
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_GETPROP: {
+		DUK__CASE(GETPROP): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_small_uint_fast_t b = DUK_DEC_B(ins);
@@ -70187,6 +70795,17 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 
 			tv_obj = DUK__REGCONSTP(b);
 			tv_key = DUK__REGCONSTP(c);
+#if defined(DUK_USE_PROPERTY_CACHE)
+			{
+				duk_tval tv_missing;
+				duk_tval *tv_val = duk__propcache_lookup(thr, curr_pc, tv_obj, tv_key, &tv_missing);
+				if (tv_val != NULL) {
+					duk_tval *tv1 = DUK__REGP(a);
+					DUK_TVAL_SET_TVAL_UPDREF_FAST(thr, tv1, tv_val);  /* side effects */
+					DUK__DISPATCH();
+				}
+			}
+#endif
 			DUK_DDD(DUK_DDDPRINT("GETPROP: a=%ld obj=%!T, key=%!T",
 			                     (long) a,
 			                     (duk_tval *) DUK__REGCONSTP(b),
@@ -70199,10 +70818,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			tv_key = NULL;  /* invalidated */
 
 			duk_replace(ctx, (duk_idx_t) a);    /* val */
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_PUTPROP: {
+		DUK__CASE(PUTPROP): {
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_small_uint_fast_t b = DUK_DEC_B(ins);
 			duk_small_uint_fast_t c = DUK_DEC_C(ins);
@@ -70222,6 +70841,15 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			tv_obj = DUK__REGP(a);
 			tv_key = DUK__REGCONSTP(b);
 			tv_val = DUK__REGCONSTP(c);
+#if defined(DUK_USE_PROPERTY_CACHE)
+			{
+				duk_tval *tv_slot = duk__propcache_lookup(thr, curr_pc, tv_obj, tv_key, NULL /*tv_missing: write*/);
+				if (tv_slot != NULL) {
+					DUK_TVAL_SET_TVAL_UPDREF_FAST(thr, tv_slot, tv_val);  /* side effects */
+					DUK__DISPATCH();
+				}
+			}
+#endif
 			DUK_DDD(DUK_DDDPRINT("PUTPROP: obj=%!T, key=%!T, val=%!T",
 			                     (duk_tval *) DUK__REGP(a),
 			                     (duk_tval *) DUK__REGCONSTP(b),
@@ -70236,10 +70864,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			tv_key = NULL;  /* invalidated */
 			tv_val = NULL;  /* invalidated */
 
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_DELPROP: {
+		DUK__CASE(DELPROP): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_small_uint_fast_t b = DUK_DEC_B(ins);
@@ -70261,11 +70889,11 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 
 			duk_push_boolean(ctx, rc);
 			duk_replace(ctx, (duk_idx_t) a);    /* result */
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_CSPROP:
-		case DUK_OP_CSPROPI: {
+		DUK__CASE(CSPROP):
+		DUK__CASE(CSPROPI): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t b = DUK_DEC_B(ins);
 			duk_small_uint_fast_t c = DUK_DEC_C(ins);
@@ -70311,14 +70939,14 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			duk_push_tval(ctx, DUK__REGP(b));         /* [ ... val obj ] */
 			duk_replace(ctx, (duk_idx_t) (idx + 1));  /* 'this' binding */
 			duk_replace(ctx, (duk_idx_t) idx);        /* val */
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_ADD:
-		case DUK_OP_SUB:
-		case DUK_OP_MUL:
-		case DUK_OP_DIV:
-		case DUK_OP_MOD: {
+		DUK__CASE(ADD):
+		DUK__CASE(SUB):
+		DUK__CASE(MUL):
+		DUK__CASE(DIV):
+		DUK__CASE(MOD): {
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_small_uint_fast_t b = DUK_DEC_B(ins);
 			duk_small_uint_fast_t c = DUK_DEC_C(ins);
@@ -70333,26 +70961,26 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			} else {
 				duk__vm_arith_binary_op(thr, DUK__REGCONSTP(b), DUK__REGCONSTP(c), a, op);
 			}
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_BAND:
-		case DUK_OP_BOR:
-		case DUK_OP_BXOR:
-		case DUK_OP_BASL:
-		case DUK_OP_BLSR:
-		case DUK_OP_BASR: {
+		DUK__CASE(BAND):
+		DUK__CASE(BOR):
+		DUK__CASE(BXOR):
+		DUK__CASE(BASL):
+		DUK__CASE(BLSR):
+		DUK__CASE(BASR): {
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_small_uint_fast_t b = DUK_DEC_B(ins);
 			duk_small_uint_fast_t c = DUK_DEC_C(ins);
 			duk_small_uint_fast_t op = DUK_DEC_OP(ins);
 
 			duk__vm_bitwise_binary_op(thr, DUK__REGCONSTP(b), DUK__REGCONSTP(c), a, op);
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_EQ:
-		case DUK_OP_NEQ: {
+		DUK__CASE(EQ):
+		DUK__CASE(NEQ): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_small_uint_fast_t b = DUK_DEC_B(ins);
@@ -70366,11 +70994,11 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			}
 			duk_push_boolean(ctx, tmp);
 			duk_replace(ctx, (duk_idx_t) a);
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_SEQ:
-		case DUK_OP_SNEQ: {
+		DUK__CASE(SEQ):
+		DUK__CASE(SNEQ): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_small_uint_fast_t b = DUK_DEC_B(ins);
@@ -70384,7 +71012,7 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			}
 			duk_push_boolean(ctx, tmp);
 			duk_replace(ctx, (duk_idx_t) a);
-			break;
+			DUK__DISPATCH();
 		}
 
 		/* Note: combining comparison ops must be done carefully because
@@ -70397,7 +71025,7 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 		 * XXX: can be combined; check code size.
 		 */
 
-		case DUK_OP_GT: {
+		DUK__CASE(GT): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_small_uint_fast_t b = DUK_DEC_B(ins);
@@ -70412,10 +71040,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 
 			duk_push_boolean(ctx, tmp);
 			duk_replace(ctx, (duk_idx_t) a);
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_GE: {
+		DUK__CASE(GE): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_small_uint_fast_t b = DUK_DEC_B(ins);
@@ -70431,10 +71059,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 
 			duk_push_boolean(ctx, tmp);
 			duk_replace(ctx, (duk_idx_t) a);
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_LT: {
+		DUK__CASE(LT): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_small_uint_fast_t b = DUK_DEC_B(ins);
@@ -70449,10 +71077,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 
 			duk_push_boolean(ctx, tmp);
 			duk_replace(ctx, (duk_idx_t) a);
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_LE: {
+		DUK__CASE(LE): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_small_uint_fast_t b = DUK_DEC_B(ins);
@@ -70467,10 +71095,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 
 			duk_push_boolean(ctx, tmp);
 			duk_replace(ctx, (duk_idx_t) a);
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_IF: {
+		DUK__CASE(IF): {
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_small_uint_fast_t b = DUK_DEC_B(ins);
 			duk_bool_t tmp;
@@ -70482,17 +71110,17 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			} else {
 				;
 			}
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_JUMP: {
+		DUK__CASE(JUMP): {
 			duk_int_fast_t abc = DUK_DEC_ABC(ins);
 
 			curr_pc += abc - DUK_BC_JUMP_BIAS;
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_RETURN: {
+		DUK__CASE(RETURN): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_small_uint_fast_t b = DUK_DEC_B(ins);
@@ -70528,8 +71156,8 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			return;
 		}
 
-		case DUK_OP_CALL:
-		case DUK_OP_CALLI: {
+		DUK__CASE(CALL):
+		DUK__CASE(CALLI): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_small_uint_fast_t c = DUK_DEC_C(ins);
@@ -70704,10 +71332,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			 * status after returning.  This is now handled by call handling
 			 * and heap->dbg_force_restart.
 			 */
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_TRYCATCH: {
+		DUK__CASE(TRYCATCH): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_activation *act;
 			duk_catcher *cat;
@@ -70874,14 +71502,14 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			                     (long) cat->pc_base, (long) cat->idx_base, (duk_heaphdr *) cat->h_varname));
 
 			curr_pc += 2;  /* skip jump slots */
-			break;
+			DUK__DISPATCH();
 		}
 
 		/* Pre/post inc/dec for register variables, important for loops. */
-		case DUK_OP_PREINCR:
-		case DUK_OP_PREDECR:
-		case DUK_OP_POSTINCR:
-		case DUK_OP_POSTDECR: {
+		DUK__CASE(PREINCR):
+		DUK__CASE(PREDECR):
+		DUK__CASE(POSTINCR):
+		DUK__CASE(POSTDECR): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_uint_fast_t bc = DUK_DEC_BC(ins);
@@ -70918,7 +71546,7 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 				tv2 = DUK__REGP(a);
 				z_fi = (ins & DUK_ENC_OP(0x02)) ? x_fi : y_fi;
 				DUK_TVAL_SET_FASTINT_UPDREF(thr, tv2, z_fi);  /* side effects */
-				break;
+				DUK__DISPATCH();
 			}
 		 skip_fastint:
 #endif
@@ -70951,14 +71579,14 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 			tv2 = DUK__REGP(a);
 			z = (ins & DUK_ENC_OP(0x02)) ? x : y;
 			DUK_TVAL_SET_NUMBER_UPDREF(thr, tv2, z);  /* side effects */
-			break;
+			DUK__DISPATCH();
 		}
 
 		/* Preinc/predec for var-by-name, slow path. */
-		case DUK_OP_PREINCV:
-		case DUK_OP_PREDECV:
-		case DUK_OP_POSTINCV:
-		case DUK_OP_POSTDECV: {
+		DUK__CASE(PREINCV):
+		DUK__CASE(PREDECV):
+		DUK__CASE(POSTINCV):
+		DUK__CASE(POSTDECV): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_activation *act;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
@@ -71000,14 +71628,14 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 
 			duk_push_number(ctx, (ins & DUK_ENC_OP(0x02)) ? x : y);
 			duk_replace(ctx, (duk_idx_t) a);
-			break;
+			DUK__DISPATCH();
 		}
 
 		/* Preinc/predec for object properties. */
-		case DUK_OP_PREINCP:
-		case DUK_OP_PREDECP:
-		case DUK_OP_POSTINCP:
-		case DUK_OP_POSTDECP: {
+		DUK__CASE(PREINCP):
+		DUK__CASE(PREDECP):
+		DUK__CASE(POSTINCP):
+		DUK__CASE(POSTDECP): {
 			duk_context *ctx = (duk_context *) thr;
 			duk_small_uint_fast_t a = DUK_DEC_A(ins);
 			duk_small_uint_fast_t b = DUK_DEC_B(ins);
@@ -71059,10 +71687,10 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 
 			duk_push_number(ctx, (ins & DUK_ENC_OP(0x02)) ? x : y);
 			duk_replace(ctx, (duk_idx_t) a);
-			break;
+			DUK__DISPATCH();
 		}
 
-		case DUK_OP_EXTRA: {
+		DUK__CASE(EXTRA): {
 			/* XXX: shared decoding of 'b' and 'c'? */
 
 			duk_small_uint_fast_t extraop = DUK_DEC_A(ins);
@@ -71730,7 +72358,7 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 
 			}  /* end switch */
 
-			break;
+			DUK__DISPATCH();
 		}
 
 		default: {
@@ -71761,6 +72389,9 @@ DUK_LOCAL DUK_NOINLINE void duk__js_execute_bytecode_inner(duk_hthread *entry_th
 #undef DUK__INTERNAL_ERROR
 #undef DUK__SYNC_CURR_PC
 #undef DUK__SYNC_AND_NULL_CURR_PC
+#undef DUK__CASE
+#undef DUK__LABEL
+#undef DUK__DISPATCH
 #line 1 "duk_js_ops.c"
 /*
  *  Ecmascript specification algorithm and conversion helpers.
@@ -79299,6 +79930,9 @@ DUK_INTERNAL void duk_numconv_parse(duk_context *ctx, duk_small_int_t radix, duk
 
 #define DUK__RE_INITIAL_BUFSIZE 64
 
+/* Number of compiled regexps kept per heap before the cache is flushed. */
+#define DUK__RE_CACHE_SIZE 64
+
 #undef DUK__RE_BUFLEN
 #define DUK__RE_BUFLEN(re_ctx) \
 	DUK_BW_GET_SIZE(re_ctx->thr, &re_ctx->bw)
@@ -80171,6 +80805,86 @@ DUK_LOCAL void duk__create_escaped_source(duk_hthread *thr, int idx_pattern) {
  *  Output stack: [ bytecode escaped_source ]  (both as strings)
  */
 
+#if defined(DUK_USE_REGEXP_CACHE)
+/*
+ *  Compiled regexp cache.
+ *
+ *  Programs often compile the same pattern over and over, e.g. with
+ *  'new RegExp(str)' or String.prototype.match() with a string argument
+ *  inside a loop.  The cache maps flags and pattern to the compiled
+ *  [ escaped_source bytecode ] pair.  It's an internal property of the
+ *  heap stash, so it's per heap, reachable for GC and out of reach of
+ *  Ecmascript code.  It has no prototype, so a lookup never finds an
+ *  inherited property.  When it fills up it's simply replaced with an
+ *  empty one.
+ */
+
+/* [ ... pattern flags ] -> [ ... pattern flags cache key ] */
+DUK_LOCAL void duk__re_cache_push(duk_hthread *thr) {
+	duk_context *ctx = (duk_context *) thr;
+
+	duk_push_heap_stash(ctx);
+	duk_get_prop_string(ctx, -1, "\xFF" "regexpCache");
+	if (!duk_is_object(ctx, -1) || thr->heap->regexp_cache_count >= DUK__RE_CACHE_SIZE) {
+		duk_pop(ctx);
+		duk_push_object_internal(ctx);
+		duk_dup_top(ctx);
+		duk_put_prop_string(ctx, -3, "\xFF" "regexpCache");
+		thr->heap->regexp_cache_count = 0;
+	}
+	duk_remove(ctx, -2);
+	duk_dup(ctx, -2);
+	duk_push_string(ctx, "/");
+	duk_dup(ctx, -5);
+	duk_concat(ctx, 3);
+}
+
+/* [ ... pattern flags ] -> [ ... escaped_source bytecode ] on a hit (returns
+ * 1), unchanged on a miss (returns 0).
+ */
+DUK_LOCAL duk_bool_t duk__re_cache_lookup(duk_hthread *thr) {
+	duk_context *ctx = (duk_context *) thr;
+
+	duk__re_cache_push(thr);
+	if (!duk_get_prop(ctx, -2)) {
+		duk_pop_2(ctx);
+		return 0;
+	}
+
+	/* [ ... pattern flags cache entry ] */
+
+	duk_get_prop_index(ctx, -1, 0);
+	duk_get_prop_index(ctx, -2, 1);
+
+	/* [ ... pattern flags cache entry escaped_source bytecode ] */
+
+	duk_replace(ctx, -5);
+	duk_replace(ctx, -5);
+	duk_pop_2(ctx);
+	return 1;
+}
+
+/* [ ... pattern flags escaped_source bytecode ] -> unchanged */
+DUK_LOCAL void duk__re_cache_insert(duk_hthread *thr) {
+	duk_context *ctx = (duk_context *) thr;
+
+	duk_dup(ctx, -4);
+	duk_dup(ctx, -4);
+	duk__re_cache_push(thr);
+
+	/* [ ... pattern flags escaped_source bytecode pattern flags cache key ] */
+
+	duk_push_array(ctx);
+	duk_dup(ctx, -7);
+	duk_put_prop_index(ctx, -2, 0);
+	duk_dup(ctx, -6);
+	duk_put_prop_index(ctx, -2, 1);
+	duk_put_prop(ctx, -3);
+	thr->heap->regexp_cache_count++;
+	duk_pop_3(ctx);
+}
+#endif  /* DUK_USE_REGEXP_CACHE */
+
 DUK_INTERNAL void duk_regexp_compile(duk_hthread *thr) {
 	duk_context *ctx = (duk_context *) thr;
 	duk_re_compiler_ctx re_ctx;
@@ -80190,6 +80904,14 @@ DUK_INTERNAL void duk_regexp_compile(duk_hthread *thr) {
 	h_pattern = duk_require_hstring(ctx, -2);
 	h_flags = duk_require_hstring(ctx, -1);
 
+#if defined(DUK_USE_REGEXP_CACHE)
+	if (duk__re_cache_lookup(thr)) {
+		DUK_DD(DUK_DDPRINT("regexp cache hit, escaped source: %!T",
+		                   (duk_tval *) duk_get_tval(ctx, -2)));
+		return;
+	}
+#endif
+
 	/*
 	 *  Create normalized 'source' property (E5 Section 15.10.3).
 	 */
@@ -80270,6 +80992,10 @@ DUK_INTERNAL void duk_regexp_compile(duk_hthread *thr) {
 
 	/* [ ... pattern flags escaped_source bytecode ] */
 
+#if defined(DUK_USE_REGEXP_CACHE)
+	duk__re_cache_insert(thr);
+#endif
+
 	/*
 	 *  Finalize stack
 	 */
@@ -81008,6 +81734,71 @@ DUK_LOCAL const duk_uint8_t *duk__match_regexp(duk_re_matcher_ctx *re_ctx, const
  *  Output stack: [ ... result ]
  */
 
+/*
+ *  Literal prefix extraction.
+ *
+ *  Compiled bytecode always starts with SAVE 0.  Quantifiers and
+ *  alternatives are inserted before the atoms they apply to, so if SAVE 0 is
+ *  directly followed by CHAR instructions then every match must start with
+ *  those characters.  ASCII characters are encoded as single bytes that can't
+ *  occur inside any other UTF-8 sequence, so candidate start positions can be
+ *  found with memchr() instead of running the matcher at every offset.
+ *
+ *  Case-insensitive letters are skipped because the input is canonicalized
+ *  while matching.  A leading '^' (without the multiline flag) can only
+ *  match at the start of the input.
+ */
+
+#define DUK__RE_PREFIX_MAX 16
+
+DUK_LOCAL duk_small_uint_t duk__regexp_literal_prefix(duk_re_matcher_ctx *re_ctx, duk_uint8_t *buf, duk_small_int_t *out_anchored) {
+	const duk_uint8_t *pc;
+	duk_uint32_t op;
+	duk_uint32_t c;
+	duk_small_uint_t len = 0;
+
+	*out_anchored = 0;
+	pc = re_ctx->bytecode;
+	op = duk__bc_get_u32(re_ctx, &pc);
+	if (op != DUK_REOP_SAVE) {
+		return 0;
+	}
+	(void) duk__bc_get_u32(re_ctx, &pc);
+	op = duk__bc_get_u32(re_ctx, &pc);
+	if (op == DUK_REOP_ASSERT_START && !(re_ctx->re_flags & DUK_RE_FLAG_MULTILINE)) {
+		*out_anchored = 1;
+		return 0;
+	}
+	while (op == DUK_REOP_CHAR && len < DUK__RE_PREFIX_MAX) {
+		c = duk__bc_get_u32(re_ctx, &pc);
+		if (c >= 0x80) {
+			break;
+		}
+		if ((re_ctx->re_flags & DUK_RE_FLAG_IGNORE_CASE) &&
+		    (c | 0x20) >= DUK_ASC_LC_A && (c | 0x20) <= DUK_ASC_LC_Z) {
+			break;
+		}
+		buf[len++] = (duk_uint8_t) c;
+		op = duk__bc_get_u32(re_ctx, &pc);
+	}
+	return len;
+}
+
+/* Find the next occurrence of a literal prefix at or after 'p', or NULL. */
+DUK_LOCAL const duk_uint8_t *duk__regexp_find_prefix(const duk_uint8_t *p, const duk_uint8_t *p_end, const duk_uint8_t *prefix, duk_small_uint_t prefix_len) {
+	while ((duk_size_t) (p_end - p) >= prefix_len) {
+		p = (const duk_uint8_t *) DUK_MEMCHR((const void *) p, (int) prefix[0], (duk_size_t) (p_end - p) - prefix_len + 1);
+		if (p == NULL) {
+			return NULL;
+		}
+		if (DUK_MEMCMP((const void *) (p + 1), (const void *) (prefix + 1), (duk_size_t) (prefix_len - 1)) == 0) {
+			return p;
+		}
+		p++;
+	}
+	return NULL;
+}
+
 DUK_LOCAL void duk__regexp_match_helper(duk_hthread *thr, duk_small_int_t force_global) {
 	duk_context *ctx = (duk_context *) thr;
 	duk_re_matcher_ctx re_ctx;
@@ -81021,6 +81812,10 @@ DUK_LOCAL void duk__regexp_match_helper(duk_hthread *thr, duk_small_int_t force_
 	duk_uint_fast32_t i;
 	double d;
 	duk_uint32_t char_offset;
+	duk_uint8_t prefix[DUK__RE_PREFIX_MAX];
+	duk_small_uint_t prefix_len;
+	duk_small_int_t anchored;
+	duk_small_int_t input_is_ascii;
 
 	DUK_ASSERT(thr != NULL);
 	DUK_ASSERT(ctx != NULL);
@@ -81084,6 +81879,9 @@ DUK_LOCAL void duk__regexp_match_helper(duk_hthread *thr, duk_small_int_t force_
 	DUK_ASSERT(re_ctx.nsaved >= 2);
 	DUK_ASSERT((re_ctx.nsaved % 2) == 0);
 
+	prefix_len = duk__regexp_literal_prefix(&re_ctx, prefix, &anchored);
+	input_is_ascii = (DUK_HSTRING_GET_CHARLEN(h_input) == DUK_HSTRING_GET_BYTELEN(h_input));
+
 	duk_push_fixed_buffer(ctx, sizeof(duk_uint8_t *) * re_ctx.nsaved);
 	re_ctx.saved = (const duk_uint8_t **) duk_get_buffer(ctx, -1, NULL);
 	DUK_ASSERT(re_ctx.saved != NULL);
@@ -81162,6 +81960,32 @@ DUK_LOCAL void duk__regexp_match_helper(duk_hthread *thr, duk_small_int_t force_
 		/* Note: ctx.steps is intentionally not reset, it applies to the entire unanchored match */
 		DUK_ASSERT(re_ctx.recursion_depth == 0);
 
+		if (anchored && sp != re_ctx.input) {
+			DUK_DDD(DUK_DDDPRINT("anchored regexp cannot match at char offset %ld", (long) char_offset));
+			break;
+		}
+		if (prefix_len > 0) {
+			const duk_uint8_t *p_cand;
+
+			p_cand = duk__regexp_find_prefix(sp, re_ctx.input_end, prefix, prefix_len);
+			if (p_cand == NULL) {
+				DUK_DDD(DUK_DDDPRINT("literal prefix not found after char offset %ld", (long) char_offset));
+				break;
+			}
+			/* Skip to the candidate, counting the characters skipped. */
+			if (input_is_ascii) {
+				char_offset += (duk_uint32_t) (p_cand - sp);
+				sp = p_cand;
+			} else {
+				while (sp < p_cand) {
+					if ((*sp & 0xc0) != 0x80) {
+						char_offset++;
+					}
+					sp++;
+				}
+			}
+		}
+
 		DUK_DDD(DUK_DDDPRINT("attempt match at char offset %ld; %p [%p,%p]",
 		                     (long) char_offset, (const void *) sp,
 		                     (const void *) re_ctx.input, (const void *) re_ctx.input_end));
@@ -81177,12 +82001,12 @@ DUK_LOCAL void duk__regexp_match_helper(duk_hthread *thr, duk_small_int_t force_
 		 *    - Backtracking also rewinds ctx.recursion back to zero, unless an
 		 *      internal/limit error occurs (which causes a longjmp())
 		 *
-		 *    - If we supported anchored matches, we would break out here
-		 *      unconditionally; however, Ecmascript regexps don't have anchored
-		 *      matches.  It might make sense to implement a fast bail-out if
-		 *      the regexp begins with '^' and sp is not 0: currently we'll just
-		 *      run through the entire input string, trivially failing the match
-		 *      at every non-zero offset.
+		 *    - Ecmascript regexps don't have anchored matches, so a failed
+		 *      attempt moves on to the next offset.  Offsets that can't match
+		 *      are skipped before getting here: a regexp beginning with '^'
+		 *      (without the multiline flag) gives up at any non-zero offset,
+		 *      and a regexp beginning with a literal prefix skips straight to
+		 *      the next occurrence of the prefix, giving up if there is none.
 		 */
 
 		if (duk__match_regexp(&re_ctx, re_ctx.bytecode, sp) != NULL) {
@@ -1047,6 +1047,7 @@ DUK_EXTERNAL_DECL void duk_log_va(duk_context *ctx, duk_int_t level, const char
  */
 
 DUK_EXTERNAL_DECL void duk_push_context_dump(duk_context *ctx);
+DUK_EXTERNAL_DECL duk_bool_t duk_get_stack_frame(duk_context *ctx, duk_int_t level, const char **out_name, const char **out_file, duk_int_t *out_line);
 
 #if defined(DUK_USE_FILE_IO)
 /* internal use */
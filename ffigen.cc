@@ -28,11 +28,23 @@
  */
 
 #include <clang-c/Index.h>
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <functional>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <regex>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <unordered_set>
@@ -59,17 +71,83 @@ typedef std::vector<std::pair<std::string, int>> Enum;
 typedef std::function<CXChildVisitResult(CXCursor, CXCursor)> Visitor;
 
 /**
- * Global collection of all of the structs that we've found.
+ * Options that control which declarations are wrapped and how the module is
+ * registered.  These are set from the `-ffigen-*` command-line options before
+ * any parsing starts and are read-only afterwards.
  */
-std::unordered_map<std::string, Struct> structs;
+struct Options
+{
+	/**
+	 * If not empty, only functions and enums whose names match one of these
+	 * are wrapped.
+	 */
+	std::vector<std::regex> allow;
+	/**
+	 * Functions and enums whose names match any of these are not wrapped.
+	 */
+	std::vector<std::regex> deny;
+	/**
+	 * If not empty, only functions and enums declared in a file whose path
+	 * matches one of these are wrapped.
+	 */
+	std::vector<std::regex> headers;
+	/**
+	 * Wrap deprecated declarations as well as available ones.
+	 */
+	bool deprecated = false;
+	/**
+	 * Create function objects on first access, rather than registering all of
+	 * them when the module is loaded.
+	 */
+	bool lazy = false;
+} options;
+
+/**
+ * The declarations collected from one translation unit.  Each source file is
+ * parsed on its own thread into one of these, and they are then merged into
+ * the global collections.
+ */
+struct Declarations
+{
+	/**
+	 * The structs found in this translation unit.
+	 */
+	std::unordered_map<std::string, Struct> structs;
+	/**
+	 * The function declarations found in this translation unit.
+	 */
+	std::unordered_map<std::string, CXType> functions;
+	/**
+	 * The enumerations found in this translation unit.
+	 */
+	std::unordered_map<std::string, Enum> enums;
+	/**
+	 * The Unified Symbol Resolution of each struct, function and enum, keyed
+	 * by a one-character kind prefix and the name.  Used to deduplicate
+	 * declarations that appear in more than one translation unit.
+	 */
+	std::unordered_map<std::string, std::string> usrs;
+};
+
+/**
+ * Global collection of all of the structs that we've found.  The global
+ * collections are ordered, so that the generated code doesn't depend on hash
+ * table iteration order and is reproducible.
+ */
+std::map<std::string, Struct> structs;
 /**
  * Global collection of all of the function declarations that we've found.
  */
-std::unordered_map<std::string, CXType> functions;
+std::map<std::string, CXType> functions;
 /**
  * Global collection of all of the enumerations that we've found.
  */
-std::unordered_map<std::string, Enum> enums;
+std::map<std::string, Enum> enums;
+/**
+ * The USRs of everything in the global collections, in the same form as
+ * `Declarations::usrs`.
+ */
+std::unordered_map<std::string, std::string> usrs;
 
 /**
  * RAIICXString wraps a CXString and handles automatic deallocation.
@@ -125,11 +203,21 @@ visitChildren(CXCursor cursor, Visitor v)
 			(CXClientData*)&v);
 }
 
+/**
+ * Record the USR of a declaration in `d`.
+ */
+void
+recordUSR(Declarations &d, char kind, const std::string &name, CXCursor decl)
+{
+	RAIICXString usr = clang_getCursorUSR(decl);
+	d.usrs[kind + name] = usr.str();
+}
+
 /**
  * Collect struct definitions.
  */
 void
-collectStruct(CXCursor structDecl)
+collectStruct(Declarations &d, CXCursor structDecl)
 {
 	// Skip unions - we don't explicitly box them as objects, we just wrap them
 	// in a buffer.
@@ -143,11 +231,12 @@ collectStruct(CXCursor structDecl)
 		return;
 	}
 	// If we've already parsed this struct, return early.
-	if (structs.find(structname) != structs.end())
+	if (d.structs.find(structname) != d.structs.end())
 	{
 		return;
 	}
-	Struct &s = structs[structname];
+	Struct &s = d.structs[structname];
+	recordUSR(d, 's', structname, structDecl);
 	// Once we've found a struct, recursively visit the fields and add them.
 	visitChildren(structDecl,
 		[&](CXCursor cursor, CXCursor parent)
@@ -161,7 +250,7 @@ collectStruct(CXCursor structDecl)
 			// structs, which we should...
 			if (type.kind == CXType_Record)
 			{
-				collectStruct(clang_getTypeDeclaration(type));
+				collectStruct(d, clang_getTypeDeclaration(type));
 			}
 			s.push_back(std::make_pair(name.str(), type));
 			return CXChildVisit_Continue;
@@ -172,26 +261,96 @@ collectStruct(CXCursor structDecl)
  * Collect function declarations.
  */
 void
-collectFunction(CXCursor functionDecl)
+collectFunction(Declarations &d, CXCursor functionDecl)
 {
 	RAIICXString name = clang_getCursorSpelling(functionDecl);
 	CXType type = clang_getCanonicalType(clang_getCursorType(functionDecl));
-	functions[name] = type;
+	d.functions[name] = type;
+	recordUSR(d, 'f', name, functionDecl);
+}
+
+/**
+ * Returns true if any of the regular expressions in `filters` matches `str`.
+ */
+bool
+matchesAny(const std::vector<std::regex> &filters, const std::string &str)
+{
+	for (auto &r : filters)
+	{
+		if (std::regex_search(str, r))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Returns true if `name` passes the allow and deny filters.
+ */
+bool
+isWantedName(const std::string &name)
+{
+	if (!options.allow.empty() && !matchesAny(options.allow, name))
+	{
+		return false;
+	}
+	return !matchesAny(options.deny, name);
+}
+
+/**
+ * Returns true if the declaration at `cursor` passes the header and name
+ * filters.  Anonymous declarations are only subject to the header filter:
+ * the name filters are applied to the constants of anonymous enums
+ * individually.
+ */
+bool
+isWanted(CXCursor cursor)
+{
+	if (!options.headers.empty())
+	{
+		CXFile file = nullptr;
+		clang_getSpellingLocation(clang_getCursorLocation(cursor), &file,
+				nullptr, nullptr, nullptr);
+		std::string fileName;
+		if (file != nullptr)
+		{
+			fileName = RAIICXString(clang_getFileName(file)).str();
+		}
+		if (!matchesAny(options.headers, fileName))
+		{
+			return false;
+		}
+	}
+	RAIICXString name = clang_getCursorSpelling(cursor);
+	if (name.str().empty())
+	{
+		return true;
+	}
+	return isWantedName(name);
 }
 
 /**
  * Collect enum declarations.
  */
 void
-collectEnum(CXCursor enumDecl)
+collectEnum(Declarations &d, CXCursor enumDecl)
 {
 	RAIICXString name = clang_getCursorSpelling(enumDecl);
-	Enum &e = enums[name];
+	// The constants of anonymous enums become properties of the module
+	// object, so they are filtered by their own names.
+	bool anonymous = name.str().empty();
+	Enum &e = d.enums[name];
+	recordUSR(d, 'e', name, enumDecl);
 	// Recursively visit the children of the enum.
 	visitChildren(enumDecl,
 		[&](CXCursor cursor, CXCursor parent)
 		{
 			RAIICXString name = clang_getCursorSpelling(cursor);
+			if (anonymous && !isWantedName(name))
+			{
+				return CXChildVisit_Continue;
+			}
 			int value = clang_getEnumConstantDeclValue(cursor);
 			e.push_back(std::make_pair(name.str(), value));
 			return CXChildVisit_Continue;
@@ -204,11 +363,15 @@ collectEnum(CXCursor enumDecl)
  * collect information about them.
  */
 enum CXChildVisitResult
-visitTranslationUnit (CXCursor cursor, CXCursor parent, CXClientData unused)
+visitTranslationUnit (CXCursor cursor, CXCursor parent, CXClientData data)
 {
+	Declarations &d = *static_cast<Declarations*>(data);
 	CXCursorKind kind = clang_getCursorKind(cursor);
-	// Skip anything that's deprecated
-	if (clang_getCursorAvailability(cursor) != CXAvailability_Available)
+	// Skip anything that's unavailable, and anything that's deprecated unless
+	// we've been asked to include it.
+	CXAvailabilityKind availability = clang_getCursorAvailability(cursor);
+	if ((availability != CXAvailability_Available) &&
+	    !(options.deprecated && (availability == CXAvailability_Deprecated)))
 	{
 		return CXChildVisit_Continue;
 	}
@@ -222,19 +385,327 @@ visitTranslationUnit (CXCursor cursor, CXCursor parent, CXClientData unused)
 		case CXCursor_StructDecl:
 		{
 			RAIICXString name = clang_getCursorSpelling(cursor);
-			collectStruct(cursor);
+			collectStruct(d, cursor);
 			break;
 		}
+		// Structs are only used as argument and return types, so the
+		// filters apply to functions and enums.
 		case CXCursor_EnumDecl:
-			collectEnum(cursor);
+			if (isWanted(cursor))
+			{
+				collectEnum(d, cursor);
+			}
 			break;
 		case CXCursor_FunctionDecl:
-			collectFunction(cursor);
+			if (isWanted(cursor))
+			{
+				collectFunction(d, cursor);
+			}
 			break;
 	}
 	return CXChildVisit_Continue;
 }
 
+/**
+ * Merge the declarations of one kind from a translation unit into the global
+ * collection.  Declarations with the same USR as one that we've already seen
+ * are duplicates (typically from a header included by more than one source
+ * file) and are skipped.  Different declarations with the same name can't
+ * both be exposed to JavaScript, so the first one wins.
+ */
+template<class G, class L> void
+mergeDeclarations(G &global, L &local, char kind, Declarations &d)
+{
+	for (auto &kv : local)
+	{
+		const std::string key = kind + kv.first;
+		const std::string &usr = d.usrs[key];
+		auto existing = usrs.find(key);
+		if (existing == usrs.end())
+		{
+			usrs[key] = usr;
+			global.insert(std::move(kv));
+		}
+		else if (existing->second != usr)
+		{
+			cerr << "Warning: Conflicting declarations of " << kv.first
+			     << ".  Using the first one.\n";
+		}
+	}
+}
+
+/**
+ * Merge the declarations from one translation unit into the global
+ * collections.
+ */
+void
+mergeDeclarations(Declarations &d)
+{
+	// All anonymous enums are collected under the empty name, so merge their
+	// values individually rather than by USR.
+	auto anon = d.enums.find(std::string());
+	if (anon != d.enums.end())
+	{
+		Enum &global = enums[std::string()];
+		for (auto &v : anon->second)
+		{
+			bool found = false;
+			for (auto &existing : global)
+			{
+				found |= (existing.first == v.first);
+			}
+			if (!found)
+			{
+				global.push_back(v);
+			}
+		}
+		d.enums.erase(anon);
+	}
+	mergeDeclarations(structs, d.structs, 's', d);
+	mergeDeclarations(functions, d.functions, 'f', d);
+	mergeDeclarations(enums, d.enums, 'e', d);
+}
+
+/**
+ * Hash function used by the perfect hash tables.  This must match
+ * `ffigen_hash` in the runtime emitted by `emit_perfect_hash_runtime()`.
+ */
+uint32_t
+perfectHashFunction(uint32_t seed, const std::string &key)
+{
+	uint32_t h = seed ^ 2166136261U;
+	for (unsigned char c : key)
+	{
+		h ^= c;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/**
+ * The number of seeds `perfectHash()` tries for each bucket before giving up.
+ */
+const uint32_t maxPerfectHashSeed = 1U << 24;
+
+/**
+ * Construct a minimal perfect hash for `keys`, using the hash and displace
+ * algorithm.  Each key is first hashed into a bucket.  Buckets are then
+ * placed, largest first, by searching for a seed that maps all of their keys
+ * to free slots, or (for buckets with one key) by storing a free slot
+ * directly, encoded as a negative number.  Returns the displacement table and
+ * sets `slots[i]` to the index assigned to `keys[i]`.  Exits with an error if
+ * no seed up to `maxPerfectHashSeed` places a bucket, which in practice only
+ * happens for duplicate keys.
+ */
+std::vector<int32_t>
+perfectHash(const std::vector<std::string> &keys, std::vector<size_t> &slots)
+{
+	const size_t size = keys.size();
+	std::vector<int32_t> displacements(size, 0);
+	std::vector<std::vector<size_t>> buckets(size);
+	slots.assign(size, 0);
+	for (size_t i=0 ; i<size ; i++)
+	{
+		buckets[perfectHashFunction(0, keys[i]) % size].push_back(i);
+	}
+	std::vector<size_t> order(size);
+	for (size_t i=0 ; i<size ; i++)
+	{
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(),
+		[&](size_t a, size_t b)
+		{
+			return buckets[a].size() > buckets[b].size();
+		});
+	std::vector<bool> used(size, false);
+	size_t freeSlot = 0;
+	for (size_t b : order)
+	{
+		auto &bucket = buckets[b];
+		if (bucket.empty())
+		{
+			break;
+		}
+		if (bucket.size() == 1)
+		{
+			while (used[freeSlot])
+			{
+				freeSlot++;
+			}
+			used[freeSlot] = true;
+			slots[bucket[0]] = freeSlot;
+			displacements[b] = -static_cast<int32_t>(freeSlot) - 1;
+			continue;
+		}
+		uint32_t seed;
+		for (seed=1 ; seed<=maxPerfectHashSeed ; seed++)
+		{
+			std::vector<size_t> candidate;
+			for (size_t key : bucket)
+			{
+				size_t slot = perfectHashFunction(seed, keys[key]) % size;
+				if (used[slot] ||
+				    (std::find(candidate.begin(), candidate.end(), slot) !=
+				     candidate.end()))
+				{
+					break;
+				}
+				candidate.push_back(slot);
+			}
+			if (candidate.size() == bucket.size())
+			{
+				for (size_t i=0 ; i<bucket.size() ; i++)
+				{
+					used[candidate[i]] = true;
+					slots[bucket[i]] = candidate[i];
+				}
+				displacements[b] = static_cast<int32_t>(seed);
+				break;
+			}
+		}
+		if (seed > maxPerfectHashSeed)
+		{
+			cerr << "Unable to construct a perfect hash for " << keys[bucket[0]]
+			     << " and " << (bucket.size() - 1) << " other names\n";
+			exit(EXIT_FAILURE);
+		}
+	}
+	return displacements;
+}
+
+/**
+ * Emit a displacement table constructed by `perfectHash()`.
+ */
+void
+emit_perfect_hash_table(const std::string &name,
+                        const std::vector<int32_t> &displacements)
+{
+	cout << "static const int32_t " << name << "[] = {";
+	for (auto d : displacements)
+	{
+		cout << ' ' << d << ',';
+	}
+	// Avoid emitting an empty array.
+	cout << " 0 };\n";
+}
+
+/**
+ * Emit the run-time support for looking keys up in the perfect hash tables.
+ * `ffigen_lookup` returns the only slot that can contain the key, which the
+ * caller must then compare against.
+ */
+void
+emit_perfect_hash_runtime()
+{
+	cout << "static uint32_t ffigen_hash(uint32_t seed, const char *key, "
+	        "size_t len)\n{\n"
+	        "\tuint32_t h = seed ^ 2166136261U;\n"
+	        "\tfor (size_t i=0 ; i<len ; i++)\n\t{\n"
+	        "\t\th ^= (unsigned char)key[i];\n"
+	        "\t\th *= 16777619U;\n\t}\n"
+	        "\treturn h;\n}\n";
+	cout << "static int ffigen_lookup(const int32_t *table, size_t size, "
+	        "const char *key, size_t len)\n{\n"
+	        "\tif (size == 0)\n\t{\n\t\treturn -1;\n\t}\n"
+	        "\tint32_t d = table[ffigen_hash(0, key, len) % size];\n"
+	        "\treturn d < 0 ? -d - 1 : (int)(ffigen_hash(d, key, len) % size);\n"
+	        "}\n";
+	cout << "static int ffigen_key_equal(const char *name, const char *key, "
+	        "size_t len)\n{\n"
+	        "\treturn (strlen(name) == len) && (memcmp(name, key, len) == 0);\n"
+	        "}\n";
+	// Tables of enum constants, ordered by perfect hash slot.
+	cout << "struct ffigen_constant\n{\n"
+	        "\tconst char *name;\n"
+	        "\tduk_double_t value;\n};\n"
+	        "struct ffigen_constant_table\n{\n"
+	        "\tconst struct ffigen_constant *constants;\n"
+	        "\tconst int32_t *hash;\n"
+	        "\tsize_t count;\n};\n";
+	cout << "static int ffigen_constant_find(duk_context *ctx, "
+	        "const struct ffigen_constant_table *t, duk_idx_t key)\n{\n"
+	        "\tduk_size_t len;\n"
+	        "\tif (!duk_is_string(ctx, key))\n\t{\n\t\treturn -1;\n\t}\n"
+	        "\tconst char *str = duk_get_lstring(ctx, key, &len);\n"
+	        "\tint i = ffigen_lookup(t->hash, t->count, str, len);\n"
+	        "\tif ((i < 0) || !ffigen_key_equal(t->constants[i].name, str, len))\n"
+	        "\t{\n\t\treturn -1;\n\t}\n"
+	        "\treturn i;\n}\n";
+	// Eagerly define every constant in a table as a property of an object.
+	cout << "static void ffigen_put_constants(duk_context *ctx, duk_idx_t obj, "
+	        "const struct ffigen_constant_table *t)\n{\n"
+	        "\tobj = duk_normalize_index(ctx, obj);\n"
+	        "\tfor (size_t i=0 ; i<t->count ; i++)\n\t{\n"
+	        "\t\tduk_push_number(ctx, t->constants[i].value);\n"
+	        "\t\tduk_put_prop_string(ctx, obj, t->constants[i].name);\n"
+	        "\t}\n}\n";
+	// Append the names of all constants in a table that aren't already
+	// properties of the object at `obj` to the array at `keys`.
+	cout << "static duk_uarridx_t ffigen_constant_keys(duk_context *ctx, "
+	        "const struct ffigen_constant_table *t, duk_idx_t obj, "
+	        "duk_idx_t keys, duk_uarridx_t n)\n{\n"
+	        "\tfor (size_t i=0 ; i<t->count ; i++)\n\t{\n"
+	        "\t\tif (!duk_has_prop_string(ctx, obj, t->constants[i].name))\n"
+	        "\t\t{\n"
+	        "\t\t\tduk_push_string(ctx, t->constants[i].name);\n"
+	        "\t\t\tduk_put_prop_index(ctx, keys, n++);\n"
+	        "\t\t}\n\t}\n"
+	        "\treturn n;\n}\n";
+	// Proxy traps for enum objects.  The handler object stores a pointer to
+	// the table.  Constants are cheap to push, so they aren't cached.
+	cout << "static const struct ffigen_constant_table *"
+	        "ffigen_handler_table(duk_context *ctx)\n{\n"
+	        "\tduk_push_this(ctx);\n"
+	        "\tduk_get_prop_string(ctx, -1, \"\\xFF\" \"table\");\n"
+	        "\tconst struct ffigen_constant_table *t = duk_get_pointer(ctx, -1);\n"
+	        "\tduk_pop_2(ctx);\n"
+	        "\treturn t;\n}\n";
+	cout << "static duk_ret_t ffigen_constants_get(duk_context *ctx)\n{\n"
+	        "\tconst struct ffigen_constant_table *t = ffigen_handler_table(ctx);\n"
+	        "\tduk_dup(ctx, 1);\n"
+	        "\tif (duk_get_prop(ctx, 0))\n\t{\n\t\treturn 1;\n\t}\n"
+	        "\tint i = ffigen_constant_find(ctx, t, 1);\n"
+	        "\tif (i >= 0)\n\t{\n"
+	        "\t\tduk_push_number(ctx, t->constants[i].value);\n\t}\n"
+	        "\treturn 1;\n}\n";
+	cout << "static duk_ret_t ffigen_constants_has(duk_context *ctx)\n{\n"
+	        "\tconst struct ffigen_constant_table *t = ffigen_handler_table(ctx);\n"
+	        "\tduk_dup(ctx, 1);\n"
+	        "\tduk_push_boolean(ctx, duk_has_prop(ctx, 0) || "
+	        "(ffigen_constant_find(ctx, t, 1) >= 0));\n"
+	        "\treturn 1;\n}\n";
+	cout << "static duk_ret_t ffigen_constants_keys(duk_context *ctx)\n{\n"
+	        "\tconst struct ffigen_constant_table *t = ffigen_handler_table(ctx);\n"
+	        "\tduk_idx_t keys = duk_push_array(ctx);\n"
+	        "\tduk_uarridx_t n = 0;\n"
+	        "\tduk_enum(ctx, 0, DUK_ENUM_OWN_PROPERTIES_ONLY);\n"
+	        "\twhile (duk_next(ctx, -1, 0))\n\t{\n"
+	        "\t\tduk_put_prop_index(ctx, keys, n++);\n\t}\n"
+	        "\tduk_pop(ctx);\n"
+	        "\tffigen_constant_keys(ctx, t, 0, keys, n);\n"
+	        "\treturn 1;\n}\n";
+	// Push a proxy that exposes the constants in a table as properties.
+	cout << "static void ffigen_push_constants(duk_context *ctx, "
+	        "const struct ffigen_constant_table *t)\n{\n"
+	        "\tduk_push_global_object(ctx);\n"
+	        "\tduk_get_prop_string(ctx, -1, \"Proxy\");\n"
+	        "\tduk_remove(ctx, -2);\n"
+	        "\tduk_push_object(ctx);\n"
+	        "\tduk_push_object(ctx);\n"
+	        "\tduk_push_pointer(ctx, (void*)t);\n"
+	        "\tduk_put_prop_string(ctx, -2, \"\\xFF\" \"table\");\n"
+	        "\tduk_push_c_function(ctx, ffigen_constants_get, 3);\n"
+	        "\tduk_put_prop_string(ctx, -2, \"get\");\n"
+	        "\tduk_push_c_function(ctx, ffigen_constants_has, 2);\n"
+	        "\tduk_put_prop_string(ctx, -2, \"has\");\n"
+	        "\tduk_push_c_function(ctx, ffigen_constants_keys, 1);\n"
+	        "\tduk_put_prop_string(ctx, -2, \"enumerate\");\n"
+	        "\tduk_push_c_function(ctx, ffigen_constants_keys, 1);\n"
+	        "\tduk_put_prop_string(ctx, -2, \"ownKeys\");\n"
+	        "\tduk_new(ctx, 2);\n}\n";
+}
+
 /**
  * Helper that emits the name of the function used to convert from a C
  * structure to JavaScript.
@@ -797,6 +1268,65 @@ emit_function_arg_writeback(T writeback, CXType fnType, int args)
 	}
 }
 
+/**
+ * Emit the Proxy handler functions for a lazily registered module.  The
+ * module object is a proxy whose target holds everything that has been
+ * materialised so far.  Reading a property that the target doesn't have looks
+ * the name up in `js_funcs` and, if it's found, creates the function object
+ * and caches it on the target.
+ */
+void
+emit_lazy_module_handlers()
+{
+	cout << "static int js_funcs_find(duk_context *ctx, duk_idx_t key)\n{\n"
+	        "\tduk_size_t len;\n"
+	        "\tif (!duk_is_string(ctx, key))\n\t{\n\t\treturn -1;\n\t}\n"
+	        "\tconst char *str = duk_get_lstring(ctx, key, &len);\n"
+	        "\tint i = ffigen_lookup(js_funcs_hash, JS_FUNCS_COUNT, str, len);\n"
+	        "\tif ((i < 0) || !ffigen_key_equal(js_funcs[i].key, str, len))\n"
+	        "\t{\n\t\treturn -1;\n\t}\n"
+	        "\treturn i;\n}\n";
+	// get(target, key, receiver)
+	cout << "static duk_ret_t js_funcs_get(duk_context *ctx)\n{\n"
+	        "\tduk_dup(ctx, 1);\n"
+	        "\tif (duk_get_prop(ctx, 0))\n\t{\n\t\treturn 1;\n\t}\n"
+	        "\tint i = js_funcs_find(ctx, 1);\n"
+	        "\tif (i < 0)\n\t{\n"
+	        "\t\ti = ffigen_constant_find(ctx, &js_constants, 1);\n"
+	        "\t\tif (i >= 0)\n\t\t{\n"
+	        "\t\t\tduk_push_number(ctx, js_constants.constants[i].value);\n"
+	        "\t\t}\n"
+	        "\t\treturn 1;\n\t}\n"
+	        "\tduk_pop(ctx);\n"
+	        "\tduk_push_c_function(ctx, js_funcs[i].value, js_funcs[i].nargs);\n"
+	        "\tduk_dup(ctx, 1);\n"
+	        "\tduk_dup(ctx, -2);\n"
+	        "\tduk_put_prop(ctx, 0);\n"
+	        "\treturn 1;\n}\n";
+	// has(target, key)
+	cout << "static duk_ret_t js_funcs_has(duk_context *ctx)\n{\n"
+	        "\tduk_dup(ctx, 1);\n"
+	        "\tduk_push_boolean(ctx, duk_has_prop(ctx, 0) || "
+	        "(js_funcs_find(ctx, 1) >= 0) || "
+	        "(ffigen_constant_find(ctx, &js_constants, 1) >= 0));\n"
+	        "\treturn 1;\n}\n";
+	// enumerate(target) and ownKeys(target)
+	cout << "static duk_ret_t js_funcs_keys(duk_context *ctx)\n{\n"
+	        "\tduk_idx_t keys = duk_push_array(ctx);\n"
+	        "\tduk_uarridx_t n = 0;\n"
+	        "\tduk_enum(ctx, 0, DUK_ENUM_OWN_PROPERTIES_ONLY);\n"
+	        "\twhile (duk_next(ctx, -1, 0))\n\t{\n"
+	        "\t\tif (js_funcs_find(ctx, -1) >= 0)\n\t\t{\n"
+	        "\t\t\tduk_pop(ctx);\n\t\t\tcontinue;\n\t\t}\n"
+	        "\t\tduk_put_prop_index(ctx, keys, n++);\n\t}\n"
+	        "\tduk_pop(ctx);\n"
+	        "\tfor (int i=0 ; i<JS_FUNCS_COUNT ; i++)\n\t{\n"
+	        "\t\tduk_push_string(ctx, js_funcs[i].key);\n"
+	        "\t\tduk_put_prop_index(ctx, keys, n++);\n\t}\n"
+	        "\tffigen_constant_keys(ctx, &js_constants, 0, keys, n);\n"
+	        "\treturn 1;\n}\n";
+}
+
 void
 emit_function_wrappers()
 {
@@ -804,7 +1334,7 @@ emit_function_wrappers()
 	// sure that we've managed, then we'll emit a warning and continue.  We'll
 	// then put all of the ones that we successfully handled in a function
 	// list and register them with the JS context.
-	std::vector<std::tuple<const std::string, const std::string, int>> fns;
+	std::vector<std::tuple<std::string, std::string, int>> fns;
 	for (auto kv : functions)
 	{
 		CXType fnType = kv.second;
@@ -834,7 +1364,7 @@ emit_function_wrappers()
 		// If we have the wrong number of arguments, then abort
 		cout << "\tif (duk_get_top(ctx) != " << args << ")\n\t{";
 		cout << "\treturn DUK_RET_TYPE_ERROR;\n\t}\n";
-		std::unordered_set<int> writeback;
+		std::set<int> writeback;
 		for (int i=0 ; i<args ; i++)
 		{
 			success &= emit_function_argument(fnType, args, i, writeback);
@@ -886,6 +1416,26 @@ emit_function_wrappers()
 			fns.push_back(std::make_tuple(name, cname, args));
 		}
 	}
+	// In lazy mode, the function list is ordered by perfect hash slot, so that
+	// the module's property lookup can index it directly.
+	if (options.lazy)
+	{
+		std::vector<std::string> names;
+		for (auto &entry : fns)
+		{
+			names.push_back(std::get<0>(entry));
+		}
+		std::vector<size_t> slots;
+		auto displacements = perfectHash(names, slots);
+		auto ordered = fns;
+		for (size_t i=0 ; i<fns.size() ; i++)
+		{
+			ordered[slots[i]] = fns[i];
+		}
+		fns.swap(ordered);
+		emit_perfect_hash_table("js_funcs_hash", displacements);
+		cout << "#define JS_FUNCS_COUNT " << fns.size() << "\n";
+	}
 	// Emit the function list
 	cout << "static const duk_function_list_entry js_funcs[] = {\n";
 	for (auto &entry : fns)
@@ -896,33 +1446,296 @@ emit_function_wrappers()
 	// Add the null terminator.
 	cout << "\t{ 0, 0, 0 }\n";
 	cout << "};\n";
+	if (options.lazy)
+	{
+		emit_lazy_module_handlers();
+	}
+}
+
+/**
+ * The name of the constant table emitted for an enum.  Constants from
+ * anonymous enums are collected in one table and become properties of the
+ * module object.
+ */
+std::string
+enum_table_name(const std::string &name)
+{
+	return name.empty() ? "js_constants" : "js_enum_" + name;
+}
+
+/**
+ * Emit a static table of constants for each enum, ordered by perfect hash
+ * slot so that the generated lookup functions can index it directly.  Loading
+ * the module then costs one object per enum, rather than one property per
+ * constant.
+ */
+void
+emit_enum_tables()
+{
+	// Always emit the anonymous constant table, as the lazy module object
+	// refers to it.
+	enums[std::string()];
+	for (auto &kv : enums)
+	{
+		// Skip any duplicate names (for example, from redeclarations), as they
+		// can't be placed in a perfect hash.
+		std::set<std::string> seen;
+		Enum vals;
+		for (auto &v : kv.second)
+		{
+			if (seen.insert(v.first).second)
+			{
+				vals.push_back(v);
+			}
+		}
+		std::vector<std::string> names;
+		for (auto &v : vals)
+		{
+			names.push_back(v.first);
+		}
+		std::vector<size_t> slots;
+		auto displacements = perfectHash(names, slots);
+		Enum ordered(vals);
+		for (size_t i=0 ; i<vals.size() ; i++)
+		{
+			ordered[slots[i]] = vals[i];
+		}
+		const std::string table = enum_table_name(kv.first);
+		emit_perfect_hash_table(table + "_hash", displacements);
+		cout << "static const struct ffigen_constant " << table
+		     << "_values[] = {\n";
+		for (auto &v : ordered)
+		{
+			cout << "\t{ \"" << v.first << "\", " << v.second << " },\n";
+		}
+		cout << "\t{ 0, 0 }\n};\n";
+		cout << "static const struct ffigen_constant_table " << table
+		     << " = { " << table << "_values, " << table << "_hash, "
+		     << ordered.size() << " };\n";
+	}
 }
 
 void
 emit_enum_wrappers()
 {
 	cout << "duk_ret_t dukopen_module(duk_context *ctx)\n{\n"
-	     << "\tduk_push_object(ctx);\n"
-	     << "\tduk_put_function_list(ctx, -1, js_funcs);\n";
+	     << "\tduk_push_object(ctx);\n";
+	if (!options.lazy)
+	{
+		cout << "\tduk_put_function_list(ctx, -1, js_funcs);\n";
+		cout << "\tffigen_put_constants(ctx, -1, &js_constants);\n";
+	}
 	for (auto &kv : enums)
 	{
 		const std::string &name = kv.first;
-		Enum &vals = kv.second;
-		if (name != std::string())
+		if (name.empty())
 		{
-			cout << "\tduk_push_object(ctx);\n";
+			continue;
 		}
-		for (auto &v : vals)
+		cout << "\tffigen_push_constants(ctx, &" << enum_table_name(name)
+		     << ");\n"
+		     << "\tduk_put_prop_string(ctx, -2, \"" << name << "\");\n";
+	}
+	if (options.lazy)
+	{
+		// Wrap the module object in a proxy that creates functions on demand.
+		cout << "\tduk_push_global_object(ctx);\n"
+		        "\tduk_get_prop_string(ctx, -1, \"Proxy\");\n"
+		        "\tduk_remove(ctx, -2);\n"
+		        "\tduk_dup(ctx, -2);\n"
+		        "\tduk_push_object(ctx);\n"
+		        "\tduk_push_c_function(ctx, js_funcs_get, 3);\n"
+		        "\tduk_put_prop_string(ctx, -2, \"get\");\n"
+		        "\tduk_push_c_function(ctx, js_funcs_has, 2);\n"
+		        "\tduk_put_prop_string(ctx, -2, \"has\");\n"
+		        "\tduk_push_c_function(ctx, js_funcs_keys, 1);\n"
+		        "\tduk_put_prop_string(ctx, -2, \"enumerate\");\n"
+		        "\tduk_push_c_function(ctx, js_funcs_keys, 1);\n"
+		        "\tduk_put_prop_string(ctx, -2, \"ownKeys\");\n"
+		        "\tduk_new(ctx, 2);\n"
+		        "\tduk_remove(ctx, -2);\n";
+	}
+	cout << "\treturn 1;\n}\n";
+}
+
+/**
+ * Identifier for the format of cache entries.  This must be changed whenever
+ * the generated code changes, so that stale entries are not reused.
+ */
+const char cacheVersion[] = "ffigen-cache-3";
+
+/**
+ * 64-bit FNV-1a hash.  Used to construct cache keys and to detect changes to
+ * the files that a cached output depends on.
+ */
+uint64_t
+hash(const std::string &data, uint64_t h = 14695981039346656037ULL)
+{
+	for (unsigned char c : data)
+	{
+		h ^= c;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/**
+ * Read the entire contents of `path` into `contents`.  Returns false if the
+ * file can't be read.
+ */
+bool
+readFile(const std::string &path, std::string &contents)
+{
+	std::ifstream f(path, std::ios::binary);
+	if (!f)
+	{
+		return false;
+	}
+	std::stringstream ss;
+	ss << f.rdbuf();
+	contents = ss.str();
+	return true;
+}
+
+/**
+ * The output cache.  Each entry records the generated code for one
+ * invocation, keyed by the command-line arguments and the version of ffigen,
+ * along with the content hash of every file that the translation unit
+ * included.  If none of those files have changed then the cached output is
+ * emitted without invoking libclang.
+ */
+class OutputCache
+{
+	/**
+	 * The path of the cache entry for this invocation, or empty if caching is
+	 * disabled.
+	 */
+	std::string path;
+	public:
+	/**
+	 * Construct a cache for an invocation with the specified arguments (source
+	 * files, options and compiler flags), storing entries in `dir`.  An empty
+	 * `dir` disables caching.
+	 */
+	OutputCache(const std::string &dir, const std::vector<std::string> &args)
+	{
+		if (dir.empty())
 		{
-			cout << "\tduk_push_int(ctx, " << v.second << ");\n"
-			     << "\tduk_put_prop_string(ctx, -2, \"" << v.first << "\");\n";
+			return;
 		}
-		if (name != std::string())
+		uint64_t key = hash(cacheVersion);
+		for (auto &arg : args)
 		{
-			cout << "\tduk_put_prop_string(ctx, -2, \"" << name << "\");\n";
+			key = hash(arg, hash(std::string(1, '\0'), key));
 		}
+		std::stringstream ss;
+		ss << dir << '/' << std::hex << std::setw(16) << std::setfill('0')
+		   << key << ".ffigen";
+		path = ss.str();
 	}
-	cout << "\treturn 1;\n}\n";
+	/**
+	 * If there is a valid entry for this invocation, write it to `out` and
+	 * return true.
+	 */
+	bool emit(std::ostream &out)
+	{
+		std::string entry;
+		if (path.empty() || !readFile(path, entry))
+		{
+			return false;
+		}
+		std::istringstream in(entry);
+		std::string line;
+		if (!std::getline(in, line) || (line != cacheVersion))
+		{
+			return false;
+		}
+		// Each dependency line is `dep {hash} {path}`, followed by an `output
+		// {length}` line and then the generated code.
+		while (std::getline(in, line))
+		{
+			std::istringstream fields(line);
+			std::string tag;
+			fields >> tag;
+			if (tag == "output")
+			{
+				size_t length;
+				fields >> length;
+				size_t start = static_cast<size_t>(in.tellg());
+				if (!fields || (start + length != entry.size()))
+				{
+					return false;
+				}
+				out.write(entry.data() + start, length);
+				return true;
+			}
+			uint64_t expected;
+			std::string dep;
+			fields >> std::hex >> expected;
+			fields.get();
+			std::getline(fields, dep);
+			std::string contents;
+			if ((tag != "dep") || !readFile(dep, contents) ||
+			    (hash(contents) != expected))
+			{
+				return false;
+			}
+		}
+		return false;
+	}
+	/**
+	 * Store `output` as the entry for this invocation, recording the current
+	 * contents of each of `deps`.
+	 */
+	void store(const std::unordered_set<std::string> &deps,
+	           const std::string &output)
+	{
+		if (path.empty())
+		{
+			return;
+		}
+		// Write to a temporary file and rename it, so that concurrent
+		// invocations never see a partial entry.
+		std::string tmp = path + ".tmp";
+		{
+			std::ofstream f(tmp, std::ios::binary);
+			f << cacheVersion << '\n';
+			for (auto &dep : deps)
+			{
+				std::string contents;
+				if (!readFile(dep, contents))
+				{
+					f.setstate(std::ios::failbit);
+					break;
+				}
+				f << "dep " << std::hex << hash(contents) << std::dec << ' '
+				  << dep << '\n';
+			}
+			f << "output " << output.size() << '\n' << output;
+			if (!f)
+			{
+				cerr << "Warning: Unable to write cache entry " << path << '\n';
+				f.close();
+				std::remove(tmp.c_str());
+				return;
+			}
+		}
+		std::rename(tmp.c_str(), path.c_str());
+	}
+};
+
+/**
+ * Inclusion visitor that collects the names of all files that the translation
+ * unit depends on, including the main file.
+ */
+void
+collectInclusion(CXFile file,
+                 CXSourceLocation *stack,
+                 unsigned depth,
+                 CXClientData deps)
+{
+	RAIICXString name = clang_getFileName(file);
+	static_cast<std::unordered_set<std::string>*>(deps)->insert(name.str());
 }
 
 } // anonymous namespace
@@ -932,24 +1745,154 @@ main(int argc, char **argv)
 {
 	if (argc < 2)
 	{
-		cerr << "Usage: " << argv[0] << "{source file} [compiler flags]\n";
+		cerr << "Usage: " << argv[0]
+		     << "{source files} [-ffigen-cache={dir}] [-ffigen-allow={regex}]\n"
+		        "\t[-ffigen-deny={regex}] [-ffigen-header={regex}]\n"
+		        "\t[-ffigen-deprecated] [-ffigen-lazy] [compiler flags]\n";
 		return EXIT_FAILURE;
 	}
-	// Construct the libclang context and try to parse the file.
-	CXIndex idx = clang_createIndex(1, 1);
-	CXTranslationUnit translationUnit =
-		clang_createTranslationUnitFromSourceFile(idx, argv[1], argc-2, argv+2,
-				0, nullptr);
-	if (!translationUnit)
+	// The leading arguments are source files.  After that, split our own
+	// options from the flags that we pass to the compiler.
+	std::vector<std::string> sources;
+	std::string cacheDir;
+	std::vector<const char*> flags;
+	// Everything except the cache directory affects the output.
+	std::vector<std::string> cacheKey;
+	int arg = 1;
+	for (; (arg<argc) && (argv[arg][0] != '-') ; arg++)
+	{
+		sources.push_back(argv[arg]);
+		cacheKey.push_back(argv[arg]);
+	}
+	for (; arg<argc ; arg++)
+	{
+		std::string opt = argv[arg];
+		auto value = [&](const char *prefix)
+		{
+			size_t len = strlen(prefix);
+			return opt.compare(0, len, prefix) == 0 ? opt.substr(len) : "";
+		};
+		if (opt.compare(0, 14, "-ffigen-cache=") == 0)
+		{
+			cacheDir = opt.substr(14);
+			continue;
+		}
+		cacheKey.push_back(opt);
+		try
+		{
+			if (opt.compare(0, 14, "-ffigen-allow=") == 0)
+			{
+				options.allow.emplace_back(value("-ffigen-allow="));
+			}
+			else if (opt.compare(0, 13, "-ffigen-deny=") == 0)
+			{
+				options.deny.emplace_back(value("-ffigen-deny="));
+			}
+			else if (opt.compare(0, 15, "-ffigen-header=") == 0)
+			{
+				options.headers.emplace_back(value("-ffigen-header="));
+			}
+			else if (opt == "-ffigen-deprecated")
+			{
+				options.deprecated = true;
+			}
+			else if (opt == "-ffigen-lazy")
+			{
+				options.lazy = true;
+			}
+			else
+			{
+				flags.push_back(argv[arg]);
+			}
+		}
+		catch (std::regex_error &e)
+		{
+			cerr << "Invalid regular expression in " << opt << '\n';
+			return EXIT_FAILURE;
+		}
+	}
+	if (sources.empty())
 	{
-		cerr << "Unable to parse file\n";
+		cerr << "No source files specified\n";
 		return EXIT_FAILURE;
 	}
-	clang_visitChildren(clang_getTranslationUnitCursor(translationUnit),
-			visitTranslationUnit, 0);
+	OutputCache cache(cacheDir, cacheKey);
+	if (cache.emit(cout))
+	{
+		return EXIT_SUCCESS;
+	}
+	// Parse each source file on its own thread, with its own libclang index.
+	// We only look at declarations, so don't bother parsing the bodies of
+	// inline functions in headers.  The translation units must stay alive
+	// until we've finished emitting code, because the collected `CXType`s
+	// refer to them.
+	std::vector<CXIndex> indexes(sources.size());
+	std::vector<CXTranslationUnit> translationUnits(sources.size());
+	std::vector<Declarations> declarations(sources.size());
+	std::mutex lock;
+	size_t next = 0;
+	auto parse = [&]()
+	{
+		for (;;)
+		{
+			size_t i;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				if (next == sources.size())
+				{
+					return;
+				}
+				i = next++;
+			}
+			indexes[i] = clang_createIndex(1, 1);
+			translationUnits[i] =
+				clang_parseTranslationUnit(indexes[i], sources[i].c_str(),
+						flags.data(), flags.size(), nullptr, 0,
+						CXTranslationUnit_SkipFunctionBodies);
+			if (translationUnits[i])
+			{
+				clang_visitChildren(
+					clang_getTranslationUnitCursor(translationUnits[i]),
+					visitTranslationUnit, &declarations[i]);
+			}
+		}
+	};
+	size_t threadCount = std::thread::hardware_concurrency();
+	threadCount = std::max<size_t>(1, std::min(threadCount, sources.size()));
+	std::vector<std::thread> threads;
+	for (size_t i=1 ; i<threadCount ; i++)
+	{
+		threads.emplace_back(parse);
+	}
+	parse();
+	for (auto &t : threads)
+	{
+		t.join();
+	}
+	// Merge in the order that the files were specified, so that the output
+	// doesn't depend on thread scheduling.
+	std::unordered_set<std::string> deps;
+	for (size_t i=0 ; i<sources.size() ; i++)
+	{
+		if (!translationUnits[i])
+		{
+			cerr << "Unable to parse file " << sources[i] << '\n';
+			return EXIT_FAILURE;
+		}
+		mergeDeclarations(declarations[i]);
+		clang_getInclusions(translationUnits[i], collectInclusion, &deps);
+	}
+	// Generate the code into a buffer, so that we can store it in the cache.
+	std::stringstream output;
+	std::streambuf *stdoutBuffer = cout.rdbuf(output.rdbuf());
 	cout << "#include <duktape.h>\n";
 	cout << "#include <assert.h>\n";
-	cout << "#include \"" << argv[1] << "\"\n";
+	cout << "#include <stdint.h>\n";
+	cout << "#include <string.h>\n";
+	for (auto &source : sources)
+	{
+		cout << "#include \"" << source << "\"\n";
+	}
 	// Stick in the prototype for this ourself for now.  We should probably
 	// have a duk_ffi.h or similar that included the relevant functions from
 	// the duktape API plus our extensions.
@@ -957,14 +1900,21 @@ main(int argc, char **argv)
 	cout << "void *duk_push_array_buffer(duk_context *, duk_size_t );\n";
 
 	// Emit all of the wrapers
+	emit_perfect_hash_runtime();
 	emit_struct_wrappers();
+	emit_enum_tables();
 	emit_function_wrappers();
 	emit_enum_wrappers();
+	cout.rdbuf(stdoutBuffer);
+	cout << output.str();
+	cache.store(deps, output.str());
 	// Clean up (don't bother for non-debug builds, exit is our garbage
 	// collector!)
 #ifdef NDEBUG
-	clang_disposeTranslationUnit(translationUnit);
-	clang_disposeIndex(idx);
+	for (size_t i=0 ; i<sources.size() ; i++)
+	{
+		clang_disposeTranslationUnit(translationUnits[i]);
+		clang_disposeIndex(indexes[i]);
+	}
 #endif
 }
-
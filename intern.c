@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2015 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jsrun.h"
+
+/**
+ * The number of slots in the shared string table.  Must be a power of two.
+ */
+#define SHARED_STRING_SLOTS 16384
+/**
+ * The maximum number of strings that will be added to the table.  Keeping
+ * the table at most three quarters full bounds the length of probe
+ * sequences, and guarantees that every lookup finds an empty slot.
+ */
+#define SHARED_STRING_LIMIT ((SHARED_STRING_SLOTS / 4) * 3)
+/**
+ * The longest string that will be shared.
+ */
+#define SHARED_STRING_MAX_LEN 64
+
+/**
+ * A string in the shared table.  Entries are immutable once published and
+ * are never freed.
+ */
+struct shared_string
+{
+	uint32_t hash;
+	uint32_t length;
+	char data[];
+};
+
+/**
+ * The process-wide table, using open addressing with linear probing.  Slots
+ * go from NULL to an entry exactly once, so lookups need no locks.
+ */
+static _Atomic(struct shared_string *) table[SHARED_STRING_SLOTS];
+/**
+ * The number of entries that have been (or are being) added to the table.
+ * Callers that reserve a place and then don't add an entry give it back.
+ */
+static atomic_uint count;
+
+/**
+ * Returns true if the string looks like an identifier.  These are the
+ * strings (builtin names, property names, variable names) that are likely to
+ * be interned again in every heap.  Other strings, such as values in
+ * messages, would fill the table with strings that are rarely shared.
+ */
+static bool
+is_identifier(const char *str, size_t len)
+{
+	if ((len == 0) || (len > SHARED_STRING_MAX_LEN) ||
+	    ((str[0] >= '0') && (str[0] <= '9')))
+	{
+		return false;
+	}
+	for (size_t i=0 ; i<len ; i++)
+	{
+		char c = str[i];
+		if (!(((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+		      ((c >= '0') && (c <= '9')) || (c == '_') || (c == '$')))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * FNV-1a hash.
+ */
+static uint32_t
+hash_string(const char *str, size_t len)
+{
+	uint32_t h = 2166136261U;
+	for (size_t i=0 ; i<len ; i++)
+	{
+		h ^= (unsigned char)str[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static inline bool
+entry_matches(struct shared_string *e, uint32_t hash, const char *str,
+              size_t len)
+{
+	return (e->hash == hash) && (e->length == len) &&
+	       (memcmp(e->data, str, len) == 0);
+}
+
+const void *
+shared_string_intern(void *udata, const void *ptr, duk_size_t len)
+{
+	const char *str = ptr;
+	if (!is_identifier(str, len))
+	{
+		return NULL;
+	}
+	uint32_t hash = hash_string(str, len);
+	struct shared_string *new_entry = NULL;
+	for (uint32_t i=hash ; ; i++)
+	{
+		_Atomic(struct shared_string *) *slot =
+			&table[i & (SHARED_STRING_SLOTS - 1)];
+		struct shared_string *e =
+			atomic_load_explicit(slot, memory_order_acquire);
+		if (e == NULL)
+		{
+			// Not found.  Try to add it, unless the table is full.
+			if (new_entry == NULL)
+			{
+				if (atomic_fetch_add_explicit(&count, 1,
+				        memory_order_relaxed) >= SHARED_STRING_LIMIT)
+				{
+					atomic_fetch_sub_explicit(&count, 1, memory_order_relaxed);
+					return NULL;
+				}
+				new_entry = malloc(sizeof(struct shared_string) + len + 1);
+				if (new_entry == NULL)
+				{
+					atomic_fetch_sub_explicit(&count, 1, memory_order_relaxed);
+					return NULL;
+				}
+				new_entry->hash = hash;
+				new_entry->length = len;
+				memcpy(new_entry->data, str, len);
+				new_entry->data[len] = 0;
+			}
+			if (atomic_compare_exchange_strong_explicit(slot, &e, new_entry,
+			        memory_order_release, memory_order_acquire))
+			{
+				return new_entry->data;
+			}
+			// Another thread filled the slot first.  If it added the same
+			// string then use that one, otherwise keep probing.
+		}
+		if (entry_matches(e, hash, str, len))
+		{
+			// If we lost the race to add this string, give back the place
+			// that we reserved for it.
+			if (new_entry != NULL)
+			{
+				free(new_entry);
+				atomic_fetch_sub_explicit(&count, 1, memory_order_relaxed);
+			}
+			return e->data;
+		}
+	}
+}
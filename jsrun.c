@@ -231,9 +231,12 @@ handle_interactive(duk_context *ctx) {
 static void
 usage(void)
 {
-	fprintf(stderr, "Usage: duk [-i] [-l {bytes} ] [<filenames>]\n"
+	fprintf(stderr, "Usage: duk [-i] [-p {file}] [-m {file}] [-t {file}] [-l {bytes} ] [<filenames>]\n"
 	                "\n"
 	                "   -i         enter interactive mode after executing argument file(s)\n"
+	                "   -p {file}  write a sampling CPU profile to file at exit\n"
+	                "   -m {file}  write a profile of allocating call stacks to file at exit\n"
+	                "   -t {file}  write a trace of worker events to file at exit\n"
 	                "\n"
 	                "If <filename> is omitted, interactive mode is started automatically.\n");
 	fflush(stderr);
@@ -257,7 +260,7 @@ int main(int argc, char *argv[])
 		usage();
 	}
 
-	while ((ch = getopt(argc, argv, "ir")) != -1)
+	while ((ch = getopt(argc, argv, "im:p:rt:")) != -1)
 	{
 		switch (ch)
 		{
@@ -267,6 +270,24 @@ int main(int argc, char *argv[])
 			case 'i':
 				interactive = true;
 				break;
+			case 'p':
+				if (profile_start(optarg) != 0)
+				{
+					exit(1);
+				}
+				break;
+			case 'm':
+				if (alloc_profile_start(optarg) != 0)
+				{
+					exit(1);
+				}
+				break;
+			case 't':
+				if (trace_start(optarg) != 0)
+				{
+					exit(1);
+				}
+				break;
 			case '?':
 			default:
 				usage();
@@ -277,7 +298,7 @@ int main(int argc, char *argv[])
 	have_file = argc > 0;
 
 	// Create the context
-	ctx = duk_create_heap_default();
+	ctx = create_heap();
 	init_default_objects(ctx);
 
 	// Create an array containing all arguments after the 
@@ -332,7 +353,7 @@ int main(int argc, char *argv[])
 		fflush(stderr);
 	}
 
-	duk_destroy_heap(ctx);
+	destroy_heap(ctx);
 
 	return retval;
 }
@@ -1,5 +1,84 @@
+#include <stdbool.h>
+#include <stdint.h>
 #include "duktape.h"
 
+/**
+ * Create a new Duktape heap.  Small allocations made by the heap come from
+ * per-heap pools of fixed-size blocks, so the short-lived objects and strings
+ * created while handling messages are recycled without going through
+ * malloc().
+ */
+duk_context *create_heap(void);
+/**
+ * Destroy a heap created with `create_heap()` and release its pools.
+ */
+void destroy_heap(duk_context *ctx);
+/**
+ * Called by Duktape when it interns a new string.  Returns a pointer to a
+ * copy of the string's bytes in a process-wide table that is shared between
+ * heaps, or NULL if the heap should keep its own copy.  Only used when
+ * Duktape is built with external strings (see `SHARED_STRINGS_CFLAGS` in the
+ * Makefile).
+ */
+const void *shared_string_intern(void *udata, const void *ptr, duk_size_t len);
+/**
+ * Called by Duktape from the interpreter's periodic interrupt.  Records the
+ * JavaScript call stack if a profiler tick has happened since this thread
+ * last took a sample.  Only used when Duktape is built with the sampling hook
+ * (see `PROFILER_CFLAGS` in the Makefile).
+ */
+void profile_sample(void *udata, duk_context *ctx);
+/**
+ * Start the sampling profiler.  Samples are taken from every thread and are
+ * written to `file`, as collapsed stacks for flame graph tools, when the
+ * process exits.  Returns 0 on success.
+ */
+int profile_start(const char *file);
+/**
+ * Set when allocation profiling is enabled.
+ */
+extern _Atomic(bool) alloc_profile_enabled;
+/**
+ * Charge `bytes` of allocation to the current JavaScript call stack of `ctx`.
+ */
+void profile_allocation(duk_context *ctx, size_t bytes);
+/**
+ * Start the allocation profiler.  Allocations in every heap are sampled and
+ * the allocating call stacks, with the bytes charged to each, are written to
+ * `file` when the process exits.  Returns 0 on success.
+ */
+int alloc_profile_start(const char *file);
+
+/**
+ * Set when event tracing is enabled.  Use `TRACE()` to record events, so that
+ * they cost only this check when it isn't.
+ */
+extern _Atomic(bool) trace_enabled;
+/**
+ * Record an event with the specified Chrome trace-event phase in the calling
+ * thread's trace buffer.  `name` must be a string constant.
+ */
+void trace_event(char phase, const char *name, uint64_t arg);
+/**
+ * Set the name that the calling thread is shown with in the trace.
+ */
+void trace_thread_name(const char *name);
+/**
+ * Start recording events.  The trace is written to `file` in Chrome
+ * trace-event JSON format when the process exits.  Returns 0 on success.
+ */
+int trace_start(const char *file);
+/**
+ * Record a trace event if tracing is enabled.
+ */
+#define TRACE(phase, name, arg) \
+	do { \
+		if (trace_enabled) \
+		{ \
+			trace_event((phase), (name), (arg)); \
+		} \
+	} while (0)
+
 /**
  * Initialise the objects required for module loading to work.
  */
@@ -16,6 +95,62 @@ void init_env(duk_context *ctx);
  * Initialize TypedArray support.
  */
 void init_typed_array(duk_context *ctx);
+/**
+ * The kinds of typed array that jsrun knows about, in the order that they
+ * appear in arraykinds.inc.
+ */
+enum typed_array_kind
+{
+#define TYPED_ARRAY_CASE(name, type, arith) TYPED_ARRAY_##name,
+#include "arraykinds.inc"
+};
+/**
+ * Find the kind of the typed array at `idx`.  On success, returns the kind and
+ * sets `data` and `count` to the start and the length (in elements) of the
+ * array's view of its buffer.  Returns -1 if the value is not a typed array of
+ * a kind that we know.
+ */
+int get_typed_array(duk_context *ctx, duk_idx_t idx, void **data,
+                    size_t *count);
+/**
+ * A block of memory that can be shared between the heaps of several threads.
+ * Each `SharedArrayBuffer` object holds a reference to one.
+ */
+struct shared_buffer;
+/**
+ * Initialise `SharedArrayBuffer` and `Atomics`.  Must be called after
+ * `init_typed_array()`.
+ */
+void init_shared_memory(duk_context *ctx);
+/**
+ * Returns the shared buffer of the `SharedArrayBuffer` at `idx`, or NULL if
+ * the value is not a `SharedArrayBuffer`.  Does not take a reference.
+ */
+struct shared_buffer *get_shared_buffer(duk_context *ctx, duk_idx_t idx);
+/**
+ * Take a reference to a shared buffer.
+ */
+void retain_shared_buffer(struct shared_buffer *b);
+/**
+ * Release a reference to a shared buffer, freeing it if this was the last.
+ */
+void release_shared_buffer(struct shared_buffer *b);
+/**
+ * Push a new `SharedArrayBuffer` object for `b`.  The heap takes over the
+ * caller's reference, which it holds until it is destroyed.
+ */
+void push_shared_buffer(duk_context *ctx, struct shared_buffer *b);
+/**
+ * Returns a NULL-terminated array of the shared buffers that the heap of
+ * `ctx` holds references to, or NULL if it has none, and passes the references
+ * to the caller.  Called when the heap is about to be destroyed.
+ */
+struct shared_buffer **take_heap_shared_buffers(duk_context *ctx);
+/**
+ * Release the references returned by `take_heap_shared_buffers()`, once the
+ * heap has been destroyed, and free the array.
+ */
+void release_shared_buffers(struct shared_buffer **buffers);
 /**
  * Keep the context running for as long as it has a receive port with pending
  * messages.
@@ -40,4 +175,6 @@ static inline void init_default_objects(duk_context *ctx)
 	init_env(ctx);
 	init_modules(ctx);
 	init_workers(ctx);
+	init_typed_array(ctx);
+	init_shared_memory(ctx);
 }
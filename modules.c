@@ -64,7 +64,7 @@ static duk_ret_t load_native_module(duk_context *ctx) {
 	}
 	const char *file = duk_get_string(ctx, -1);
 	pthread_mutex_lock(&lock);
-	void *lib = dlopen(file, RTLD_LOCAL);
+	void *lib = dlopen(file, RTLD_LAZY | RTLD_LOCAL);
 	if (!lib)
 	{
 		pthread_mutex_unlock(&lock);
@@ -95,11 +95,11 @@ static const char modSearch[] =
 "       name = './' + id + '.so';\n"
 "       lib = Duktape.loadNativeModule(name);\n"
 "    }\n"
+"    // Use the native module object directly, rather than copying its\n"
+"    // properties, so that lazily registered modules stay lazy.\n"
 "    if (lib)\n"
 "    {\n"
-"        for(var prop in lib) {\n"
-"            exports[prop] = lib[prop];\n"
-"        }\n"
+"        module.exports = lib;\n"
 "        found = true;\n"
 "    }\n"
 "\n"
@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2015 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "jsrun.h"
+
+/**
+ * The interval between profiler ticks, in microseconds of CPU time.
+ */
+#define PROFILE_INTERVAL_US 1000
+/**
+ * The number of buckets in a table of sampled stacks.
+ */
+#define PROFILE_BUCKETS 4096
+/**
+ * The space for a collapsed stack.  Deeper stacks are truncated at the
+ * innermost end.
+ */
+#define PROFILE_STACK_MAX 4096
+
+/**
+ * A distinct call stack and the total weight (samples or bytes) recorded for
+ * it.
+ */
+struct stack_count
+{
+	struct stack_count *next;
+	uint64_t count;
+	/**
+	 * The stack in collapsed form: frames from outermost to innermost,
+	 * separated by semicolons.
+	 */
+	char stack[];
+};
+
+/**
+ * A table of sampled stacks, shared by all threads.
+ */
+struct stack_table
+{
+	/**
+	 * Lock protecting the buckets.
+	 */
+	pthread_mutex_t lock;
+	/**
+	 * The stacks, chained in buckets by hash.
+	 */
+	struct stack_count *buckets[PROFILE_BUCKETS];
+	/**
+	 * The file that the table is written to at exit.
+	 */
+	const char *file;
+};
+
+/**
+ * Stacks sampled by the CPU profiler, weighted by sample count.
+ */
+static struct stack_table cpu_profile = { PTHREAD_MUTEX_INITIALIZER };
+/**
+ * Stacks sampled by the allocation profiler, weighted by bytes allocated.
+ */
+static struct stack_table alloc_profile = { PTHREAD_MUTEX_INITIALIZER };
+/**
+ * Incremented by the timer signal.  Each thread takes a sample the next time
+ * that its interpreter is interrupted after this changes.
+ */
+static atomic_uint profile_ticks;
+/**
+ * The value of `profile_ticks` when this thread last took a sample.
+ */
+static _Thread_local unsigned last_tick;
+
+_Atomic(bool) alloc_profile_enabled;
+
+/**
+ * Signal handler for the profiler timer.
+ */
+static void
+profile_tick(int sig)
+{
+	atomic_fetch_add_explicit(&profile_ticks, 1, memory_order_relaxed);
+}
+
+/**
+ * FNV-1a hash.
+ */
+static uint32_t
+hash_stack(const char *str, size_t len)
+{
+	uint32_t h = 2166136261U;
+	for (size_t i=0 ; i<len ; i++)
+	{
+		h ^= (unsigned char)str[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/**
+ * Add `weight` to the collapsed stack `stack` in table `t`.
+ */
+static void
+record_stack(struct stack_table *t, const char *stack, size_t len,
+             uint64_t weight)
+{
+	struct stack_count **bucket =
+		&t->buckets[hash_stack(stack, len) & (PROFILE_BUCKETS - 1)];
+	pthread_mutex_lock(&t->lock);
+	for (struct stack_count *s=*bucket ; s != NULL ; s=s->next)
+	{
+		if ((strncmp(s->stack, stack, len) == 0) && (s->stack[len] == '\0'))
+		{
+			s->count += weight;
+			pthread_mutex_unlock(&t->lock);
+			return;
+		}
+	}
+	struct stack_count *s = malloc(sizeof(struct stack_count) + len + 1);
+	if (s != NULL)
+	{
+		s->count = weight;
+		memcpy(s->stack, stack, len);
+		s->stack[len] = '\0';
+		s->next = *bucket;
+		*bucket = s;
+	}
+	pthread_mutex_unlock(&t->lock);
+}
+
+/**
+ * Write the JavaScript call stack of `ctx` into `stack` in collapsed form.
+ * Returns the length, which is 0 if no JavaScript code is running.
+ */
+static size_t
+collapse_stack(duk_context *ctx, char *stack, size_t size)
+{
+	// Find the outermost frame, so that the stack can be written root first.
+	duk_int_t depth = 0;
+	const char *name, *file;
+	duk_int_t line;
+	while (duk_get_stack_frame(ctx, -(depth + 1), &name, &file, &line))
+	{
+		depth++;
+	}
+	size_t len = 0;
+	for (duk_int_t level=-depth ; level<0 ; level++)
+	{
+		duk_get_stack_frame(ctx, level, &name, &file, &line);
+		if (name == NULL || *name == '\0')
+		{
+			name = file == NULL ? "(native)" : "(anonymous)";
+		}
+		int n = file == NULL ?
+			snprintf(stack + len, size - len, "%s%s",
+			         len == 0 ? "" : ";", name) :
+			snprintf(stack + len, size - len, "%s%s (%s:%d)",
+			         len == 0 ? "" : ";", name, file, (int)line);
+		if ((n < 0) || ((size_t)n >= size - len))
+		{
+			break;
+		}
+		len += n;
+	}
+	return len;
+}
+
+void
+profile_sample(void *udata, duk_context *ctx)
+{
+	unsigned tick = atomic_load_explicit(&profile_ticks, memory_order_relaxed);
+	if (tick == last_tick)
+	{
+		return;
+	}
+	last_tick = tick;
+	char stack[PROFILE_STACK_MAX];
+	size_t len = collapse_stack(ctx, stack, sizeof(stack));
+	if (len > 0)
+	{
+		record_stack(&cpu_profile, stack, len, 1);
+	}
+}
+
+void
+profile_allocation(duk_context *ctx, size_t bytes)
+{
+	char stack[PROFILE_STACK_MAX];
+	size_t len = collapse_stack(ctx, stack, sizeof(stack));
+	if (len == 0)
+	{
+		len = snprintf(stack, sizeof(stack), "(no JavaScript)");
+	}
+	record_stack(&alloc_profile, stack, len, bytes);
+}
+
+static int
+compare_counts(const void *a, const void *b)
+{
+	uint64_t ca = (*(struct stack_count *const *)a)->count;
+	uint64_t cb = (*(struct stack_count *const *)b)->count;
+	return ca < cb ? 1 : (ca > cb ? -1 : 0);
+}
+
+/**
+ * Write a table to its file.  Each line is a collapsed stack followed by its
+ * weight, the input format for flame graph tools.  The heaviest stacks are
+ * written first.
+ */
+static void
+write_table(struct stack_table *t)
+{
+	FILE *f = fopen(t->file, "w");
+	if (f == NULL)
+	{
+		perror(t->file);
+		return;
+	}
+	pthread_mutex_lock(&t->lock);
+	size_t count = 0;
+	for (int i=0 ; i<PROFILE_BUCKETS ; i++)
+	{
+		for (struct stack_count *s=t->buckets[i] ; s != NULL ; s=s->next)
+		{
+			count++;
+		}
+	}
+	struct stack_count **sorted = calloc(count, sizeof(struct stack_count*));
+	if (sorted != NULL)
+	{
+		size_t n = 0;
+		for (int i=0 ; i<PROFILE_BUCKETS ; i++)
+		{
+			for (struct stack_count *s=t->buckets[i] ; s != NULL ; s=s->next)
+			{
+				sorted[n++] = s;
+			}
+		}
+		qsort(sorted, count, sizeof(struct stack_count*), compare_counts);
+		for (size_t i=0 ; i<count ; i++)
+		{
+			fprintf(f, "%s %llu\n", sorted[i]->stack,
+			        (unsigned long long)sorted[i]->count);
+		}
+		free(sorted);
+	}
+	pthread_mutex_unlock(&t->lock);
+	fclose(f);
+}
+
+/**
+ * Write the CPU profile at exit.
+ */
+static void
+profile_write(void)
+{
+	struct itimerval stop = { { 0, 0 }, { 0, 0 } };
+	setitimer(ITIMER_PROF, &stop, NULL);
+	write_table(&cpu_profile);
+}
+
+/**
+ * Write the allocation profile at exit.
+ */
+static void
+alloc_profile_write(void)
+{
+	alloc_profile_enabled = false;
+	write_table(&alloc_profile);
+}
+
+int
+profile_start(const char *file)
+{
+#ifndef DUK_USE_EXEC_SAMPLE_HOOK
+	fprintf(stderr, "Profiling is not supported by this build\n");
+	return -1;
+#else
+	cpu_profile.file = file;
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = profile_tick;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGPROF, &sa, NULL) != 0)
+	{
+		perror("sigaction");
+		return -1;
+	}
+	struct itimerval interval = {
+		{ 0, PROFILE_INTERVAL_US },
+		{ 0, PROFILE_INTERVAL_US }
+	};
+	if (setitimer(ITIMER_PROF, &interval, NULL) != 0)
+	{
+		perror("setitimer");
+		return -1;
+	}
+	atexit(profile_write);
+	return 0;
+#endif
+}
+
+int
+alloc_profile_start(const char *file)
+{
+	alloc_profile.file = file;
+	alloc_profile_enabled = true;
+	atexit(alloc_profile_write);
+	return 0;
+}
@@ -0,0 +1,776 @@
+/*
+ * Copyright (c) 2015 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+/**
+ * Shared memory between workers.  A `SharedArrayBuffer` is an `ArrayBuffer`
+ * whose bytes live in a reference-counted block outside of any Duktape heap,
+ * so every thread that is sent one sees the same memory.  Typed array views on
+ * it are ordinary Duktape views of an external buffer.
+ *
+ * Duktape never frees the bytes of an external buffer, and the plain buffer
+ * that points at them can escape from the `SharedArrayBuffer` object (for
+ * example with `Duktape.Buffer()`) and outlive it.  Each heap therefore holds a
+ * single reference to every shared buffer that it has seen, which is released
+ * when the heap is destroyed, rather than each object holding one.
+ *
+ * `Atomics` provides sequentially consistent operations on integer typed
+ * arrays, and `wait()` / `notify()` on `Int32Array`s over shared memory.  On
+ * Linux these are implemented with a futex on the element itself, elsewhere
+ * with a process-wide list of waiting threads.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "jsrun.h"
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/**
+ * The largest timeout (in milliseconds) that `Atomics.wait()` treats as
+ * finite.  Longer timeouts (around 30,000 years) wait forever, so that the
+ * deadline can't overflow.
+ */
+#define WAIT_FOREVER_MS 1e15
+
+struct shared_buffer
+{
+	/**
+	 * The number of references to this buffer.  Each heap that has a
+	 * `SharedArrayBuffer` for it holds one, as does each message that carries
+	 * the buffer.
+	 */
+	_Atomic(int) refcount;
+	/**
+	 * The length of the buffer, in bytes.
+	 */
+	size_t length;
+	/**
+	 * The contents of the buffer, aligned for the largest typed array
+	 * element.
+	 */
+	_Alignas(double) char data[];
+};
+
+/**
+ * Allocate a zero-filled shared buffer of `length` bytes, with one reference.
+ */
+static struct shared_buffer *
+create_shared_buffer(size_t length)
+{
+	struct shared_buffer *b = calloc(sizeof(struct shared_buffer) + length, 1);
+	if (b == NULL)
+	{
+		return NULL;
+	}
+	b->refcount = 1;
+	b->length = length;
+	return b;
+}
+
+void
+retain_shared_buffer(struct shared_buffer *b)
+{
+	atomic_fetch_add(&b->refcount, 1);
+}
+
+void
+release_shared_buffer(struct shared_buffer *b)
+{
+	if (atomic_fetch_sub(&b->refcount, 1) == 1)
+	{
+		free(b);
+	}
+}
+
+void
+push_shared_buffer(duk_context *ctx, struct shared_buffer *b)
+{
+	// Record the reference in the heap's list, unless the heap already holds
+	// one for this buffer.
+	duk_push_heap_stash(ctx);
+	duk_get_prop_string(ctx, -1, "shared_buffers");
+	duk_push_sprintf(ctx, "%p", (void*)b);
+	duk_dup_top(ctx);
+	if (duk_has_prop(ctx, -3))
+	{
+		duk_pop_3(ctx);
+		release_shared_buffer(b);
+	}
+	else
+	{
+		duk_push_pointer(ctx, b);
+		duk_put_prop(ctx, -3);
+		duk_pop_2(ctx);
+	}
+	duk_push_external_buffer(ctx);
+	duk_config_buffer(ctx, -1, b->data, b->length);
+	duk_push_buffer_object(ctx, -1, 0, b->length, DUK_BUFOBJ_ARRAYBUFFER);
+	duk_remove(ctx, -2);
+	duk_push_pointer(ctx, b);
+	duk_put_prop_string(ctx, -2, "\xFF" "shared");
+	duk_push_heap_stash(ctx);
+	duk_get_prop_string(ctx, -1, "shared_array_buffer_prototype");
+	duk_set_prototype(ctx, -3);
+	duk_pop(ctx); // heap stash
+}
+
+struct shared_buffer *
+get_shared_buffer(duk_context *ctx, duk_idx_t idx)
+{
+	if (!duk_is_object(ctx, idx))
+	{
+		return NULL;
+	}
+	duk_get_prop_string(ctx, idx, "\xFF" "shared");
+	struct shared_buffer *b = duk_get_pointer(ctx, -1);
+	duk_pop(ctx);
+	// The pointer is visible in objects that inherit from a
+	// SharedArrayBuffer, so check that this is the buffer object itself.
+	duk_size_t size;
+	if ((b == NULL) || (duk_get_buffer_data(ctx, idx, &size) != b->data))
+	{
+		return NULL;
+	}
+	return b;
+}
+
+/**
+ * The `SharedArrayBuffer` constructor.  Takes the length in bytes.
+ */
+static duk_ret_t
+shared_array_buffer_constructor(duk_context *ctx)
+{
+	if (!duk_is_constructor_call(ctx))
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	double length = duk_to_number(ctx, 0);
+	if (!(length >= 0) || (length != floor(length)) || (length > UINT32_MAX))
+	{
+		return DUK_RET_RANGE_ERROR;
+	}
+	struct shared_buffer *b = create_shared_buffer(length);
+	if (b == NULL)
+	{
+		return DUK_RET_ALLOC_ERROR;
+	}
+	push_shared_buffer(ctx, b);
+	return 1;
+}
+
+struct shared_buffer **
+take_heap_shared_buffers(duk_context *ctx)
+{
+	duk_push_heap_stash(ctx);
+	if (!duk_get_prop_string(ctx, -1, "shared_buffers"))
+	{
+		duk_pop_2(ctx);
+		return NULL;
+	}
+	size_t count = 0;
+	size_t size = 8;
+	struct shared_buffer **buffers = malloc(size * sizeof(struct shared_buffer *));
+	duk_enum(ctx, -1, DUK_ENUM_OWN_PROPERTIES_ONLY);
+	while (duk_next(ctx, -1, true))
+	{
+		if (count + 1 == size)
+		{
+			size *= 2;
+			buffers = realloc(buffers, size * sizeof(struct shared_buffer *));
+		}
+		buffers[count++] = duk_get_pointer(ctx, -1);
+		duk_pop_2(ctx);
+	}
+	buffers[count] = NULL;
+	duk_pop(ctx); // enumerator
+	// Anything that runs before the heap is destroyed must not record the
+	// references again.
+	duk_push_object(ctx);
+	duk_put_prop_string(ctx, -3, "shared_buffers");
+	duk_pop_2(ctx);
+	return buffers;
+}
+
+void
+release_shared_buffers(struct shared_buffer **buffers)
+{
+	if (buffers == NULL)
+	{
+		return;
+	}
+	for (struct shared_buffer **b=buffers ; *b != NULL ; b++)
+	{
+		release_shared_buffer(*b);
+	}
+	free(buffers);
+}
+
+/**
+ * An element of an integer typed array that an `Atomics` function operates
+ * on.
+ */
+struct atomic_element
+{
+	/**
+	 * The address of the element.
+	 */
+	void *ptr;
+	/**
+	 * The size of the element, in bytes.
+	 */
+	size_t size;
+	/**
+	 * True if the element is a signed integer.
+	 */
+	bool is_signed;
+};
+
+/**
+ * Find the element of the integer typed array in argument 0 selected by the
+ * index in argument 1.  Returns 0 on success or an error code.
+ */
+static duk_ret_t
+get_atomic_element(duk_context *ctx, struct atomic_element *e)
+{
+	void *data;
+	size_t count;
+	int kind = get_typed_array(ctx, 0, &data, &count);
+	switch (kind)
+	{
+		case TYPED_ARRAY_Int8:
+		case TYPED_ARRAY_Int16:
+		case TYPED_ARRAY_Int32:
+			e->is_signed = true;
+			break;
+		case TYPED_ARRAY_UInt8:
+		case TYPED_ARRAY_UInt16:
+		case TYPED_ARRAY_UInt32:
+			e->is_signed = false;
+			break;
+		default:
+			return DUK_RET_TYPE_ERROR;
+	}
+	double index = duk_to_number(ctx, 1);
+	if (!(index >= 0) || (index != floor(index)) || (index >= count))
+	{
+		return DUK_RET_RANGE_ERROR;
+	}
+	duk_size_t size;
+	duk_get_buffer_data(ctx, 0, &size);
+	e->size = size / count;
+	e->ptr = (char*)data + ((size_t)index * e->size);
+	return 0;
+}
+
+/**
+ * Push the value of an element, given its bits.
+ */
+static void
+push_element(duk_context *ctx, struct atomic_element *e, uint32_t bits)
+{
+	if (!e->is_signed)
+	{
+		duk_push_number(ctx, bits);
+		return;
+	}
+	switch (e->size)
+	{
+		case 1:
+			duk_push_int(ctx, (int8_t)bits);
+			break;
+		case 2:
+			duk_push_int(ctx, (int16_t)bits);
+			break;
+		default:
+			duk_push_int(ctx, (int32_t)bits);
+	}
+}
+
+/**
+ * The operations implemented by `atomic_op()`.
+ */
+enum atomic_op
+{
+	ATOMIC_LOAD,
+	ATOMIC_STORE,
+	ATOMIC_ADD,
+	ATOMIC_COMPARE_EXCHANGE
+};
+
+/**
+ * Perform one operation on element `e`.  Values are passed as the low bits of
+ * their `ToUint32` conversion, which is how JavaScript stores them into
+ * smaller integer types.  Returns the bits of the element's old value, or
+ * the loaded or stored value.
+ */
+static uint32_t
+atomic_op(struct atomic_element *e, enum atomic_op op, uint32_t value,
+          uint32_t replacement)
+{
+#define ATOMIC_OP(type) \
+	do { \
+		type *p = e->ptr; \
+		type expected = (type)value; \
+		switch (op) \
+		{ \
+			case ATOMIC_LOAD: \
+				return __atomic_load_n(p, __ATOMIC_SEQ_CST); \
+			case ATOMIC_STORE: \
+				__atomic_store_n(p, (type)value, __ATOMIC_SEQ_CST); \
+				return value; \
+			case ATOMIC_ADD: \
+				return __atomic_fetch_add(p, (type)value, __ATOMIC_SEQ_CST); \
+			case ATOMIC_COMPARE_EXCHANGE: \
+				__atomic_compare_exchange_n(p, &expected, (type)replacement, \
+					false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+				return expected; \
+		} \
+	} while (0)
+	switch (e->size)
+	{
+		case 1:
+			ATOMIC_OP(uint8_t);
+			break;
+		case 2:
+			ATOMIC_OP(uint16_t);
+			break;
+		default:
+			ATOMIC_OP(uint32_t);
+	}
+#undef ATOMIC_OP
+	return 0;
+}
+
+/**
+ * `Atomics.load(array, index)`.  Returns the element.
+ */
+static duk_ret_t
+atomics_load(duk_context *ctx)
+{
+	struct atomic_element e;
+	duk_ret_t ret = get_atomic_element(ctx, &e);
+	if (ret != 0)
+	{
+		return ret;
+	}
+	push_element(ctx, &e, atomic_op(&e, ATOMIC_LOAD, 0, 0));
+	return 1;
+}
+
+/**
+ * `Atomics.store(array, index, value)`.  Returns the value, converted to an
+ * integer but not truncated to the element type.
+ */
+static duk_ret_t
+atomics_store(duk_context *ctx)
+{
+	struct atomic_element e;
+	duk_ret_t ret = get_atomic_element(ctx, &e);
+	if (ret != 0)
+	{
+		return ret;
+	}
+	double value = duk_to_number(ctx, 2);
+	atomic_op(&e, ATOMIC_STORE, duk_to_uint32(ctx, 2), 0);
+	duk_push_number(ctx, isnan(value) ? 0 : trunc(value));
+	return 1;
+}
+
+/**
+ * `Atomics.add(array, index, value)`.  Returns the old value of the element.
+ */
+static duk_ret_t
+atomics_add(duk_context *ctx)
+{
+	struct atomic_element e;
+	duk_ret_t ret = get_atomic_element(ctx, &e);
+	if (ret != 0)
+	{
+		return ret;
+	}
+	push_element(ctx, &e, atomic_op(&e, ATOMIC_ADD, duk_to_uint32(ctx, 2), 0));
+	return 1;
+}
+
+/**
+ * `Atomics.compareExchange(array, index, expected, replacement)`.  Stores the
+ * replacement if the element is equal to the expected value (after both are
+ * converted to the element type).  Returns the old value of the element.
+ */
+static duk_ret_t
+atomics_compare_exchange(duk_context *ctx)
+{
+	struct atomic_element e;
+	duk_ret_t ret = get_atomic_element(ctx, &e);
+	if (ret != 0)
+	{
+		return ret;
+	}
+	uint32_t expected = duk_to_uint32(ctx, 2);
+	uint32_t replacement = duk_to_uint32(ctx, 3);
+	push_element(ctx, &e,
+		atomic_op(&e, ATOMIC_COMPARE_EXCHANGE, expected, replacement));
+	return 1;
+}
+
+/**
+ * The results of waiting, in the order of the strings that `Atomics.wait()`
+ * returns for them.
+ */
+enum wait_result
+{
+	WAIT_OK,
+	WAIT_NOT_EQUAL,
+	WAIT_TIMED_OUT
+};
+
+static const char *const wait_results[] = { "ok", "not-equal", "timed-out" };
+
+#ifdef __linux__
+/**
+ * Wait on the futex at `addr` until it is woken, provided that it contains
+ * `value`.  `deadline` is an absolute time on the monotonic clock, or NULL to
+ * wait forever.
+ */
+static enum wait_result
+wait_on_address(int32_t *addr, int32_t value, struct timespec *deadline)
+{
+	for (;;)
+	{
+		// The bitset variant takes an absolute timeout, so the deadline
+		// doesn't need recalculating when a signal interrupts the wait.
+		long ret = syscall(SYS_futex, addr,
+		                   FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, value,
+		                   deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+		if (ret == 0)
+		{
+			return WAIT_OK;
+		}
+		switch (errno)
+		{
+			case EINTR:
+				continue;
+			case EAGAIN:
+				return WAIT_NOT_EQUAL;
+			case ETIMEDOUT:
+				return WAIT_TIMED_OUT;
+		}
+		return WAIT_OK;
+	}
+}
+
+/**
+ * Wake up to `count` threads waiting on `addr`.  Returns the number woken.
+ */
+static int
+notify_address(int32_t *addr, int count)
+{
+	long ret = syscall(SYS_futex, addr, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, count,
+	                   NULL, NULL, 0);
+	return ret < 0 ? 0 : ret;
+}
+
+/**
+ * The clock that wait deadlines are measured with.
+ */
+#define WAIT_CLOCK CLOCK_MONOTONIC
+#else
+/**
+ * A thread blocked in `Atomics.wait()`.
+ */
+struct waiter
+{
+	/**
+	 * The next waiter in the list.
+	 */
+	struct waiter *next;
+	/**
+	 * The address that the thread is waiting on.
+	 */
+	int32_t *addr;
+	/**
+	 * Condition variable that the thread sleeps on.
+	 */
+	pthread_cond_t cond;
+	/**
+	 * Set when the waiter has been woken by `notify_address()`.
+	 */
+	bool woken;
+};
+
+/**
+ * All threads blocked in `Atomics.wait()`, in the order that they started
+ * waiting.
+ */
+static struct waiter *waiters;
+/**
+ * Lock protecting `waiters`.
+ */
+static pthread_mutex_t waiters_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Remove `w` from the list of waiters.  Must be called with `waiters_lock`
+ * held.
+ */
+static void
+remove_waiter(struct waiter *w)
+{
+	for (struct waiter **p = &waiters ; *p != NULL ; p = &(*p)->next)
+	{
+		if (*p == w)
+		{
+			*p = w->next;
+			return;
+		}
+	}
+}
+
+static enum wait_result
+wait_on_address(int32_t *addr, int32_t value, struct timespec *deadline)
+{
+	pthread_mutex_lock(&waiters_lock);
+	// Stores are not made under the lock, but notifications are, so a store
+	// followed by a notification can't be missed between this check and
+	// adding ourself to the list.
+	if (__atomic_load_n(addr, __ATOMIC_SEQ_CST) != value)
+	{
+		pthread_mutex_unlock(&waiters_lock);
+		return WAIT_NOT_EQUAL;
+	}
+	struct waiter w = { .addr = addr };
+	pthread_cond_init(&w.cond, NULL);
+	struct waiter **tail = &waiters;
+	while (*tail != NULL)
+	{
+		tail = &(*tail)->next;
+	}
+	*tail = &w;
+	enum wait_result result = WAIT_OK;
+	while (!w.woken)
+	{
+		if (deadline == NULL)
+		{
+			pthread_cond_wait(&w.cond, &waiters_lock);
+		}
+		else if (pthread_cond_timedwait(&w.cond, &waiters_lock, deadline) ==
+		         ETIMEDOUT)
+		{
+			if (!w.woken)
+			{
+				remove_waiter(&w);
+				result = WAIT_TIMED_OUT;
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(&waiters_lock);
+	pthread_cond_destroy(&w.cond);
+	return result;
+}
+
+static int
+notify_address(int32_t *addr, int count)
+{
+	int woken = 0;
+	pthread_mutex_lock(&waiters_lock);
+	struct waiter **p = &waiters;
+	while ((*p != NULL) && (woken < count))
+	{
+		struct waiter *w = *p;
+		if (w->addr != addr)
+		{
+			p = &w->next;
+			continue;
+		}
+		*p = w->next;
+		w->woken = true;
+		pthread_cond_signal(&w->cond);
+		woken++;
+	}
+	pthread_mutex_unlock(&waiters_lock);
+	return woken;
+}
+
+#define WAIT_CLOCK CLOCK_REALTIME
+#endif
+
+/**
+ * Find the element of an `Int32Array` over shared memory for `Atomics.wait()`
+ * or `Atomics.notify()`.  Sets `shared` to false if the array is not over a
+ * `SharedArrayBuffer`.  Returns 0 on success or an error code.
+ */
+static duk_ret_t
+get_wait_address(duk_context *ctx, int32_t **addr, bool *shared)
+{
+	struct atomic_element e;
+	duk_ret_t ret = get_atomic_element(ctx, &e);
+	if (ret != 0)
+	{
+		return ret;
+	}
+	if (!e.is_signed || (e.size != sizeof(int32_t)))
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	*addr = e.ptr;
+	duk_get_prop_string(ctx, 0, "buffer");
+	*shared = (get_shared_buffer(ctx, -1) != NULL);
+	duk_pop(ctx);
+	return 0;
+}
+
+/**
+ * `Atomics.wait(array, index, value, timeout)`.  Blocks the calling thread
+ * until it is woken by `Atomics.notify()`, provided that the element is equal
+ * to the value, or until the timeout (in milliseconds, by default forever) has
+ * elapsed.  Returns `"ok"`, `"not-equal"` or `"timed-out"`.
+ */
+static duk_ret_t
+atomics_wait(duk_context *ctx)
+{
+	int32_t *addr;
+	bool shared;
+	duk_ret_t ret = get_wait_address(ctx, &addr, &shared);
+	if (ret != 0)
+	{
+		return ret;
+	}
+	if (!shared)
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	int32_t value = duk_to_int32(ctx, 2);
+	double timeout = duk_is_undefined(ctx, 3) ? INFINITY : duk_to_number(ctx, 3);
+	struct timespec deadline;
+	struct timespec *deadline_ptr = NULL;
+	if (!isnan(timeout) && (timeout < WAIT_FOREVER_MS))
+	{
+		if (timeout < 0)
+		{
+			timeout = 0;
+		}
+		clock_gettime(WAIT_CLOCK, &deadline);
+		uint64_t ns = (uint64_t)(timeout * 1000000);
+		deadline.tv_sec += ns / 1000000000;
+		deadline.tv_nsec += ns % 1000000000;
+		if (deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		deadline_ptr = &deadline;
+	}
+	TRACE('B', "Atomics.wait", 0);
+	enum wait_result result = wait_on_address(addr, value, deadline_ptr);
+	TRACE('E', "Atomics.wait", 0);
+	duk_push_string(ctx, wait_results[result]);
+	return 1;
+}
+
+/**
+ * `Atomics.notify(array, index, count)`.  Wakes up to `count` (by default
+ * all) of the threads waiting on the element.  Returns the number woken,
+ * which is always 0 for arrays that are not over shared memory.
+ */
+static duk_ret_t
+atomics_notify(duk_context *ctx)
+{
+	int32_t *addr;
+	bool shared;
+	duk_ret_t ret = get_wait_address(ctx, &addr, &shared);
+	if (ret != 0)
+	{
+		return ret;
+	}
+	int count = INT_MAX;
+	if (!duk_is_undefined(ctx, 2))
+	{
+		double c = duk_to_number(ctx, 2);
+		if (isnan(c) || (c < 0))
+		{
+			c = 0;
+		}
+		if (c < INT_MAX)
+		{
+			count = c;
+		}
+	}
+	duk_push_int(ctx, shared ? notify_address(addr, count) : 0);
+	return 1;
+}
+
+static const duk_function_list_entry atomics[] = {
+	{ "load", atomics_load, 2 },
+	{ "store", atomics_store, 3 },
+	{ "add", atomics_add, 3 },
+	{ "compareExchange", atomics_compare_exchange, 4 },
+	{ "wait", atomics_wait, 4 },
+	{ "notify", atomics_notify, 3 },
+	{ 0, 0, 0 }
+};
+
+void
+init_shared_memory(duk_context *ctx)
+{
+	duk_push_global_object(ctx);
+	// SharedArrayBuffer objects are ArrayBuffers with a different prototype,
+	// which is also kept in the heap stash for creating the objects for
+	// buffers that are sent to this thread.
+	duk_push_c_function(ctx, shared_array_buffer_constructor, 1);
+	duk_push_object(ctx);
+	duk_get_prop_string(ctx, -3, "ArrayBuffer");
+	duk_get_prop_string(ctx, -1, "prototype");
+	duk_set_prototype(ctx, -3);
+	duk_pop(ctx); // ArrayBuffer
+	duk_dup(ctx, -2);
+	duk_put_prop_string(ctx, -2, "constructor");
+	duk_push_heap_stash(ctx);
+	duk_dup(ctx, -2);
+	duk_put_prop_string(ctx, -2, "shared_array_buffer_prototype");
+	// The shared buffers that this heap holds references to, keyed by
+	// address.
+	duk_push_object(ctx);
+	duk_push_undefined(ctx);
+	duk_set_prototype(ctx, -2);
+	duk_put_prop_string(ctx, -2, "shared_buffers");
+	duk_pop(ctx); // heap stash
+	duk_put_prop_string(ctx, -2, "prototype");
+	duk_put_prop_string(ctx, -2, "SharedArrayBuffer");
+
+	duk_push_object(ctx);
+	duk_put_function_list(ctx, -1, atomics);
+	duk_put_prop_string(ctx, -2, "Atomics");
+	duk_pop(ctx);
+}
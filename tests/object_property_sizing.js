@@ -0,0 +1,37 @@
+// Objects from JSON.parse() and object literals are allocated at their final
+// size.  Check that they have no spare entries whatever the size of the
+// previous object at the same depth, and that they can still grow.
+function check_exact(obj, what)
+{
+	var info = Duktape.info(obj);
+	// info[5] is the size of the entry part, info[6] the number used.
+	if (info[5] !== info[6])
+	{
+		throw new Error(what + " has " + info[5] + " entries for " +
+		                info[6] + " properties");
+	}
+}
+var records = JSON.parse('[{"a":1,"b":2,"c":3},{"a":1},' +
+	'{"a":1,"b":2,"c":3,"d":4,"e":5},{"a":{"x":1,"y":2},"b":{"x":1}}]');
+for (var i=0 ; i<records.length ; i++)
+{
+	check_exact(records[i], "record " + i);
+}
+check_exact(records[3].a, "nested record");
+check_exact(records[3].b, "second nested record");
+records[1].z = 26;
+if (JSON.stringify(records[1]) !== '{"a":1,"z":26}')
+{
+	throw new Error("grown record is " + JSON.stringify(records[1]));
+}
+check_exact({x:1, y:2, z:3}, "object literal");
+var keys = [];
+for (var i=0 ; i<100 ; i++)
+{
+	keys.push('"k' + i + '":' + i);
+}
+var big = eval("({" + keys.join() + "})");
+if (big.k0 !== 0 || big.k99 !== 99 || Object.keys(big).length !== 100)
+{
+	throw new Error("large object literal is wrong");
+}
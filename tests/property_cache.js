@@ -0,0 +1,80 @@
+// GETPROP and PUTPROP go through an inline cache that also resolves
+// inherited and missing properties.  Run the same instructions over objects
+// whose prototype chains change between iterations and check that every
+// read and write matches what the generic property lookup would do.
+function check(got, expected, what)
+{
+	if (got !== expected)
+	{
+		throw new Error(what + " is " + got + ", expected " + expected);
+	}
+}
+
+function read(o)
+{
+	return o.x;
+}
+
+function write(o, v)
+{
+	o.x = v;
+}
+
+var proto = { x: 'proto' };
+var child = Object.create(proto);
+var grandchild = Object.create(child);
+var bare = Object.create(null);
+for (var i=0 ; i<40 ; i++)
+{
+	check(read(grandchild), 'proto', 'inherited read');
+	check(read(bare), undefined, 'missing read');
+	check(read({}), undefined, 'missing read through Object.prototype');
+}
+
+// Shadowing, deletion and prototype changes after the site is cached.
+child.x = 'child';
+check(read(grandchild), 'child', 'shadowed read');
+delete child.x;
+check(read(grandchild), 'proto', 'read after delete');
+Object.setPrototypeOf(child, { y: 1, x: 'other' });
+check(read(grandchild), 'other', 'read after prototype change');
+Object.setPrototypeOf(child, null);
+check(read(grandchild), undefined, 'read after prototype removal');
+Object.prototype.x = 'global';
+check(read({}), 'global', 'read of new Object.prototype property');
+delete Object.prototype.x;
+check(read({}), undefined, 'read after Object.prototype delete');
+
+// Accessors and exotic objects in the chain.
+var getter = Object.create({ get x() { return 'getter'; } });
+check(read(getter), 'getter', 'inherited getter');
+// Duktape only calls proxy traps for the base object of an access.
+var proxied = Object.create(new Proxy({}, { get: function() { return 'trap'; } }));
+check(read(proxied), undefined, 'read through proxy prototype');
+var arr = Object.create([1, 2, 3]);
+check(arr.length, 3, 'inherited array length');
+check(read(Object.create(new String('abc'))), undefined, 'string object prototype');
+
+// Writes add own properties, call inherited setters and respect
+// non-writable inherited properties.
+var set_value;
+var setter_proto = { set x(v) { set_value = v; } };
+var readonly_proto = Object.defineProperty({}, 'x', { value: 'ro', writable: false });
+for (var i=0 ; i<40 ; i++)
+{
+	var o = Object.create(proto);
+	write(o, i);
+	check(o.x, i, 'added property');
+	check(proto.x, 'proto', 'prototype after write');
+	write(o, i + 1);
+	check(o.x, i + 1, 'updated property');
+
+	var s = Object.create(setter_proto);
+	write(s, i);
+	check(set_value, i, 'setter argument');
+	check(Object.getOwnPropertyNames(s).length, 0, 'own properties after setter');
+
+	var r = Object.create(readonly_proto);
+	write(r, i);
+	check(r.x, 'ro', 'write to read-only inherited property');
+}
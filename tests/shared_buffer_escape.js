@@ -0,0 +1,11 @@
+// A plain buffer taken from a view of a SharedArrayBuffer points at the shared
+// memory.  It must stay valid after the SharedArrayBuffer and its views have
+// been collected.
+var pb = Duktape.Buffer(new Uint8Array(new SharedArrayBuffer(64)));
+Duktape.gc();
+Duktape.gc();
+pb[0] = 1;
+if (pb[0] !== 1)
+{
+	throw new Error("shared memory was not preserved");
+}
@@ -0,0 +1,20 @@
+// ArrayOps.copy() between overlapping views of different element types must
+// convert every source element as it was before the copy.
+function check(dst_type, src_type, dst_offset, src_offset)
+{
+	var buffer = new ArrayBuffer(64);
+	var src = new src_type(buffer, src_offset, 4);
+	src.set([1, 2, 3, 4]);
+	var dst = new dst_type(buffer, dst_offset, 4);
+	ArrayOps.copy(dst, src);
+	var result = Array.prototype.slice.call(dst).join();
+	if (result !== "1,2,3,4")
+	{
+		throw new Error("copy to " + dst_offset + " from " + src_offset +
+		                " gave " + result);
+	}
+}
+check(Int32Array, Int8Array, 0, 0);
+check(Int8Array, Int32Array, 0, 0);
+check(Float64Array, Uint8Array, 0, 8);
+check(Uint16Array, Float32Array, 4, 0);
@@ -0,0 +1,95 @@
+// The ArrayOps reductions, searches, comparisons and byte swaps must give the
+// same results as the obvious element-by-element loops, for every kind and
+// for lengths that leave partial vectors at the end.
+var kinds = [Int8Array, Uint8Array, Int16Array, Uint16Array, Int32Array,
+             Uint32Array, Float32Array, Float64Array];
+var sizes = [1, 1, 2, 2, 4, 4, 4, 8];
+function fail(kind, length, what, got, expected)
+{
+	throw new Error(kind + "[" + length + "]." + what + " gave " + got +
+	                ", expected " + expected);
+}
+function check(kind, size, length, seed)
+{
+	var a = new kind(length);
+	var x = seed;
+	for (var i=0 ; i<length ; i++)
+	{
+		x = (x * 1103515245 + 12345) % 2147483648;
+		a[i] = (x % 2001) - 1000 + ((size == 4 || size == 8) ? x / 4096 : 0);
+	}
+	var sum = 0, min = Infinity, max = -Infinity;
+	for (var i=0 ; i<length ; i++)
+	{
+		sum += a[i];
+		min = Math.min(min, a[i]);
+		max = Math.max(max, a[i]);
+	}
+	var got = ArrayOps.sum(a);
+	if (Math.abs(got - sum) > Math.abs(sum) * 1e-12)
+	{
+		fail(kind.name, length, "sum", got, sum);
+	}
+	if (ArrayOps.min(a) !== min)
+	{
+		fail(kind.name, length, "min", ArrayOps.min(a), min);
+	}
+	if (ArrayOps.max(a) !== max)
+	{
+		fail(kind.name, length, "max", ArrayOps.max(a), max);
+	}
+	if (length > 0)
+	{
+		var last = a[length - 1];
+		var expected = Array.prototype.indexOf.call(a, last);
+		if (ArrayOps.indexOf(a, last) !== expected)
+		{
+			fail(kind.name, length, "indexOf", ArrayOps.indexOf(a, last),
+			     expected);
+		}
+		if (ArrayOps.indexOf(a, last + 0.5) !== -1)
+		{
+			fail(kind.name, length, "indexOf(non-element)",
+			     ArrayOps.indexOf(a, last + 0.5), -1);
+		}
+		var b = new kind(a);
+		var at = length >> 1;
+		b[at] = b[at] + 1;
+		if ((b[at] !== a[at]) && (ArrayOps.compare(a, b) !== at))
+		{
+			fail(kind.name, length, "compare", ArrayOps.compare(a, b), at);
+		}
+	}
+	if (ArrayOps.compare(a, new kind(a)) !== -1)
+	{
+		fail(kind.name, length, "compare(copy)",
+		     ArrayOps.compare(a, new kind(a)), -1);
+	}
+	var bytes = new Uint8Array(a.buffer);
+	var before = Array.prototype.slice.call(bytes);
+	ArrayOps.byteSwap(a);
+	for (var i=0 ; i<bytes.length ; i++)
+	{
+		var j = i - (i % size) + (size - 1 - (i % size));
+		if (bytes[i] !== before[j])
+		{
+			fail(kind.name, length, "byteSwap", bytes[i], before[j]);
+		}
+	}
+}
+for (var k=0 ; k<kinds.length ; k++)
+{
+	for (var length=0 ; length<80 ; length++)
+	{
+		check(kinds[k], sizes[k], length, length + 1);
+	}
+}
+var f = new Float64Array([1, 2, NaN, 0]);
+if (!isNaN(ArrayOps.min(f)) || !isNaN(ArrayOps.max(f)))
+{
+	throw new Error("min and max must be NaN if any element is NaN");
+}
+if (ArrayOps.indexOf(new Int32Array([1, 2, 3]), 4294967298) !== -1)
+{
+	throw new Error("indexOf must not wrap out-of-range values");
+}
@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2015 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "jsrun.h"
+
+/**
+ * The number of events that each thread's buffer holds.  When a buffer is
+ * full, the oldest events are overwritten.
+ */
+#define TRACE_BUFFER_EVENTS 16384
+/**
+ * The longest thread name that is recorded.
+ */
+#define TRACE_NAME_MAX 64
+
+/**
+ * A recorded event.
+ */
+struct trace_event
+{
+	/**
+	 * Time of the event, in nanoseconds from the monotonic clock.
+	 */
+	uint64_t time;
+	/**
+	 * Event argument: a size, a queue depth, a counter value or (for flow
+	 * events) the message identifier.
+	 */
+	uint64_t arg;
+	/**
+	 * The name of the event.  Always a string constant.
+	 */
+	const char *name;
+	/**
+	 * The trace-event phase (`B`, `E`, `i`, `s`, `f` or `C`).
+	 */
+	char phase;
+};
+
+/**
+ * A per-thread ring buffer of events.  Only the owning thread writes to a
+ * buffer, so recording an event needs no locks or atomic read-modify-write
+ * operations.  Buffers are never freed, so that the events from threads that
+ * have exited are still written out.
+ */
+struct trace_buffer
+{
+	/**
+	 * The next buffer in the list of all buffers.
+	 */
+	struct trace_buffer *next;
+	/**
+	 * The identifier used for this thread in the trace.
+	 */
+	unsigned tid;
+	/**
+	 * The thread's name, set with `trace_thread_name()`.
+	 */
+	char name[TRACE_NAME_MAX];
+	/**
+	 * The total number of events that have been recorded.  The most recent
+	 * `TRACE_BUFFER_EVENTS` are in the buffer.
+	 */
+	_Atomic(uint64_t) count;
+	/**
+	 * The events.
+	 */
+	struct trace_event events[TRACE_BUFFER_EVENTS];
+};
+
+_Atomic(bool) trace_enabled;
+/**
+ * The file that the trace is written to.
+ */
+static const char *trace_file;
+/**
+ * List of all buffers.  Buffers are only ever added, with a compare and
+ * exchange.
+ */
+static _Atomic(struct trace_buffer *) all_buffers;
+/**
+ * The identifier for the next thread to record an event.
+ */
+static atomic_uint next_tid;
+/**
+ * This thread's buffer, allocated when it records its first event.
+ */
+static _Thread_local struct trace_buffer *thread_buffer;
+
+/**
+ * Returns the calling thread's buffer, creating it if necessary.  Returns
+ * NULL if it can't be allocated.
+ */
+static struct trace_buffer *
+get_buffer(void)
+{
+	struct trace_buffer *b = thread_buffer;
+	if (b != NULL)
+	{
+		return b;
+	}
+	b = calloc(1, sizeof(struct trace_buffer));
+	if (b == NULL)
+	{
+		return NULL;
+	}
+	b->tid = atomic_fetch_add(&next_tid, 1);
+	struct trace_buffer *head = atomic_load(&all_buffers);
+	do
+	{
+		b->next = head;
+	} while (!atomic_compare_exchange_weak(&all_buffers, &head, b));
+	thread_buffer = b;
+	return b;
+}
+
+void
+trace_event(char phase, const char *name, uint64_t arg)
+{
+	struct trace_buffer *b = get_buffer();
+	if (b == NULL)
+	{
+		return;
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t count = atomic_load_explicit(&b->count, memory_order_relaxed);
+	struct trace_event *e = &b->events[count % TRACE_BUFFER_EVENTS];
+	e->time = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	e->arg = arg;
+	e->name = name;
+	e->phase = phase;
+	atomic_store_explicit(&b->count, count + 1, memory_order_release);
+}
+
+void
+trace_thread_name(const char *name)
+{
+	if (!trace_enabled)
+	{
+		return;
+	}
+	struct trace_buffer *b = get_buffer();
+	if (b != NULL)
+	{
+		strncpy(b->name, name, TRACE_NAME_MAX - 1);
+	}
+}
+
+/**
+ * Write a string as a JSON string literal.
+ */
+static void
+write_json_string(FILE *f, const char *str)
+{
+	putc('"', f);
+	for (const unsigned char *c=(const unsigned char*)str ; *c ; c++)
+	{
+		if ((*c == '"') || (*c == '\\'))
+		{
+			fprintf(f, "\\%c", *c);
+		}
+		else if (*c < 0x20)
+		{
+			fprintf(f, "\\u%04x", *c);
+		}
+		else
+		{
+			putc(*c, f);
+		}
+	}
+	putc('"', f);
+}
+
+/**
+ * Write all of the buffers to the trace file in the Chrome trace-event
+ * format, which can be loaded into chrome://tracing or Perfetto.  This runs
+ * at exit, while worker threads may still be recording events, so each event
+ * is copied and only written if it was not overwritten during the copy.
+ */
+static void
+trace_write(void)
+{
+	trace_enabled = false;
+	FILE *f = fopen(trace_file, "w");
+	if (f == NULL)
+	{
+		perror(trace_file);
+		return;
+	}
+	int pid = getpid();
+	bool first = true;
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (struct trace_buffer *b=atomic_load(&all_buffers) ; b != NULL ;
+	     b=b->next)
+	{
+		if (b->name[0] != '\0')
+		{
+			fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+			        "\"tid\":%u,\"args\":{\"name\":", first ? "" : ",\n",
+			        pid, b->tid);
+			write_json_string(f, b->name);
+			fprintf(f, "}}");
+			first = false;
+		}
+		uint64_t count = atomic_load_explicit(&b->count, memory_order_acquire);
+		uint64_t start = count > TRACE_BUFFER_EVENTS ?
+			count - TRACE_BUFFER_EVENTS : 0;
+		for (uint64_t i=start ; i<count ; i++)
+		{
+			// Other threads may still be recording, and can overwrite an
+			// event while it is being copied.  The thread is writing to slot
+			// `i` once its count reaches `i + TRACE_BUFFER_EVENTS`, so
+			// re-read the count after copying the event and drop it if so.
+			struct trace_event e = b->events[i % TRACE_BUFFER_EVENTS];
+			atomic_thread_fence(memory_order_acquire);
+			if (atomic_load_explicit(&b->count, memory_order_relaxed) >=
+			    i + TRACE_BUFFER_EVENTS)
+			{
+				continue;
+			}
+			fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":%d,\"tid\":%u,"
+			        "\"ts\":%.3f", first ? "" : ",\n", e.name, e.phase, pid,
+			        b->tid, e.time / 1000.0);
+			switch (e.phase)
+			{
+				case 's':
+					fprintf(f, ",\"cat\":\"message\",\"id\":%llu",
+					        (unsigned long long)e.arg);
+					break;
+				case 'f':
+					fprintf(f, ",\"cat\":\"message\",\"id\":%llu,\"bp\":\"e\"",
+					        (unsigned long long)e.arg);
+					break;
+				case 'i':
+					fprintf(f, ",\"s\":\"t\",\"args\":{\"value\":%llu}",
+					        (unsigned long long)e.arg);
+					break;
+				case 'C':
+					// Counters are per process, so give each thread its own.
+					fprintf(f, ",\"id\":%u,\"args\":{\"value\":%llu}", b->tid,
+					        (unsigned long long)e.arg);
+					break;
+			}
+			fprintf(f, "}");
+			first = false;
+		}
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+}
+
+int
+trace_start(const char *file)
+{
+	trace_file = file;
+	trace_enabled = true;
+	trace_thread_name("main");
+	atexit(trace_write);
+	return 0;
+}
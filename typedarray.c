@@ -0,0 +1,939 @@
+/*
+ * Copyright (c) 2015 David Chisnall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+/**
+ * Bulk operations over typed arrays.  Element-by-element loops in JavaScript
+ * run in the bytecode interpreter, so this file provides native versions of
+ * the common inner loops, exposed as functions on the global `ArrayOps`
+ * object.
+ *
+ * Every kernel is compiled once for each instruction set that we support and
+ * the best set for the current CPU is picked when the first context is
+ * initialised.  The kernels are written with the GCC / Clang vector
+ * extensions, so the generic variant is also vectorised on targets (such as
+ * ARM with NEON) where the vector width is part of the baseline ABI.  All
+ * vectors are loaded and stored with `memcpy()`, so arrays need not be
+ * aligned.
+ */
+
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "jsrun.h"
+
+/**
+ * The set of kernels for one array kind.  All counts are in elements, not
+ * bytes, and all pointers may be unaligned.
+ */
+struct array_kernels
+{
+	/**
+	 * Store `value` (converted with JavaScript semantics) in every element.
+	 */
+	void (*fill)(void *dst, double value, size_t count);
+	/**
+	 * `dst[i] = a[i] + b[i]`
+	 */
+	void (*add)(void *dst, const void *a, const void *b, size_t count);
+	/**
+	 * `dst[i] = a[i] * b[i]`
+	 */
+	void (*mul)(void *dst, const void *a, const void *b, size_t count);
+	/**
+	 * `dst[i] = a[i] * b[i] + c[i]`
+	 */
+	void (*fma)(void *dst, const void *a, const void *b, const void *c,
+	            size_t count);
+	/**
+	 * Sum of all elements, accumulated as doubles.
+	 */
+	double (*sum)(const void *src, size_t count);
+	/**
+	 * Smallest element, or NaN if any element is NaN.
+	 */
+	double (*min)(const void *src, size_t count);
+	/**
+	 * Largest element, or NaN if any element is NaN.
+	 */
+	double (*max)(const void *src, size_t count);
+	/**
+	 * Index of the first element equal to `value`, or -1.
+	 */
+	ssize_t (*index_of)(const void *src, double value, size_t count);
+	/**
+	 * Index of the first element that differs between `a` and `b`, or -1.
+	 */
+	ssize_t (*compare)(const void *a, const void *b, size_t count);
+	/**
+	 * Reverse the byte order of every element in place.
+	 */
+	void (*byte_swap)(void *dst, size_t count);
+	/**
+	 * Read one element as a double.  Used for copies between kinds.
+	 */
+	double (*get)(const void *src, size_t i);
+	/**
+	 * Write one element from a double.  Used for copies between kinds.
+	 */
+	void (*set)(void *dst, size_t i, double value);
+};
+
+/**
+ * The names of the array kinds, in the order that they appear in
+ * arraykinds.inc.
+ */
+static const char *const array_names[] = {
+#define TYPED_ARRAY_CASE(name, type, arith) #name,
+#include "arraykinds.inc"
+};
+
+/**
+ * The size of an element of each array kind.
+ */
+static const size_t array_sizes[] = {
+#define TYPED_ARRAY_CASE(name, type, arith) sizeof(type),
+#include "arraykinds.inc"
+};
+
+/**
+ * The number of array kinds that we know about.
+ */
+#define ARRAY_KIND_COUNT (sizeof(array_sizes) / sizeof(array_sizes[0]))
+
+/**
+ * Convert a double to an unsigned 32-bit integer, using the JavaScript
+ * `ToUint32` rules.  Converting an out-of-range floating point value directly
+ * to an integer type is undefined behaviour in C.
+ */
+static inline uint32_t
+to_uint32(double d)
+{
+	if (!isfinite(d))
+	{
+		return 0;
+	}
+	d = fmod(trunc(d), 4294967296.0);
+	if (d < 0)
+	{
+		d += 4294967296.0;
+	}
+	return (uint32_t)d;
+}
+
+/**
+ * Convert a double to the arithmetic type `arith`.  Integer kinds wrap,
+ * floating point kinds round.  The condition is a compile-time constant, so
+ * only one branch survives.
+ */
+#define FROM_DOUBLE(arith, d) \
+	(((arith)0.5 == 0) ? (arith)to_uint32(d) : (arith)(d))
+
+/**
+ * Define a kernel that applies `expr` to whole vectors of the inputs.  The
+ * trailing partial vector is copied into a zeroed vector so that the tail
+ * needs no scalar arithmetic (and so no integer promotion rules).
+ */
+#define VECTOR_KERNEL(op, isa, attr, width, name, arith, params, inputs, expr) \
+attr static void                                                             \
+op##_##name##_##isa params                                                   \
+{                                                                            \
+	typedef arith vec __attribute__((vector_size(width)));                   \
+	const size_t elsize = sizeof(arith);                                     \
+	const size_t lanes = sizeof(vec) / elsize;                               \
+	char *d = dst;                                                           \
+	size_t i = 0;                                                            \
+	for (; i + lanes <= count ; i += lanes)                                  \
+	{                                                                        \
+		const size_t bytes = sizeof(vec);                                    \
+		vec r, x, y, z;                                                      \
+		inputs                                                               \
+		r = expr;                                                            \
+		memcpy(d + i * elsize, &r, bytes);                                   \
+	}                                                                        \
+	if (i < count)                                                           \
+	{                                                                        \
+		const size_t bytes = (count - i) * elsize;                           \
+		vec r, x = {0}, y = {0}, z = {0};                                    \
+		inputs                                                               \
+		r = expr;                                                            \
+		memcpy(d + i * elsize, &r, bytes);                                   \
+	}                                                                        \
+}
+
+/**
+ * Load helpers for `VECTOR_KERNEL`.
+ */
+#define LOAD2 (void)z; memcpy(&x, (const char*)a + i * elsize, bytes); \
+	memcpy(&y, (const char*)b + i * elsize, bytes);
+#define LOAD3 memcpy(&x, (const char*)a + i * elsize, bytes); \
+	memcpy(&y, (const char*)b + i * elsize, bytes); \
+	memcpy(&z, (const char*)c + i * elsize, bytes);
+
+/**
+ * Returns true if any lane of the vector comparison result at `mask`, which
+ * is `size` bytes long, is set.
+ */
+static inline bool
+any_lane(const void *mask, size_t size)
+{
+	uint64_t acc = 0;
+	for (size_t i=0 ; i<size ; i+=sizeof(uint64_t))
+	{
+		uint64_t v;
+		memcpy(&v, (const char*)mask + i, sizeof(v));
+		acc |= v;
+	}
+	return acc != 0;
+}
+
+/**
+ * Returns the index of the first set lane of the vector comparison result at
+ * `mask`, which is `size` bytes long and has `lanes` lanes.  At least one
+ * lane must be set.  Every byte of a set lane is non-zero, so only the first
+ * byte of each lane is tested.
+ */
+static inline size_t
+first_lane(const void *mask, size_t size, size_t lanes)
+{
+	const char *m = mask;
+	size_t l = 0;
+	while (m[l * (size / lanes)] == 0)
+	{
+		l++;
+	}
+	return l;
+}
+
+/**
+ * Define a min or max reduction, selecting lanes for which `cmp` holds.  The
+ * trailing partial vector is padded with the running result, which can't
+ * change it.  NaNs are tracked separately, because no comparison with them
+ * holds.
+ */
+#define MINMAX_KERNEL(op, isa, attr, width, name, type, cmp, empty)          \
+attr static double                                                           \
+op##_##name##_##isa(const void *src, size_t count)                           \
+{                                                                            \
+	typedef type vec __attribute__((vector_size(width)));                    \
+	typedef __typeof__((vec){0} cmp (vec){0}) mask;                          \
+	const size_t lanes = sizeof(vec) / sizeof(type);                         \
+	const char *s = src;                                                     \
+	if (count == 0)                                                          \
+	{                                                                        \
+		return empty;                                                        \
+	}                                                                        \
+	type first;                                                              \
+	memcpy(&first, s, sizeof(type));                                         \
+	vec m;                                                                   \
+	for (size_t l=0 ; l<lanes ; l++)                                         \
+	{                                                                        \
+		m[l] = first;                                                        \
+	}                                                                        \
+	mask unordered = m != m;                                                 \
+	size_t i = 0;                                                            \
+	for (; i + lanes <= count ; i += lanes)                                  \
+	{                                                                        \
+		vec x;                                                               \
+		memcpy(&x, s + i * sizeof(type), sizeof(vec));                       \
+		mask select = x cmp m;                                               \
+		unordered |= x != x;                                                 \
+		m = (vec)(((mask)x & select) | ((mask)m & ~select));                 \
+	}                                                                        \
+	if (i < count)                                                           \
+	{                                                                        \
+		vec x = m;                                                           \
+		memcpy(&x, s + i * sizeof(type), (count - i) * sizeof(type));        \
+		mask select = x cmp m;                                               \
+		unordered |= x != x;                                                 \
+		m = (vec)(((mask)x & select) | ((mask)m & ~select));                 \
+	}                                                                        \
+	if (any_lane(&unordered, sizeof(unordered)))                             \
+	{                                                                        \
+		return NAN;                                                          \
+	}                                                                        \
+	type r = m[0];                                                           \
+	for (size_t l=1 ; l<lanes ; l++)                                         \
+	{                                                                        \
+		r = (m[l] cmp r) ? m[l] : r;                                         \
+	}                                                                        \
+	return r;                                                                \
+}
+
+/**
+ * Swap the bytes of every element of the `bytes`-byte buffer `d`, as vectors
+ * of the unsigned integer type `utype`.  `swap` is a statement that swaps the
+ * lanes of its argument.  The trailing partial vector is swapped in a copy.
+ */
+#define BYTE_SWAP_LOOP(utype, width, d, bytes, swap)                         \
+	do                                                                       \
+	{                                                                        \
+		typedef utype uvec __attribute__((vector_size(width)));              \
+		size_t i = 0;                                                        \
+		for (; i + sizeof(uvec) <= bytes ; i += sizeof(uvec))                \
+		{                                                                    \
+			uvec v;                                                          \
+			memcpy(&v, d + i, sizeof(uvec));                                 \
+			swap(v);                                                         \
+			memcpy(d + i, &v, sizeof(uvec));                                 \
+		}                                                                    \
+		if (i < bytes)                                                       \
+		{                                                                    \
+			uvec v = {0};                                                    \
+			memcpy(&v, d + i, bytes - i);                                    \
+			swap(v);                                                         \
+			memcpy(d + i, &v, bytes - i);                                    \
+		}                                                                    \
+	} while (0)
+
+/**
+ * Byte swaps for `BYTE_SWAP_LOOP`, exchanging bytes, then pairs, then quads.
+ */
+#define SWAP16(v) v = (v << 8) | (v >> 8)
+#define SWAP32(v)                                                            \
+	v = ((v << 8) & 0xff00ff00U) | ((v >> 8) & 0x00ff00ffU);                 \
+	v = (v << 16) | (v >> 16)
+#define SWAP64(v)                                                            \
+	v = ((v << 8) & 0xff00ff00ff00ff00ULL) |                                 \
+	    ((v >> 8) & 0x00ff00ff00ff00ffULL);                                  \
+	v = ((v << 16) & 0xffff0000ffff0000ULL) |                                \
+	    ((v >> 16) & 0x0000ffff0000ffffULL);                                 \
+	v = (v << 32) | (v >> 32)
+
+/**
+ * Define all of the kernels for one array kind and one instruction set.
+ */
+#define DEFINE_KERNELS(isa, attr, width, name, type, arith)                    \
+VECTOR_KERNEL(add, isa, attr, width, name, arith,                            \
+	(void *dst, const void *a, const void *b, size_t count), LOAD2, x + y)   \
+VECTOR_KERNEL(mul, isa, attr, width, name, arith,                            \
+	(void *dst, const void *a, const void *b, size_t count), LOAD2, x * y)   \
+VECTOR_KERNEL(fma, isa, attr, width, name, arith,                            \
+	(void *dst, const void *a, const void *b, const void *c, size_t count),  \
+	LOAD3, x * y + z)                                                        \
+attr static void                                                             \
+fill_##name##_##isa(void *dst, double value, size_t count)                   \
+{                                                                            \
+	typedef arith vec __attribute__((vector_size(width)));                   \
+	arith v = FROM_DOUBLE(arith, value);                                     \
+	vec splat = (vec){0} + v;                                                \
+	char *d = dst;                                                           \
+	size_t i = 0;                                                            \
+	if (sizeof(arith) == 1)                                                  \
+	{                                                                        \
+		memset(dst, (int)v, count);                                          \
+		return;                                                              \
+	}                                                                        \
+	for (; i + sizeof(vec) / sizeof(arith) <= count ;                        \
+	     i += sizeof(vec) / sizeof(arith))                                   \
+	{                                                                        \
+		memcpy(d + i * sizeof(arith), &splat, sizeof(vec));                  \
+	}                                                                        \
+	memcpy(d + i * sizeof(arith), &splat, (count - i) * sizeof(arith));      \
+}                                                                            \
+attr static double                                                           \
+sum_##name##_##isa(const void *src, size_t count)                            \
+{                                                                            \
+	/* Each vector of elements is widened to a full-width vector of doubles  \
+	 * (or of 32-bit integers), so only part of a vector is loaded. */       \
+	typedef double dvec __attribute__((vector_size(width)));                 \
+	typedef type tvec __attribute__((vector_size(                            \
+		width / sizeof(double) * sizeof(type))));                            \
+	const size_t lanes = sizeof(dvec) / sizeof(double);                      \
+	const char *s = src;                                                     \
+	dvec acc[4] = { {0}, {0}, {0}, {0} };                                    \
+	size_t i = 0;                                                            \
+	if (sizeof(type) <= 2)                                                   \
+	{                                                                        \
+		/* Small integers are summed exactly in 32-bit lanes, which are      \
+		 * cheaper to widen to than doubles, and flushed before they could   \
+		 * overflow. */                                                      \
+		typedef int32_t ivec __attribute__((vector_size(width)));            \
+		typedef type svec __attribute__((vector_size(                        \
+			width / sizeof(int32_t) * sizeof(type))));                       \
+		const size_t ilanes = sizeof(ivec) / sizeof(int32_t);                \
+		while (i + 2 * ilanes <= count)                                      \
+		{                                                                    \
+			size_t end = (count - i > ilanes * 16384) ?                      \
+				i + ilanes * 16384 : count;                                  \
+			ivec iacc[2] = { {0}, {0} };                                     \
+			for (; i + 2 * ilanes <= end ; i += 2 * ilanes)                  \
+			{                                                                \
+				svec x, y;                                                   \
+				memcpy(&x, s + i * sizeof(type), sizeof(svec));              \
+				memcpy(&y, s + (i + ilanes) * sizeof(type), sizeof(svec));   \
+				iacc[0] += __builtin_convertvector(x, ivec);                 \
+				iacc[1] += __builtin_convertvector(y, ivec);                 \
+			}                                                                \
+			iacc[0] += iacc[1];                                              \
+			for (size_t l=0 ; l<ilanes ; l++)                                \
+			{                                                                \
+				acc[0][l % lanes] += iacc[0][l];                             \
+			}                                                                \
+		}                                                                    \
+	}                                                                        \
+	for (; i + 4 * lanes <= count ; i += 4 * lanes)                          \
+	{                                                                        \
+		for (size_t k=0 ; k<4 ; k++)                                         \
+		{                                                                    \
+			tvec x;                                                          \
+			memcpy(&x, s + (i + k * lanes) * sizeof(type), sizeof(tvec));    \
+			acc[k] += __builtin_convertvector(x, dvec);                      \
+		}                                                                    \
+	}                                                                        \
+	acc[0] += acc[1] + acc[2] + acc[3];                                      \
+	double total = 0;                                                        \
+	for (size_t l=0 ; l<lanes ; l++)                                         \
+	{                                                                        \
+		total += acc[0][l];                                                  \
+	}                                                                        \
+	for (; i < count ; i++)                                                  \
+	{                                                                        \
+		type v;                                                              \
+		memcpy(&v, s + i * sizeof(type), sizeof(type));                      \
+		total += v;                                                          \
+	}                                                                        \
+	return total;                                                            \
+}                                                                            \
+MINMAX_KERNEL(min, isa, attr, width, name, type, <, INFINITY)                \
+MINMAX_KERNEL(max, isa, attr, width, name, type, >, -INFINITY)               \
+attr static ssize_t                                                          \
+index_of_##name##_##isa(const void *src, double value, size_t count)         \
+{                                                                            \
+	typedef type vec __attribute__((vector_size(width)));                    \
+	typedef __typeof__((vec){0} == (vec){0}) mask;                           \
+	const size_t lanes = sizeof(vec) / sizeof(type);                         \
+	const char *s = src;                                                     \
+	type v;                                                                  \
+	/* Find the element value that compares equal to `value`, if there is    \
+	 * one, so that the search compares elements without converting them. */ \
+	if ((type)0.5 == 0)                                                      \
+	{                                                                        \
+		bool is_signed = (double)(type)-1 < 0;                               \
+		double bits = sizeof(type) * 8 - (is_signed ? 1 : 0);                \
+		if ((value != trunc(value)) || (value > ldexp(1, bits) - 1) ||       \
+		    (value < (is_signed ? -ldexp(1, bits) : 0)))                     \
+		{                                                                    \
+			return -1;                                                       \
+		}                                                                    \
+	}                                                                        \
+	else if ((sizeof(type) < sizeof(double)) && isfinite(value) &&           \
+	         (fabs(value) > FLT_MAX))                                        \
+	{                                                                        \
+		return -1;                                                           \
+	}                                                                        \
+	v = (type)value;                                                         \
+	if ((double)v != value)                                                  \
+	{                                                                        \
+		return -1;                                                           \
+	}                                                                        \
+	if (sizeof(type) == 1)                                                   \
+	{                                                                        \
+		const char *p = memchr(src, (int)value & 0xff, count);               \
+		return p ? p - (const char*)src : -1;                                \
+	}                                                                        \
+	vec splat;                                                               \
+	for (size_t l=0 ; l<lanes ; l++)                                         \
+	{                                                                        \
+		splat[l] = v;                                                        \
+	}                                                                        \
+	size_t i = 0;                                                            \
+	for (; i + lanes <= count ; i += lanes)                                  \
+	{                                                                        \
+		vec x;                                                               \
+		memcpy(&x, s + i * sizeof(type), sizeof(vec));                       \
+		mask eq = x == splat;                                                \
+		if (any_lane(&eq, sizeof(eq)))                                       \
+		{                                                                    \
+			return i + first_lane(&eq, sizeof(eq), lanes);                   \
+		}                                                                    \
+	}                                                                        \
+	for (; i < count ; i++)                                                  \
+	{                                                                        \
+		type x;                                                              \
+		memcpy(&x, s + i * sizeof(type), sizeof(type));                      \
+		if (x == v)                                                          \
+		{                                                                    \
+			return i;                                                        \
+		}                                                                    \
+	}                                                                        \
+	return -1;                                                               \
+}                                                                            \
+attr static ssize_t                                                          \
+compare_##name##_##isa(const void *a, const void *b, size_t count)           \
+{                                                                            \
+	typedef type vec __attribute__((vector_size(width)));                    \
+	typedef __typeof__((vec){0} != (vec){0}) mask;                           \
+	const size_t lanes = sizeof(vec) / sizeof(type);                         \
+	const char *p = a, *q = b;                                               \
+	size_t i = 0;                                                            \
+	for (; i + lanes <= count ; i += lanes)                                  \
+	{                                                                        \
+		vec x, y;                                                            \
+		memcpy(&x, p + i * sizeof(type), sizeof(vec));                       \
+		memcpy(&y, q + i * sizeof(type), sizeof(vec));                       \
+		mask ne = x != y;                                                    \
+		if (any_lane(&ne, sizeof(ne)))                                       \
+		{                                                                    \
+			return i + first_lane(&ne, sizeof(ne), lanes);                   \
+		}                                                                    \
+	}                                                                        \
+	for (; i < count ; i++)                                                  \
+	{                                                                        \
+		type x, y;                                                           \
+		memcpy(&x, p + i * sizeof(type), sizeof(type));                      \
+		memcpy(&y, q + i * sizeof(type), sizeof(type));                      \
+		if (x != y)                                                          \
+		{                                                                    \
+			return i;                                                        \
+		}                                                                    \
+	}                                                                        \
+	return -1;                                                               \
+}                                                                            \
+attr static void                                                             \
+byte_swap_##name##_##isa(void *dst, size_t count)                            \
+{                                                                            \
+	char *d = dst;                                                           \
+	size_t bytes = count * sizeof(type);                                     \
+	switch (sizeof(type))                                                    \
+	{                                                                        \
+		case 2:                                                              \
+			BYTE_SWAP_LOOP(uint16_t, width, d, bytes, SWAP16);               \
+			break;                                                           \
+		case 4:                                                              \
+			BYTE_SWAP_LOOP(uint32_t, width, d, bytes, SWAP32);               \
+			break;                                                           \
+		case 8:                                                              \
+			BYTE_SWAP_LOOP(uint64_t, width, d, bytes, SWAP64);               \
+			break;                                                           \
+	}                                                                        \
+}
+
+/**
+ * Define the element accessors for one array kind.  These are only used for
+ * conversions between kinds, so there is a single version of each.
+ */
+#define DEFINE_ACCESSORS(name, type, arith)                                   \
+static double                                                                \
+get_##name(const void *src, size_t i)                                        \
+{                                                                            \
+	type v;                                                                  \
+	memcpy(&v, (const char*)src + i * sizeof(type), sizeof(type));           \
+	return v;                                                                \
+}                                                                            \
+static void                                                                  \
+set_##name(void *dst, size_t i, double value)                                \
+{                                                                            \
+	arith v = FROM_DOUBLE(arith, value);                                     \
+	memcpy((char*)dst + i * sizeof(type), &v, sizeof(type));                 \
+}
+
+/**
+ * Construct the kernel table entry for one array kind.
+ */
+#define KERNEL_ENTRY(isa, name) \
+	{ fill_##name##_##isa, add_##name##_##isa, mul_##name##_##isa,           \
+	  fma_##name##_##isa, sum_##name##_##isa, min_##name##_##isa,            \
+	  max_##name##_##isa, index_of_##name##_##isa, compare_##name##_##isa,   \
+	  byte_swap_##name##_##isa, get_##name, set_##name },
+
+#define TYPED_ARRAY_CASE(name, type, arith) DEFINE_ACCESSORS(name, type, arith)
+#include "arraykinds.inc"
+
+// Portable kernels.  These use 16-byte vectors, which is the SSE2 baseline on
+// x86-64 and the NEON width on ARM.
+#define TYPED_ARRAY_CASE(name, type, arith) \
+	DEFINE_KERNELS(generic, , 16, name, type, arith)
+#include "arraykinds.inc"
+static const struct array_kernels generic_kernels[] = {
+#define TYPED_ARRAY_CASE(name, type, arith) KERNEL_ENTRY(generic, name)
+#include "arraykinds.inc"
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TYPED_ARRAY_CASE(name, type, arith) \
+	DEFINE_KERNELS(sse42, __attribute__((target("sse4.2"))), 16, name, type, arith)
+#include "arraykinds.inc"
+static const struct array_kernels sse42_kernels[] = {
+#define TYPED_ARRAY_CASE(name, type, arith) KERNEL_ENTRY(sse42, name)
+#include "arraykinds.inc"
+};
+
+#define TYPED_ARRAY_CASE(name, type, arith) \
+	DEFINE_KERNELS(avx2, __attribute__((target("avx2,fma"))), 32, name, type, arith)
+#include "arraykinds.inc"
+static const struct array_kernels avx2_kernels[] = {
+#define TYPED_ARRAY_CASE(name, type, arith) KERNEL_ENTRY(avx2, name)
+#include "arraykinds.inc"
+};
+#endif
+
+/**
+ * The kernels selected for this CPU.  Set once, by `select_kernels()`.
+ */
+static const struct array_kernels *kernels = generic_kernels;
+
+/**
+ * Pick the best set of kernels that the CPU that we're running on supports.
+ */
+static void
+select_kernels(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+	{
+		kernels = avx2_kernels;
+	}
+	else if (__builtin_cpu_supports("sse4.2"))
+	{
+		kernels = sse42_kernels;
+	}
+#endif
+}
+
+int
+get_typed_array(duk_context *ctx, duk_idx_t idx, void **data, size_t *count)
+{
+	int kind = -1;
+	idx = duk_normalize_index(ctx, idx);
+	if (!duk_is_object(ctx, idx))
+	{
+		return -1;
+	}
+	duk_push_heap_stash(ctx);
+	duk_get_prop_string(ctx, -1, "typed_array_constructors");
+	for (int i=0 ; i<(int)ARRAY_KIND_COUNT ; i++)
+	{
+		duk_get_prop_index(ctx, -1, i);
+		bool match = duk_is_function(ctx, -1) && duk_instanceof(ctx, idx, -1);
+		duk_pop(ctx);
+		if (match)
+		{
+			kind = i;
+			break;
+		}
+	}
+	duk_pop(ctx); // constructors
+	duk_pop(ctx); // heap stash
+	if (kind >= 0)
+	{
+		duk_size_t size;
+		*data = duk_get_buffer_data(ctx, idx, &size);
+		*count = size / array_sizes[kind];
+	}
+	return kind;
+}
+
+/**
+ * `ArrayOps.fill(array, value)`.  Stores `value` in every element of `array`.
+ */
+static duk_ret_t
+fill_method(duk_context *ctx)
+{
+	void *dst;
+	size_t count;
+	int kind = get_typed_array(ctx, 0, &dst, &count);
+	if (kind < 0)
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	kernels[kind].fill(dst, duk_to_number(ctx, 1), count);
+	return 0;
+}
+
+/**
+ * `ArrayOps.copy(dst, src)`.  Copies as many elements as will fit from `src`
+ * to `dst`, converting if the arrays are of different kinds, and returns the
+ * number of elements copied.
+ */
+static duk_ret_t
+copy_method(duk_context *ctx)
+{
+	void *dst, *src;
+	size_t dst_count, src_count;
+	int dst_kind = get_typed_array(ctx, 0, &dst, &dst_count);
+	int src_kind = get_typed_array(ctx, 1, &src, &src_count);
+	if ((dst_kind < 0) || (src_kind < 0))
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	size_t count = dst_count < src_count ? dst_count : src_count;
+	if (dst_kind == src_kind)
+	{
+		memmove(dst, src, count * array_sizes[dst_kind]);
+	}
+	else
+	{
+		// The views may share a buffer.  Elements of different sizes move at
+		// different rates, so no copy order avoids overwriting source
+		// elements before they are read.  Copy an overlapping source first.
+		const struct array_kernels *d = &kernels[dst_kind];
+		const struct array_kernels *s = &kernels[src_kind];
+		size_t src_bytes = count * array_sizes[src_kind];
+		size_t dst_bytes = count * array_sizes[dst_kind];
+		void *tmp = NULL;
+		if (((char*)src < (char*)dst + dst_bytes) &&
+		    ((char*)dst < (char*)src + src_bytes))
+		{
+			tmp = malloc(src_bytes);
+			if (tmp == NULL)
+			{
+				return DUK_RET_ALLOC_ERROR;
+			}
+			memcpy(tmp, src, src_bytes);
+			src = tmp;
+		}
+		for (size_t i=0 ; i<count ; i++)
+		{
+			d->set(dst, i, s->get(src, i));
+		}
+		free(tmp);
+	}
+	duk_push_number(ctx, count);
+	return 1;
+}
+
+/**
+ * Collect `nargs` typed array arguments, which must all be of the same kind
+ * and length.  Returns the kind, or -1 if the arguments are not valid.
+ */
+static int
+get_arrays(duk_context *ctx, int nargs, void **data, size_t *count)
+{
+	int kind = -1;
+	for (int i=0 ; i<nargs ; i++)
+	{
+		size_t c;
+		int k = get_typed_array(ctx, i, &data[i], &c);
+		if ((k < 0) || ((i > 0) && ((k != kind) || (c != *count))))
+		{
+			return -1;
+		}
+		kind = k;
+		*count = c;
+	}
+	return kind;
+}
+
+/**
+ * `ArrayOps.add(dst, a, b)`.
+ */
+static duk_ret_t
+add_method(duk_context *ctx)
+{
+	void *arrays[3];
+	size_t count;
+	int kind = get_arrays(ctx, 3, arrays, &count);
+	if (kind < 0)
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	kernels[kind].add(arrays[0], arrays[1], arrays[2], count);
+	return 0;
+}
+
+/**
+ * `ArrayOps.mul(dst, a, b)`.
+ */
+static duk_ret_t
+mul_method(duk_context *ctx)
+{
+	void *arrays[3];
+	size_t count;
+	int kind = get_arrays(ctx, 3, arrays, &count);
+	if (kind < 0)
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	kernels[kind].mul(arrays[0], arrays[1], arrays[2], count);
+	return 0;
+}
+
+/**
+ * `ArrayOps.fma(dst, a, b, c)`.
+ */
+static duk_ret_t
+fma_method(duk_context *ctx)
+{
+	void *arrays[4];
+	size_t count;
+	int kind = get_arrays(ctx, 4, arrays, &count);
+	if (kind < 0)
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	kernels[kind].fma(arrays[0], arrays[1], arrays[2], arrays[3], count);
+	return 0;
+}
+
+/**
+ * `ArrayOps.sum(array)`, `ArrayOps.min(array)` and `ArrayOps.max(array)`.  The
+ * function's magic value selects the reduction.
+ */
+static duk_ret_t
+reduce_method(duk_context *ctx)
+{
+	void *src;
+	size_t count;
+	int kind = get_typed_array(ctx, 0, &src, &count);
+	if (kind < 0)
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	const struct array_kernels *k = &kernels[kind];
+	switch (duk_get_current_magic(ctx))
+	{
+		case 0:
+			duk_push_number(ctx, k->sum(src, count));
+			break;
+		case 1:
+			duk_push_number(ctx, k->min(src, count));
+			break;
+		default:
+			duk_push_number(ctx, k->max(src, count));
+			break;
+	}
+	return 1;
+}
+
+/**
+ * `ArrayOps.indexOf(array, value)`.
+ */
+static duk_ret_t
+index_of_method(duk_context *ctx)
+{
+	void *src;
+	size_t count;
+	int kind = get_typed_array(ctx, 0, &src, &count);
+	if (kind < 0)
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	duk_push_number(ctx,
+			kernels[kind].index_of(src, duk_to_number(ctx, 1), count));
+	return 1;
+}
+
+/**
+ * `ArrayOps.compare(a, b)`.  Returns the index of the first element that
+ * differs, or -1 if the arrays are equal.  Arrays of different lengths differ
+ * at the end of the shorter one.
+ */
+static duk_ret_t
+compare_method(duk_context *ctx)
+{
+	void *a, *b;
+	size_t a_count, b_count;
+	int kind = get_typed_array(ctx, 0, &a, &a_count);
+	if ((kind < 0) || (get_typed_array(ctx, 1, &b, &b_count) != kind))
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	size_t count = a_count < b_count ? a_count : b_count;
+	ssize_t diff = kernels[kind].compare(a, b, count);
+	if ((diff < 0) && (a_count != b_count))
+	{
+		diff = count;
+	}
+	duk_push_number(ctx, diff);
+	return 1;
+}
+
+/**
+ * `ArrayOps.byteSwap(array)`.  Reverses the byte order of every element.
+ */
+static duk_ret_t
+byte_swap_method(duk_context *ctx)
+{
+	void *dst;
+	size_t count;
+	int kind = get_typed_array(ctx, 0, &dst, &count);
+	if (kind < 0)
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	kernels[kind].byte_swap(dst, count);
+	return 0;
+}
+
+static const duk_function_list_entry array_ops[] = {
+	{ "fill", fill_method, 2 },
+	{ "copy", copy_method, 2 },
+	{ "add", add_method, 3 },
+	{ "mul", mul_method, 3 },
+	{ "fma", fma_method, 4 },
+	{ "indexOf", index_of_method, 2 },
+	{ "compare", compare_method, 2 },
+	{ "byteSwap", byte_swap_method, 1 },
+	{ 0, 0, 0 }
+};
+
+void
+init_typed_array(duk_context *ctx)
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, select_kernels);
+
+	duk_push_global_object(ctx);
+	// Store the constructors for each kind in the heap stash, so that we can
+	// identify arrays even if the globals are replaced.  Duktape spells the
+	// unsigned kinds Uint, the names in arraykinds.inc (and the code that
+	// ffigen generates) use UInt, so install aliases.
+	duk_push_heap_stash(ctx);
+	duk_push_array(ctx);
+	for (int i=0 ; i<(int)ARRAY_KIND_COUNT ; i++)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%sArray", array_names[i]);
+		if (!duk_get_prop_string(ctx, -3, name))
+		{
+			duk_pop(ctx);
+			name[1] = 'i';
+			duk_get_prop_string(ctx, -3, name);
+			name[1] = 'I';
+			duk_dup_top(ctx);
+			duk_put_prop_string(ctx, -5, name);
+		}
+		duk_put_prop_index(ctx, -2, i);
+	}
+	duk_put_prop_string(ctx, -2, "typed_array_constructors");
+	duk_pop(ctx); // heap stash
+
+	duk_push_object(ctx);
+	duk_put_function_list(ctx, -1, array_ops);
+	const char *reductions[] = { "sum", "min", "max" };
+	for (int i=0 ; i<3 ; i++)
+	{
+		duk_push_c_function(ctx, reduce_method, 1);
+		duk_set_magic(ctx, -1, i);
+		duk_put_prop_string(ctx, -2, reductions[i]);
+	}
+	duk_put_prop_string(ctx, -2, "ArrayOps");
+	duk_pop(ctx);
+}
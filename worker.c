@@ -22,8 +22,17 @@
  * $FreeBSD$
  */
 #include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
 #include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include "jsrun.h"
 
@@ -42,6 +51,43 @@
 	__attribute__((cleanup(release_lock)))\
 	__attribute__((unused)) pthread_mutex_t *lock_pointer = &lock
 
+/**
+ * The minimum time (in milliseconds) that a thread must have had no messages
+ * to process before it runs an idle-time garbage collection.  Collecting while
+ * idle resets Duktape's allocation-driven collection trigger, so collections
+ * are less likely to interrupt a later burst of messages.  The delay avoids
+ * collecting between messages that arrive in quick succession.
+ */
+#define IDLE_GC_DELAY_MS 10
+/**
+ * The idle delay is at least this multiple of the duration of the last idle
+ * collection, so that threads with large heaps (and slow collections) only
+ * collect when they have been idle for a long time.
+ */
+#define IDLE_GC_DELAY_FACTOR 4
+
+/**
+ * The signal that makes jsrun print the statistics for every thread to
+ * stderr.
+ */
+#define STATS_SIGNAL SIGUSR1
+
+/**
+ * Add to one of the statistics counters in a port.  Each counter has a single
+ * writer at a time (either the thread that owns the port, or a thread holding
+ * the port's lock), so this doesn't need an atomic read-modify-write.  The
+ * counters are atomic so that other threads can read them at any time.
+ */
+#define STAT_ADD(p, field, n) \
+	atomic_store_explicit(&(p)->stats.field, \
+		atomic_load_explicit(&(p)->stats.field, memory_order_relaxed) + (n), \
+		memory_order_relaxed)
+
+/**
+ * Read one of the statistics counters in a port.
+ */
+#define STAT_GET(p, field) \
+	atomic_load_explicit(&(p)->stats.field, memory_order_relaxed)
 
 /**
  * Structure for a message sent via a `port`.
@@ -52,16 +98,228 @@ struct message
 	 * Next message in the list.
 	 */
 	struct message *next;
-	/**
-	 * The serialised object in the list.  This memory is owned by the message
-	 * struct and must be `free()`d when the message is deleted.
-	 */
-	char *contents;
 	/**
 	 * The worker that sent this message.  This allows the correct
 	 * `onMessage()` method to be called.
 	 */
 	void *receiver;
+	/**
+	 * The channel end that this message is addressed to, or NULL if it is
+	 * addressed to `receiver`.  The `MessagePort` object for the end is found
+	 * when the message is delivered, because the end may have been
+	 * transferred to another thread while the message was queued.  Holds a
+	 * reference to the channel.
+	 */
+	struct channel_end *end;
+	/**
+	 * The channel ends transferred with this message, which are in transit
+	 * until it is received.  Each holds the reference to its channel that the
+	 * `MessagePort` object in the sending thread held.
+	 */
+	struct channel_end **ports;
+	/**
+	 * The shared buffers sent with this message, or NULL if there are none.
+	 * Element `i` holds a reference to the buffer if the message's `i`th
+	 * transferable was a `SharedArrayBuffer`, in which case `ports[i]` is
+	 * NULL.
+	 */
+	struct shared_buffer **buffers;
+	/**
+	 * The number of elements in `ports` (and `buffers`, if it is not NULL).
+	 */
+	size_t nports;
+	/**
+	 * Flag indicating that this is not a serialised object, but a
+	 * notification that a queue that the receiver filled has drained.  These
+	 * are delivered to `onDrain()` rather than `onMessage()`.
+	 */
+	bool drain;
+	/**
+	 * Flag indicating that this is not a serialised object, but a new client
+	 * connecting to a shared worker.  The client's channel end is the only
+	 * element of `ports` and is delivered to `onConnect()`.
+	 */
+	bool connect;
+	/**
+	 * The length of the serialised object, excluding the terminator.
+	 */
+	size_t length;
+	/**
+	 * The serialised object, as a NUL-terminated string.  This is stored in
+	 * the same allocation as the message, so freeing the message frees it.
+	 */
+	char contents[];
+};
+
+/**
+ * Runtime statistics for the thread that receives messages from a port.
+ * These are always collected and can be read from JavaScript with
+ * `workerStats()` and `Worker.prototype.stats()`, or printed by sending the
+ * process `STATS_SIGNAL`.
+ */
+struct port_stats
+{
+	/**
+	 * The number of messages that have been sent to this port.  Updated with
+	 * the port's lock held.
+	 */
+	_Atomic(uint64_t) messages_received;
+	/**
+	 * The number of bytes of serialised messages sent to this port.  Updated
+	 * with the port's lock held.
+	 */
+	_Atomic(uint64_t) bytes_received;
+	/**
+	 * The number of messages currently in the queue.  Updated with the port's
+	 * lock held.
+	 */
+	_Atomic(uint64_t) queue_depth;
+	/**
+	 * The largest number of messages that have been in the queue at once.
+	 * Updated with the port's lock held.
+	 */
+	_Atomic(uint64_t) queue_high_water;
+	/**
+	 * The number of messages that the receiving thread has sent.  This and
+	 * the remaining fields are only updated by the receiving thread.
+	 */
+	_Atomic(uint64_t) messages_sent;
+	/**
+	 * The number of bytes of serialised messages that the receiving thread
+	 * has sent.
+	 */
+	_Atomic(uint64_t) bytes_sent;
+	/**
+	 * The number of messages that have been passed to `onMessage()`.
+	 */
+	_Atomic(uint64_t) messages_handled;
+	/**
+	 * Time, in nanoseconds, spent in `onMessage()`.
+	 */
+	_Atomic(uint64_t) handler_ns;
+	/**
+	 * Time, in nanoseconds, spent blocked waiting for messages.
+	 */
+	_Atomic(uint64_t) wait_ns;
+	/**
+	 * The number of garbage collections that the run loop has triggered.
+	 */
+	_Atomic(uint64_t) gc_count;
+	/**
+	 * Time, in nanoseconds, spent in collections triggered by the run loop.
+	 */
+	_Atomic(uint64_t) gc_ns;
+	/**
+	 * Time, in nanoseconds, that the receiving thread has spent blocked
+	 * sending to full queues.
+	 */
+	_Atomic(uint64_t) send_blocked_ns;
+	/**
+	 * The number of messages sent to this port that have been discarded
+	 * because the queue was full.  Updated with the port's lock held.
+	 */
+	_Atomic(uint64_t) messages_dropped;
+};
+
+/**
+ * What happens when a message is sent to a port whose queue is full.
+ */
+enum overflow_policy
+{
+	/**
+	 * The sender waits until the receiver has removed a message.
+	 */
+	OVERFLOW_BLOCK,
+	/**
+	 * The message is not sent and `postMessage()` throws a `RangeError`.
+	 */
+	OVERFLOW_ERROR,
+	/**
+	 * The oldest message in the queue is discarded to make room.
+	 */
+	OVERFLOW_DROP_OLDEST
+};
+
+/**
+ * The limits on the length of a port's queue.
+ */
+struct queue_limit
+{
+	/**
+	 * The maximum number of messages in the queue, or 0 for no limit.
+	 */
+	size_t capacity;
+	/**
+	 * The queue length at which `postMessage()` starts returning false, or 0
+	 * to never do so.  Senders that have seen false are sent a drain
+	 * notification once the queue has fallen to half of this length.
+	 */
+	size_t high_water;
+	/**
+	 * What to do with messages sent when the queue is full.
+	 */
+	enum overflow_policy overflow;
+};
+
+/**
+ * The result of sending a message.
+ */
+enum send_result
+{
+	/**
+	 * The message was queued.
+	 */
+	SEND_QUEUED,
+	/**
+	 * The message was queued, but the queue is at or above its high-water
+	 * mark.  The sender will be notified when it drains.
+	 */
+	SEND_ABOVE_HIGH_WATER,
+	/**
+	 * The queue was full and the message was discarded.  The sender will be
+	 * notified when it drains.
+	 */
+	SEND_FULL,
+	/**
+	 * The receiver has exited or been terminated and the message was
+	 * discarded.
+	 */
+	SEND_CLOSED
+};
+
+/**
+ * A request to notify a sender when a port's queue drains.
+ */
+struct drain_request
+{
+	/**
+	 * The next request for the same port.
+	 */
+	struct drain_request *next;
+	/**
+	 * The channel end that the message was sent from, or NULL if it was sent
+	 * with `postMessage()` on a Worker or the global object.  Holds a
+	 * reference to the channel.
+	 */
+	struct channel_end *end;
+	/**
+	 * The receive port of the thread that sent the message, if it wasn't
+	 * sent from a channel end.
+	 */
+	struct port *port;
+	/**
+	 * The receiver for the notification: the Worker object that the message
+	 * was sent with, or NULL for the global object.
+	 */
+	void *receiver;
+	/**
+	 * Flag indicating that `port` belongs to a child of the thread that owns
+	 * the port holding this request.  Notifications to children are sent
+	 * with the parent's lock held, which keeps the locks in top-down order
+	 * and guarantees that the child's port has not yet been freed.
+	 * Notifications to parents are sent without holding any locks.
+	 */
+	bool to_child;
 };
 
 /**
@@ -125,8 +383,156 @@ struct port
 	 * The insertion point for message in the queue.
 	 */
 	struct message *message_tail;
+	/**
+	 * The condition variable that senders wait on when the queue is full.
+	 */
+	pthread_cond_t space;
+	/**
+	 * The number of senders waiting on `space`.
+	 */
+	int blocked_senders;
+	/**
+	 * The limits on the length of the queue.
+	 */
+	struct queue_limit limit;
+	/**
+	 * The number of messages in the queue that count towards `limit`.  Drain
+	 * notifications and shared worker connections are not counted, because
+	 * they are never discarded.  Unlike the `queue_depth` statistic, this is
+	 * protected by `lock`.
+	 */
+	size_t limited_depth;
+	/**
+	 * Senders that should be notified when the queue drains.
+	 */
+	struct drain_request *drain_requests;
+	/**
+	 * Flag indicating that the receiving thread has processed messages since
+	 * it last ran an idle-time garbage collection.  Only accessed by the
+	 * receiving thread.
+	 */
+	bool collect_when_idle;
+	/**
+	 * The time, in milliseconds, that the receiving thread waits for a
+	 * message before running an idle-time garbage collection.  Only accessed
+	 * by the receiving thread.
+	 */
+	long idle_gc_delay_ms;
+	/**
+	 * The name of the thread that receives from this port: the worker's
+	 * script, or `main` for the main thread.
+	 */
+	char *name;
+	/**
+	 * The next port in the list of all ports.  Protected by `ports_lock`.
+	 */
+	struct port *next_port;
+	/**
+	 * The receive port of the parent thread, or NULL for the main thread.
+	 */
+	struct port *parent;
+	/**
+	 * The number of open channel ends attached to this thread or any of its
+	 * descendants, plus the number of channel sends to them that are in
+	 * progress.  A worker in whose subtree this is not zero may be sent
+	 * messages by threads outside of the subtree, so it is never collected.
+	 */
+	_Atomic(long) channel_ends;
+	/**
+	 * The number of threads sending on channels to this port.  These don't
+	 * hold a reference, but the port is not freed until this is zero.
+	 */
+	int holds;
+	/**
+	 * Statistics for the receiving thread.
+	 */
+	struct port_stats stats;
+};
+
+/**
+ * One end of a `MessageChannel`.  An end is attached to a thread (which has a
+ * `MessagePort` object for it and receives its messages), in transit in a
+ * message, or dead.  All fields are protected by the channel's lock.
+ */
+struct channel_end
+{
+	/**
+	 * The channel that this is an end of.
+	 */
+	struct channel *channel;
+	/**
+	 * The receive port of the thread that this end is attached to, or NULL if
+	 * it is in transit or dead.
+	 */
+	struct port *port;
+	/**
+	 * The `MessagePort` object for this end, in the heap of the thread that
+	 * it is attached to.
+	 */
+	void *object;
+	/**
+	 * Messages sent to this end while it was in transit, which are delivered
+	 * when it is attached to its new thread.
+	 */
+	struct message *pending_head;
+	/**
+	 * The last message in the pending list.
+	 */
+	struct message *pending_tail;
+	/**
+	 * Flag indicating that this end is included in the `channel_ends` count of
+	 * the port that it is attached to.  Ends are counted while they are
+	 * attached and the channel is open.
+	 */
+	bool counted;
+	/**
+	 * Flag indicating that the `MessagePort` for this end has been closed (or
+	 * finalised), or the message carrying it has been discarded.  Nothing more
+	 * will be delivered to it.
+	 */
+	bool dead;
 };
 
+/**
+ * A bidirectional channel between two `MessagePort`s.  A message sent from one
+ * end is delivered to the other end.  Ports are only ever locked after the
+ * channel lock, never before.
+ */
+struct channel
+{
+	/**
+	 * The lock protecting the channel and both ends.
+	 */
+	pthread_mutex_t lock;
+	/**
+	 * References to the channel: one for each end's `MessagePort` object (or
+	 * the message carrying it), and one for each message or drain request
+	 * addressed to one of the ends.  This is atomic so that references can
+	 * be released without taking the lock.
+	 */
+	_Atomic(int) refcount;
+	/**
+	 * Flag indicating that one of the ends has been closed.  Messages can't
+	 * be sent on a closed channel, but those sent before it was closed are
+	 * still delivered.
+	 */
+	bool closed;
+	/**
+	 * The two ends.
+	 */
+	struct channel_end ends[2];
+};
+
+/**
+ * List of all ports, so that the statistics for every thread can be
+ * reported.
+ */
+static struct port *all_ports;
+/**
+ * Lock protecting `all_ports`.
+ */
+static pthread_mutex_t ports_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /**
  * Struct representing a worker.  
  */
@@ -161,11 +567,28 @@ struct worker
 	 */
 	struct port *receive_port;
 	/**
-	 * The port that is used to deliver messages to the parent.
+	 * The port that is used to deliver messages to the parent.  Shared
+	 * workers have no parent, so this is the main thread's receive port,
+	 * which they hold a reference to but never send to.
 	 */
 	struct port *parent_port;
+	/**
+	 * The next shared worker in `shared_workers`.  Unused for other workers.
+	 */
+	struct worker *next_shared;
 };
 
+/**
+ * List of all shared workers, one for each script.  Shared workers run until
+ * the process exits, so they are never removed.
+ */
+static struct worker *shared_workers;
+/**
+ * Lock protecting `shared_workers`.  This is acquired after the main thread's
+ * receive port lock, and no port locks are acquired while it is held.
+ */
+static pthread_mutex_t shared_workers_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /**
  * Release a mutex.  This function should never be called directly.  It exists
  * so that the `LOCK_FOR_SCOPE()` macro can use the cleanup attribute to
@@ -178,31 +601,236 @@ release_lock(pthread_mutex_t **mtx)
 }
 
 /**
- * Construct a new port.
+ * Returns the current time from the monotonic clock, in nanoseconds.
+ */
+static inline uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Construct a new port for the thread called `name`.
  */
 static struct port *
-create_port(void)
+create_port(const char *name)
 {
 	struct port *p = calloc(sizeof(struct port),1);
 	p->lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
 	p->cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+	p->space = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+	p->name = strdup(name);
+	LOCK_FOR_SCOPE(ports_lock);
+	p->next_port = all_ports;
+	all_ports = p;
 	return p;
 }
 
+/**
+ * Allocate a message with space for `len` bytes of contents, plus the
+ * terminator.
+ */
+static struct message *
+alloc_message(size_t len)
+{
+	struct message *m = malloc(sizeof(struct message) + len + 1);
+	m->next = NULL;
+	m->receiver = NULL;
+	m->end = NULL;
+	m->ports = NULL;
+	m->buffers = NULL;
+	m->nports = 0;
+	m->drain = false;
+	m->connect = false;
+	m->length = len;
+	m->contents[len] = 0;
+	return m;
+}
+
+/**
+ * Serialise the value at `idx` (replacing it with the JSON string) and create
+ * a message containing it.  Returns NULL if the value can't be serialised.
+ */
+static struct message *
+create_message(duk_context *ctx, duk_idx_t idx)
+{
+	duk_json_encode(ctx, idx);
+	duk_size_t len;
+	const char *json = duk_get_lstring(ctx, idx, &len);
+	if (json == NULL)
+	{
+		return NULL;
+	}
+	struct message *m = alloc_message(len);
+	memcpy(m->contents, json, len);
+	return m;
+}
+
+/**
+ * Add `n` to the count of open channel ends in port `p` and all of its
+ * ancestors.  This is a release operation, so a thread that sees the count
+ * drop also sees any waiting flags that were cleared before the decrement.
+ */
+static void
+add_channel_ends(struct port *p, long n)
+{
+	for (struct port *q=p ; q != NULL ; q=q->parent)
+	{
+		atomic_fetch_add_explicit(&q->channel_ends, n, memory_order_release);
+	}
+}
+
+/**
+ * Clear the waiting flag in the ancestors of port `p`, after a message has
+ * been sent to it on a channel.  Inside the tree of workers, a thread can only
+ * be woken by its parent (which can't be waiting) or by a child (which can't
+ * be sending while its parent is waiting).  Channels can wake a thread in an
+ * idle subtree from anywhere else, so the subtree must no longer be reported
+ * as idle.
+ */
+static void
+wake_ancestors(struct port *p)
+{
+	for (struct port *q=p->parent ; q != NULL ; q=q->parent)
+	{
+		LOCK_FOR_SCOPE(q->lock);
+		q->waiting = false;
+	}
+}
+
+/**
+ * Create a new channel with both ends in transit.  The caller owns the
+ * references for both ends.
+ */
+static struct channel *
+create_channel(void)
+{
+	struct channel *c = calloc(sizeof(struct channel), 1);
+	c->lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+	c->refcount = 2;
+	c->ends[0].channel = c;
+	c->ends[1].channel = c;
+	return c;
+}
+
+static void
+retain_channel(struct channel *c)
+{
+	atomic_fetch_add_explicit(&c->refcount, 1, memory_order_relaxed);
+}
+
+/**
+ * Release a reference to a channel, freeing it if this was the last one.  The
+ * references held for the ends are released after they have been closed, so
+ * there are no pending messages left to free.
+ */
+static void
+release_channel(struct channel *c)
+{
+	if (atomic_fetch_sub_explicit(&c->refcount, 1, memory_order_acq_rel) == 1)
+	{
+		assert(c->closed);
+		assert(c->ends[0].pending_head == NULL);
+		assert(c->ends[1].pending_head == NULL);
+		pthread_mutex_destroy(&c->lock);
+		free(c);
+	}
+}
+
+/**
+ * Returns the other end of a channel.
+ */
+static inline struct channel_end *
+peer_end(struct channel_end *e)
+{
+	struct channel *c = e->channel;
+	return (e == &c->ends[0]) ? &c->ends[1] : &c->ends[0];
+}
+
+static void free_message(struct message *m);
+
+/**
+ * Stop counting channel end `e` in the port that it is attached to.  Must be
+ * called with the channel's lock held.
+ */
+static void
+uncount_end(struct channel_end *e)
+{
+	if (e->counted)
+	{
+		add_channel_ends(e->port, -1);
+		e->counted = false;
+	}
+}
+
+/**
+ * Close the channel that `e` is an end of, and mark `e` as dead.  Messages
+ * that have been sent to the other end are still delivered, but any waiting
+ * for `e` while it was in transit are discarded.
+ */
+static void
+close_channel(struct channel_end *e)
+{
+	struct channel *c = e->channel;
+	struct message *m;
+	{
+		LOCK_FOR_SCOPE(c->lock);
+		c->closed = true;
+		uncount_end(&c->ends[0]);
+		uncount_end(&c->ends[1]);
+		e->dead = true;
+		e->port = NULL;
+		e->object = NULL;
+		m = e->pending_head;
+		e->pending_head = NULL;
+		e->pending_tail = NULL;
+	}
+	// Pending messages may carry other channels' ends, which are closed in
+	// turn, so they are freed without holding the lock.
+	while (m != NULL)
+	{
+		struct message *next = m->next;
+		m->next = NULL;
+		free_message(m);
+		m = next;
+	}
+}
+
 /**
  * Free a message.  The message must be removed from any ports before passing
- * to this function.
+ * to this function.  Any channel ends that it carries are closed, so this must
+ * not be called with a port's lock held.
  */
 static void
 free_message(struct message *m)
 {
 	assert(m->next == NULL);
-	free(m->contents);
+	for (size_t i=0 ; i<m->nports ; i++)
+	{
+		if (m->ports[i] != NULL)
+		{
+			close_channel(m->ports[i]);
+			release_channel(m->ports[i]->channel);
+		}
+		else if ((m->buffers != NULL) && (m->buffers[i] != NULL))
+		{
+			release_shared_buffer(m->buffers[i]);
+		}
+	}
+	free(m->ports);
+	free(m->buffers);
+	if (m->end != NULL)
+	{
+		release_channel(m->end->channel);
+	}
 	free(m);
 }
 
 /**
- * Free a port, including any outstanding messages.
+ * Free a port, including any outstanding messages.  Messages may carry channel
+ * ends, so this must not be called with any port's lock held.
  */
 static void
 free_port(struct port *p)
@@ -212,6 +840,18 @@ free_port(struct port *p)
 		return;
 	}
 	assert(p->refcount == 0);
+	{
+		LOCK_FOR_SCOPE(ports_lock);
+		for (struct port **prev=&all_ports ; *prev != NULL ;
+		     prev=&(*prev)->next_port)
+		{
+			if (*prev == p)
+			{
+				*prev = p->next_port;
+				break;
+			}
+		}
+	}
 	struct message *m = p->message_head;
 	while (m != NULL)
 	{
@@ -220,8 +860,21 @@ free_port(struct port *p)
 		free_message(m);
 		m = next;
 	}
+	struct drain_request *r = p->drain_requests;
+	while (r != NULL)
+	{
+		struct drain_request *next = r->next;
+		if (r->end != NULL)
+		{
+			release_channel(r->end->channel);
+		}
+		free(r);
+		r = next;
+	}
 	pthread_mutex_destroy(&p->lock);
 	pthread_cond_destroy(&p->cond);
+	pthread_cond_destroy(&p->space);
+	free(p->name);
 	free(p);
 }
 
@@ -240,21 +893,25 @@ release_sending_port(struct port *p)
 }
 
 /**
- * Post a message into a port.
+ * Returns whether message `m` counts towards the limits on a port's queue.
+ * Drain notifications and shared worker connections must always be
+ * delivered, so they are not counted and are never discarded.
  */
-static bool
-send_message(struct port *p, struct message *m)
+static inline bool
+is_limited(struct message *m)
 {
-	assert(p);
-	m->next = NULL;
-	LOG("Sending %s on %p\n", m->contents, p);
-	LOCK_FOR_SCOPE(p->lock);
-	if (p->terminated || p->disconnected)
-	{
-		LOG("Not sending message, receiver is down\n");
-		free_message(m);
-		return false;
-	}
+	return !m->drain && !m->connect;
+}
+
+/**
+ * Append a message to a port's queue.  Must be called with the port's lock
+ * held.
+ */
+static void
+enqueue_message(struct port *p, struct message *m)
+{
+	TRACE('i', "enqueue", m->length);
+	TRACE('s', "message", (uintptr_t)m);
 	p->waiting = false;
 	LOG("Setting waiting to false for %p\n", p);
 	if (p->message_tail != NULL)
@@ -270,7 +927,370 @@ send_message(struct port *p, struct message *m)
 		pthread_cond_signal(&p->cond);
 	}
 	p->message_tail = m;
-	return true;
+	if (is_limited(m))
+	{
+		p->limited_depth++;
+	}
+	STAT_ADD(p, messages_received, 1);
+	STAT_ADD(p, bytes_received, m->length);
+	uint64_t depth = STAT_GET(p, queue_depth) + 1;
+	atomic_store_explicit(&p->stats.queue_depth, depth, memory_order_relaxed);
+	if (depth > STAT_GET(p, queue_high_water))
+	{
+		atomic_store_explicit(&p->stats.queue_high_water, depth,
+		                      memory_order_relaxed);
+	}
+}
+
+/**
+ * Remove the oldest message in a port's queue to make room for a new one, and
+ * return it so that it can be freed once the lock is released.  Drain
+ * notifications are never discarded, because the sender that they are
+ * addressed to would then never resume, and nor are shared worker
+ * connections, because the client would never be connected.  Must be called
+ * with the port's lock held.
+ */
+static struct message *
+drop_oldest_message(struct port *p)
+{
+	struct message *prev = NULL;
+	struct message *m = p->message_head;
+	while ((m != NULL) && !is_limited(m))
+	{
+		prev = m;
+		m = m->next;
+	}
+	if (m == NULL)
+	{
+		return NULL;
+	}
+	if (prev == NULL)
+	{
+		p->message_head = m->next;
+	}
+	else
+	{
+		prev->next = m->next;
+	}
+	if (p->message_tail == m)
+	{
+		p->message_tail = prev;
+	}
+	m->next = NULL;
+	TRACE('i', "drop", m->length);
+	p->limited_depth--;
+	STAT_ADD(p, queue_depth, -1);
+	STAT_ADD(p, messages_dropped, 1);
+	return m;
+}
+
+/**
+ * Ask for the sender described by `reply` to be notified when the queue in
+ * `p` drains.  Must be called with the lock for `p` held.
+ */
+static void
+add_drain_request(struct port *p, const struct drain_request *reply)
+{
+	for (struct drain_request *r=p->drain_requests ; r != NULL ; r=r->next)
+	{
+		if ((r->end == reply->end) && (r->port == reply->port) &&
+		    (r->receiver == reply->receiver))
+		{
+			return;
+		}
+	}
+	struct drain_request *r = malloc(sizeof(struct drain_request));
+	*r = *reply;
+	if (r->end != NULL)
+	{
+		retain_channel(r->end->channel);
+	}
+	r->next = p->drain_requests;
+	p->drain_requests = r;
+}
+
+/**
+ * Add a message to a port's queue, applying the port's limits.  Returns the
+ * result and, if a message was discarded, sets `discard` to it.  `sender`
+ * and `reply` are as for `send_message()`.
+ */
+static enum send_result
+enqueue_limited(struct port *p, struct message *m, struct port *sender,
+                const struct drain_request *reply, struct message **discard)
+{
+	LOCK_FOR_SCOPE(p->lock);
+	struct queue_limit *l = &p->limit;
+	if ((l->capacity > 0) && (l->overflow == OVERFLOW_BLOCK) &&
+	    (p->limited_depth >= l->capacity))
+	{
+		uint64_t start = now_ns();
+		TRACE('B', "send_blocked", 0);
+		while ((l->capacity > 0) && (p->limited_depth >= l->capacity) &&
+		       !p->terminated && !p->disconnected)
+		{
+			p->blocked_senders++;
+			pthread_cond_wait(&p->space, &p->lock);
+			p->blocked_senders--;
+		}
+		TRACE('E', "send_blocked", 0);
+		STAT_ADD(sender, send_blocked_ns, now_ns() - start);
+	}
+	if (p->terminated || p->disconnected)
+	{
+		LOG("Not sending message, receiver is down\n");
+		*discard = m;
+		return SEND_CLOSED;
+	}
+	if ((l->capacity > 0) && (p->limited_depth >= l->capacity))
+	{
+		if (l->overflow == OVERFLOW_ERROR)
+		{
+			*discard = m;
+			STAT_ADD(p, messages_dropped, 1);
+			add_drain_request(p, reply);
+			return SEND_FULL;
+		}
+		*discard = drop_oldest_message(p);
+	}
+	enqueue_message(p, m);
+	if ((l->high_water > 0) && (p->limited_depth >= l->high_water))
+	{
+		add_drain_request(p, reply);
+		return SEND_ABOVE_HIGH_WATER;
+	}
+	return SEND_QUEUED;
+}
+
+/**
+ * Post a message into a port.  `sender` is the receive port of the calling
+ * thread, which is used to record statistics.  If the queue is at or above
+ * its high-water mark then `reply` says where to send the drain
+ * notification.
+ */
+static enum send_result
+send_message(struct port *p, struct message *m, struct port *sender,
+             const struct drain_request *reply)
+{
+	assert(p);
+	m->next = NULL;
+	STAT_ADD(sender, messages_sent, 1);
+	STAT_ADD(sender, bytes_sent, m->length);
+	LOG("Sending %s on %p\n", m->contents, p);
+	struct message *discard = NULL;
+	enum send_result result = enqueue_limited(p, m, sender, reply, &discard);
+	// Discarded messages may carry channel ends, so they can only be freed
+	// once the port's lock has been released.
+	if (discard != NULL)
+	{
+		free_message(discard);
+	}
+	return result;
+}
+
+/**
+ * Add a message to the list of messages waiting for a channel end that is in
+ * transit.  Must be called with the channel's lock held.
+ */
+static void
+append_pending(struct channel_end *e, struct message *m)
+{
+	m->next = NULL;
+	if (e->pending_tail != NULL)
+	{
+		e->pending_tail->next = m;
+	}
+	else
+	{
+		e->pending_head = m;
+	}
+	e->pending_tail = m;
+}
+
+/**
+ * Deliver a message to a channel end, wherever it currently is, ignoring the
+ * receiving port's limits.  The message must already hold a reference to the
+ * channel.
+ */
+static void
+route_to_end(struct channel_end *e, struct message *m)
+{
+	struct channel *c = e->channel;
+	bool delivered = true;
+	pthread_mutex_lock(&c->lock);
+	if (e->dead)
+	{
+		delivered = false;
+	}
+	else if (e->port == NULL)
+	{
+		append_pending(e, m);
+	}
+	else
+	{
+		struct port *p = e->port;
+		pthread_mutex_lock(&p->lock);
+		if (p->terminated || p->disconnected)
+		{
+			delivered = false;
+		}
+		else
+		{
+			enqueue_message(p, m);
+		}
+		pthread_mutex_unlock(&p->lock);
+		if (delivered)
+		{
+			wake_ancestors(p);
+		}
+	}
+	pthread_mutex_unlock(&c->lock);
+	if (!delivered)
+	{
+		free_message(m);
+	}
+}
+
+/**
+ * Send a message from a `MessagePort` to channel end `e`, applying the limits
+ * of the port that it is attached to.  `from` is the end that the message is
+ * sent from and `sender` is the calling thread's receive port.
+ */
+static enum send_result
+send_to_end(struct channel_end *e, struct message *m, struct port *sender,
+            struct channel_end *from)
+{
+	struct channel *c = e->channel;
+	retain_channel(c);
+	m->end = e;
+	pthread_mutex_lock(&c->lock);
+	if (c->closed)
+	{
+		pthread_mutex_unlock(&c->lock);
+		free_message(m);
+		return SEND_CLOSED;
+	}
+	if (e->port == NULL)
+	{
+		append_pending(e, m);
+		pthread_mutex_unlock(&c->lock);
+		return SEND_QUEUED;
+	}
+	// Hold the receiving port so that it isn't freed if the other end is
+	// closed while we are sending (or blocked waiting for space).  The send
+	// is counted as a channel end until the receiver's ancestors have been
+	// woken, so that closing the channel while the message is in flight
+	// can't make the receiver's subtree look collectable.
+	struct port *p = e->port;
+	pthread_mutex_lock(&p->lock);
+	p->holds++;
+	pthread_mutex_unlock(&p->lock);
+	add_channel_ends(p, 1);
+	pthread_mutex_unlock(&c->lock);
+	struct drain_request reply = { .end = from };
+	enum send_result result = send_message(p, m, sender, &reply);
+	if ((result == SEND_QUEUED) || (result == SEND_ABOVE_HIGH_WATER))
+	{
+		wake_ancestors(p);
+	}
+	add_channel_ends(p, -1);
+	LOCK_FOR_SCOPE(p->lock);
+	p->holds--;
+	pthread_cond_signal(&p->cond);
+	return result;
+}
+
+/**
+ * Send a drain notification to the sender in a drain request and free the
+ * request.
+ */
+static void
+send_drain(struct drain_request *r)
+{
+	struct message *m = alloc_message(0);
+	m->receiver = r->receiver;
+	m->drain = true;
+	if (r->end != NULL)
+	{
+		// The request's reference to the channel passes to the message.
+		m->end = r->end;
+		route_to_end(r->end, m);
+		free(r);
+		return;
+	}
+	LOCK_FOR_SCOPE(r->port->lock);
+	if (r->port->terminated || r->port->disconnected)
+	{
+		free_message(m);
+	}
+	else
+	{
+		enqueue_message(r->port, m);
+	}
+	free(r);
+}
+
+/**
+ * Called with the port's lock held after a message has been removed from the
+ * queue.  Wakes blocked senders if there is now space, and if the queue has
+ * fallen to half of its high-water mark then notifies the senders that are
+ * waiting for it to drain.  Notifications to children are sent immediately.
+ * Notifications to the parent and to channel ends are returned, so that they
+ * can be sent once the lock has been released.
+ */
+static struct drain_request *
+queue_shrunk(struct port *p)
+{
+	size_t depth = p->limited_depth;
+	if ((p->blocked_senders > 0) && (depth < p->limit.capacity))
+	{
+		pthread_cond_broadcast(&p->space);
+	}
+	if ((p->drain_requests == NULL) || (depth > p->limit.high_water / 2))
+	{
+		return NULL;
+	}
+	struct drain_request *deferred = NULL;
+	struct drain_request *r = p->drain_requests;
+	p->drain_requests = NULL;
+	while (r != NULL)
+	{
+		struct drain_request *next = r->next;
+		if (r->to_child)
+		{
+			send_drain(r);
+		}
+		else
+		{
+			r->next = deferred;
+			deferred = r;
+		}
+		r = next;
+	}
+	return deferred;
+}
+
+/**
+ * Remove any requests to notify `child` from the drain requests of its
+ * parent's port, `p`.  Called with the lock for `p` held before the child's
+ * port is freed.
+ */
+static void
+remove_drain_requests(struct port *p, struct port *child)
+{
+	struct drain_request **prev = &p->drain_requests;
+	while (*prev != NULL)
+	{
+		struct drain_request *r = *prev;
+		if (r->port == child)
+		{
+			*prev = r->next;
+			free(r);
+		}
+		else
+		{
+			prev = &r->next;
+		}
+	}
 }
 
 /**
@@ -302,6 +1322,8 @@ try_to_collect_workers(struct port *p, duk_context *ctx)
 	duk_int_t length = duk_get_int(ctx, -1);
 	duk_pop(ctx); // length
 	bool all_waiting = true;
+	// The number of workers that the GC might be able to collect.
+	int candidates = 0;
 #ifndef NDEBUG
 	duk_int_t top = duk_get_top(ctx);
 #endif
@@ -324,16 +1346,26 @@ try_to_collect_workers(struct port *p, duk_context *ctx)
 				continue;
 			}
 			LOG("[%d] Inspecting worker %p (%d)\n", i, w->object, w->receive_port->waiting);
-			assert(!w->receive_port->waiting ||
+			// The worker's port is read without locking it.  The worker can
+			// only start waiting with our receive lock held, which we hold.
+			// Inside the tree, only we can send to it while it is waiting
+			// (its children are idle too), but channels let any thread send to
+			// a thread in its subtree and `wake_ancestors()` then clears its
+			// waiting flag.  Those workers count as waiting but are never
+			// collected.  A channel send is counted in `channel_ends` until
+			// the ancestors have been woken, and the count is decremented
+			// with release semantics, so reading it with acquire semantics
+			// before the waiting flag means that a zero count is never paired
+			// with a waiting flag that a channel send has made stale.
+			bool has_channels = atomic_load_explicit(
+				&w->receive_port->channel_ends, memory_order_acquire) != 0;
+			assert(!w->receive_port->waiting || has_channels ||
 			       (w->receive_port->waiting &&
 			        (w->receive_port->message_head == NULL)));
-			// We don't need to lock the receive port, because only the parent
-			// (i.e. us) is allowed to move the worker from a waiting to a
-			// non-waiting state.  Thia also avoids the thread deadlocking with
-			// itself if the finalise method is called.
 			// If the worker is waiting, replace the GC'd pointer with a
 			// non-GC'd one.
-			if (w->receive_port->waiting || w->receive_port->disconnected)
+			if ((w->receive_port->waiting && !has_channels) ||
+			    w->receive_port->disconnected)
 			{
 				void *ptr = duk_get_heapptr(ctx, -1);
 				LOG("[%d] Trying to collect worker %p (waiting: %d)\n", i, ptr, w->receive_port->waiting);
@@ -341,12 +1373,13 @@ try_to_collect_workers(struct port *p, duk_context *ctx)
 				duk_push_int(ctx, i);
 				duk_push_pointer(ctx, ptr); // Worker as non-GC'd pointer
 				duk_put_prop(ctx, -3);
+				candidates++;
 			}
 			else
 			{
 				duk_pop(ctx); // Worker
 				LOG("[%d] Worker %p (port %p) is not waiting\n", i, w->object, w->receive_port);
-				all_waiting = false;
+				all_waiting &= w->receive_port->waiting;
 			}
 		}
 		else
@@ -355,9 +1388,19 @@ try_to_collect_workers(struct port *p, duk_context *ctx)
 		}
 	}
 	// Run the GC a couple of times to make sure that we clean up any
-	// workers that are no longer referenced.
-	duk_gc(ctx, 0);
-	duk_gc(ctx, 0);
+	// workers that are no longer referenced.  This is called every time the
+	// message queue drains, so skip the (stop-the-world) collections if no
+	// worker could be collected.
+	if (candidates > 0)
+	{
+		uint64_t start = now_ns();
+		TRACE('B', "collect_workers", candidates);
+		duk_gc(ctx, 0);
+		duk_gc(ctx, 0);
+		TRACE('E', "collect_workers", 0);
+		STAT_ADD(p, gc_count, 2);
+		STAT_ADD(p, gc_ns, now_ns() - start);
+	}
 	LOG("Re-adding roots for live workers in context %p\n", ctx);
 	duk_int_t insert_ptr = 0;
 	for (duk_int_t i=0 ; i<length ; i++)
@@ -401,10 +1444,54 @@ try_to_collect_workers(struct port *p, duk_context *ctx)
 }
 
 
+/**
+ * Returns true if every shared worker is waiting for messages.  Sets `count`
+ * to the number of shared workers.
+ */
+static bool
+shared_workers_waiting(int *count)
+{
+	LOCK_FOR_SCOPE(shared_workers_lock);
+	bool waiting = true;
+	*count = 0;
+	for (struct worker *w=shared_workers ; w != NULL ; w=w->next_shared)
+	{
+		waiting &= w->receive_port->waiting;
+		(*count)++;
+	}
+	return waiting;
+}
+
+/**
+ * Try to collect the workers of the main thread, whose receive port is `p`,
+ * and return true if it can exit.  Shared workers are not in the main
+ * thread's list of workers, but they hold references to its port and set
+ * their `waiting` flags (and signal it) in the same way as its children, so
+ * the main thread exits once they are all waiting as well.  Must be called
+ * with the lock for `p` held.
+ */
+static bool
+main_thread_idle(struct port *p, duk_context *ctx)
+{
+	bool children_waiting = try_to_collect_workers(p, ctx);
+	int count;
+	if (!shared_workers_waiting(&count))
+	{
+		return false;
+	}
+	return children_waiting || (p->refcount == count);
+}
+
+/**
+ * Wait for the next message on port `p`.  Returns false if the thread should
+ * exit.  Any drain notifications that must be sent to the parent once the
+ * lock is released are returned in `drained`.
+ */
 static bool
 get_message(struct port *p,
             struct port *parent,
             struct message **m,
+            struct drain_request **drained,
             duk_context *ctx)
 {
 	LOCK_FOR_SCOPE(p->lock);
@@ -415,6 +1502,55 @@ get_message(struct port *p,
 	}
 	// Sleep while there are no pending messages, but there are threads that
 	// may send messages.
+	if (p->message_head == NULL && p->refcount > 0 && p->collect_when_idle)
+	{
+		// If we've processed messages since the last idle collection, wait a
+		// little while for the next message and collect garbage if none
+		// arrives.  The lock is released during the collection so that
+		// senders are not blocked.
+		long delay = p->idle_gc_delay_ms;
+		if (delay < IDLE_GC_DELAY_MS)
+		{
+			delay = IDLE_GC_DELAY_MS;
+		}
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += delay / 1000;
+		deadline.tv_nsec += (delay % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		uint64_t wait_start = now_ns();
+		TRACE('B', "wait", 0);
+		// The condition variable is also signalled for things other than
+		// messages (and may wake spuriously), so keep waiting until a
+		// message arrives or the deadline passes.
+		int ret = 0;
+		while (p->message_head == NULL && !p->terminated && p->refcount > 0 &&
+		       ret != ETIMEDOUT)
+		{
+			ret = pthread_cond_timedwait(&p->cond, &p->lock, &deadline);
+		}
+		TRACE('E', "wait", 0);
+		STAT_ADD(p, wait_ns, now_ns() - wait_start);
+		if (p->message_head == NULL && !p->terminated && ret == ETIMEDOUT)
+		{
+			LOG("Idle collection for port %p\n", p);
+			p->collect_when_idle = false;
+			pthread_mutex_unlock(&p->lock);
+			uint64_t start = now_ns();
+			TRACE('B', "idle_gc", 0);
+			duk_gc(ctx, 0);
+			TRACE('E', "idle_gc", 0);
+			uint64_t gc_time = now_ns() - start;
+			STAT_ADD(p, gc_count, 1);
+			STAT_ADD(p, gc_ns, gc_time);
+			p->idle_gc_delay_ms = IDLE_GC_DELAY_FACTOR * (gc_time / 1000000);
+			pthread_mutex_lock(&p->lock);
+		}
+	}
 	if (p->message_head == NULL && p->refcount > 0)
 	{
 		// If the reference count is 1, then we have no children.  If the
@@ -443,7 +1579,7 @@ get_message(struct port *p,
 		{
 			// If we're the top-level thread, then try to collect children and
 			// if we can then give up now
-			if (try_to_collect_workers(p, ctx))
+			if (main_thread_idle(p, ctx))
 			{
 				return false;
 			}
@@ -452,7 +1588,11 @@ get_message(struct port *p,
 		if (p->message_head == NULL && p->refcount > 0)
 		{
 			LOG("Sleeping on port %p (%d senders)\n", p, p->refcount);
+			uint64_t wait_start = now_ns();
+			TRACE('B', "wait", 0);
 			pthread_cond_wait(&p->cond, &p->lock);
+			TRACE('E', "wait", 0);
+			STAT_ADD(p, wait_ns, now_ns() - wait_start);
 		}
 		LOG("Waking up port %p, message: %p\n", p, p->message_head);
 		assert((p->waiting == false) || (p->message_head == NULL));
@@ -467,11 +1607,18 @@ get_message(struct port *p,
 	assert(p->waiting == false);
 	*m = p->message_head;
 	p->message_head = (*m)->next;
+	if (is_limited(*m))
+	{
+		p->limited_depth--;
+	}
+	STAT_ADD(p, queue_depth, -1);
+	TRACE('i', "dequeue", STAT_GET(p, queue_depth));
 	(*m)->next = NULL;
 	if (p->message_head == NULL)
 	{
 		p->message_tail = NULL;
 	}
+	*drained = queue_shrunk(p);
 	LOG("received on port %p, message: %p for %p\n", p, *m, (*m)->receiver);
 	return true;
 }
@@ -484,22 +1631,40 @@ static void
 cleanup_worker(struct worker *w)
 {
 	LOG("Cleaning up worker %p\n", w);
-	duk_destroy_heap(w->ctx);
+	TRACE('i', "cleanup_worker", 0);
+	// Destroying the heap finalises any MessagePort objects, which closes
+	// their channels.
+	destroy_heap(w->ctx);
 	free(w->file);
-	// Wait for the refcount to drop to 0 and then delete it.
+	// Tell the parent that we've gone, so that it can collect the Worker
+	// object.  This must be done with the parent's lock held and the parent
+	// signalled, or the parent may check us just before we disconnect and then
+	// sleep forever.
 	{
+		LOCK_FOR_SCOPE(w->parent_port->lock);
 		w->receive_port->disconnected = true;
+		remove_drain_requests(w->parent_port, w->receive_port);
+		pthread_cond_signal(&w->parent_port->cond);
+	}
+	// Wait for the refcount to drop to 0 and for any channel senders to
+	// finish with the port, and then delete it.
+	{
 		LOCK_FOR_SCOPE(w->receive_port->lock);
-		while (!(w->receive_port->refcount == 0))
+		// Wake any senders blocked on our full queue.
+		pthread_cond_broadcast(&w->receive_port->space);
+		while (!((w->receive_port->refcount == 0) &&
+		         (w->receive_port->holds == 0)))
 		{
 			LOG("Waiting for the last reference to our receive port (%p) to disappear\n", w->receive_port);
 			pthread_cond_wait(&w->receive_port->cond, &w->receive_port->lock);
 		}
 	}
 	// Release our reference to the parent port.
-	LOCK_FOR_SCOPE(w->parent_port->lock);
-	LOG("Parent port refcount: %d\n", w->parent_port->refcount);
-	release_sending_port(w->parent_port);
+	{
+		LOCK_FOR_SCOPE(w->parent_port->lock);
+		LOG("Parent port refcount: %d\n", w->parent_port->refcount);
+		release_sending_port(w->parent_port);
+	}
 	LOG("Destroying worker struct %p (object: %p)\n", w, w->object);
 	free_port(w->receive_port);
 	free(w);
@@ -529,7 +1694,7 @@ get_thread_port(duk_context *ctx)
 	else
 	{
 		duk_pop(ctx);
-		p = create_port();
+		p = create_port("main");
 		duk_push_pointer(ctx, p);
 		duk_put_prop_string(ctx, -2, "default_port");
 	}
@@ -538,24 +1703,272 @@ get_thread_port(duk_context *ctx)
 }
 
 static bool
-prepare_onmessage(duk_context *ctx)
+prepare_handler(duk_context *ctx, const char *name)
 {
-	// Get the onmessage function and stick it on the top of the stack
-	if (duk_get_prop_string(ctx, -1, "onMessage") != 1)
+	// Get the handler function and stick it on the top of the stack
+	if (duk_get_prop_string(ctx, -1, name) != 1)
 	{
-		LOG("Failed to find onMessage property in object\n");
+		LOG("Failed to find %s property in object\n", name);
+		duk_pop(ctx);
 		return false;
 	}
-	// If the onmessage variable is not a function then return it.
+	// If the handler variable is not a function then return it.
 	if (!duk_is_function(ctx, -1))
 	{
-		LOG("onMessage property is not a function\n");
+		LOG("%s property is not a function\n", name);
 		duk_pop(ctx);
 		return false;
 	}
 	return true;
 }
 
+/**
+ * Attach channel end `e` to the thread that receives from port `p`, with
+ * `object` as its `MessagePort`.  Any messages sent to the end while it was in
+ * transit are moved to the port's queue.
+ */
+static void
+attach_end(struct channel_end *e, struct port *p, void *object)
+{
+	LOCK_FOR_SCOPE(e->channel->lock);
+	e->port = p;
+	e->object = object;
+	if (!e->channel->closed)
+	{
+		add_channel_ends(p, 1);
+		e->counted = true;
+	}
+	{
+		LOCK_FOR_SCOPE(p->lock);
+		while (e->pending_head != NULL)
+		{
+			struct message *m = e->pending_head;
+			e->pending_head = m->next;
+			m->next = NULL;
+			enqueue_message(p, m);
+		}
+	}
+	e->pending_tail = NULL;
+}
+
+/**
+ * Detach channel end `e` from the thread that receives from port `p`, so that
+ * it can be transferred.  Messages for the end that are still in the port's
+ * queue become its pending messages, so they are delivered (in order) to the
+ * thread that it is transferred to.
+ */
+static void
+detach_end(struct channel_end *e, struct port *p)
+{
+	LOCK_FOR_SCOPE(e->channel->lock);
+	if (e->port != p)
+	{
+		return;
+	}
+	{
+		LOCK_FOR_SCOPE(p->lock);
+		struct message **prev = &p->message_head;
+		p->message_tail = NULL;
+		while (*prev != NULL)
+		{
+			struct message *m = *prev;
+			if (m->end == e)
+			{
+				*prev = m->next;
+				if (is_limited(m))
+				{
+					p->limited_depth--;
+				}
+				append_pending(e, m);
+				STAT_ADD(p, queue_depth, -1);
+			}
+			else
+			{
+				p->message_tail = m;
+				prev = &m->next;
+			}
+		}
+	}
+	uncount_end(e);
+	e->port = NULL;
+	e->object = NULL;
+}
+
+/**
+ * Returns the `MessagePort` object for channel end `e` if it is attached to
+ * the thread that receives from port `p`, or NULL otherwise.
+ */
+static void *
+attached_object(struct channel_end *e, struct port *p)
+{
+	LOCK_FOR_SCOPE(e->channel->lock);
+	return (e->port == p) ? e->object : NULL;
+}
+
+/**
+ * Push the key used for the `MessagePort` object for channel end `e` in the
+ * heap stash's `message_ports` object.  Objects are kept there while their
+ * end is attached to this thread, so that they are not collected while they
+ * may still receive messages.
+ */
+static void
+push_port_key(duk_context *ctx, struct channel_end *e)
+{
+	duk_push_sprintf(ctx, "%p", (void*)e);
+}
+
+/**
+ * Push a new `MessagePort` object for channel end `e` and attach the end to
+ * the calling thread.  The object takes over the caller's reference to the
+ * channel.
+ */
+static void
+push_message_port(duk_context *ctx, struct channel_end *e)
+{
+	duk_push_object(ctx);
+	duk_push_heap_stash(ctx);
+	duk_get_prop_string(ctx, -1, "message_port_prototype");
+	duk_set_prototype(ctx, -3);
+	duk_push_pointer(ctx, e);
+	duk_put_prop_string(ctx, -3, "\xFF" "end");
+	duk_get_prop_string(ctx, -1, "message_ports");
+	push_port_key(ctx, e);
+	duk_dup(ctx, -4);
+	duk_put_prop(ctx, -3);
+	duk_pop(ctx); // message_ports
+	duk_pop(ctx); // heap stash
+	attach_end(e, get_thread_port(ctx), duk_get_heapptr(ctx, -1));
+}
+
+/**
+ * Remove the channel end from the `MessagePort` object at `idx` and stop
+ * keeping the object alive.  Returns the end, or NULL if the object has
+ * already been closed or transferred.  The caller takes over the object's
+ * reference to the channel.
+ */
+static struct channel_end *
+take_message_port(duk_context *ctx, duk_idx_t idx)
+{
+	idx = duk_normalize_index(ctx, idx);
+	duk_get_prop_string(ctx, idx, "\xFF" "end");
+	struct channel_end *e = duk_get_pointer(ctx, -1);
+	duk_pop(ctx);
+	if (e == NULL)
+	{
+		return NULL;
+	}
+	duk_del_prop_string(ctx, idx, "\xFF" "end");
+	duk_push_heap_stash(ctx);
+	duk_get_prop_string(ctx, -1, "message_ports");
+	push_port_key(ctx, e);
+	duk_del_prop(ctx, -2);
+	duk_pop(ctx); // message_ports
+	duk_pop(ctx); // heap stash
+	return e;
+}
+
+/**
+ * Deliver a message received on `receive_port` by calling the `onMessage()`
+ * or `onDrain()` method of its receiver, then free it.  Channel ends
+ * transferred with the message are attached to this thread and passed to
+ * `onMessage()` as `MessagePort`s in an array in the second argument, along
+ * with new `SharedArrayBuffer` objects for any shared buffers.  Connections to
+ * a shared worker are delivered to `onConnect()`, with the client's
+ * `MessagePort` as the only argument.
+ */
+static void
+dispatch_message(duk_context *ctx, struct port *receive_port,
+                 struct message *m)
+{
+	if (m->end != NULL)
+	{
+		void *object = attached_object(m->end, receive_port);
+		if (object == NULL)
+		{
+			// The end has been transferred away or closed since this message
+			// was queued.
+			route_to_end(m->end, m);
+			return;
+		}
+		duk_push_heapptr(ctx, object);
+	}
+	// If the receiver is null, then this is aimed at the global
+	// receive port.
+	else if (m->receiver == NULL)
+	{
+		duk_push_global_object(ctx);
+	}
+	else
+	{
+		// Push the worker
+		duk_push_heapptr(ctx, m->receiver);
+	}
+	const char *handler = m->drain ? "onDrain" :
+		(m->connect ? "onConnect" : "onMessage");
+	if (prepare_handler(ctx, handler))
+	{
+		// Swap the method / this order on the stack.  For the call,
+		// the order should be method, object, args
+		duk_swap_top(ctx, -2);
+		int nargs = 0;
+		if (m->connect)
+		{
+			assert(m->nports == 1);
+			push_message_port(ctx, m->ports[0]);
+			m->ports[0] = NULL;
+			nargs = 1;
+		}
+		else if (!m->drain)
+		{
+			decode_string(ctx, m->contents);
+			assert(duk_is_object_coercible(ctx, -1));
+			nargs = 1;
+		}
+		if ((m->nports > 0) && !m->connect)
+		{
+			duk_push_array(ctx);
+			for (size_t i=0 ; i<m->nports ; i++)
+			{
+				if ((m->buffers != NULL) && (m->buffers[i] != NULL))
+				{
+					push_shared_buffer(ctx, m->buffers[i]);
+					m->buffers[i] = NULL;
+				}
+				else
+				{
+					push_message_port(ctx, m->ports[i]);
+					m->ports[i] = NULL;
+				}
+				duk_put_prop_index(ctx, -2, i);
+			}
+			nargs++;
+		}
+		assert(duk_is_object(ctx, -1 - nargs));
+		assert(duk_is_callable(ctx, -2 - nargs));
+		uint64_t start = now_ns();
+		TRACE('B', handler, 0);
+		TRACE('f', "message", (uintptr_t)m);
+		duk_int_t ret = duk_pcall_method(ctx, nargs);
+		TRACE('E', handler, 0);
+		STAT_ADD(receive_port, handler_ns, now_ns() - start);
+		STAT_ADD(receive_port, messages_handled, 1);
+		if (ret != DUK_EXEC_SUCCESS)
+		{
+			print_error(ctx, stderr);
+		}
+		else
+		{
+			// We don't care about the return or error value.
+			duk_pop(ctx);
+		}
+	}
+	else 
+	{
+		duk_pop(ctx); // Worker / global object
+	}
+	free_message(m);
+}
+
 void
 run_message_loop(duk_context *ctx)
 {
@@ -569,53 +1982,28 @@ run_message_loop(duk_context *ctx)
 	duk_int_t top = duk_get_top(ctx);
 #endif
 	struct message *m;
+	struct drain_request *drained;
 	bool possibly_dead = false;
 	do
 	{
-		if (get_message(receive_port, parent_port, &m, ctx))
+		if (get_message(receive_port, parent_port, &m, &drained, ctx))
 		{
+			while (drained != NULL)
+			{
+				struct drain_request *next = drained->next;
+				send_drain(drained);
+				drained = next;
+			}
 			if (receive_port->terminated)
 			{
 				LOG("Not processing message, worker terminated\n");
+				free_message(m);
 				break;
 			}
 			assert(top == duk_get_top(ctx));
-			// If the receiver is null, then this is aimed at the global
-			// receive port.
-			if (m->receiver == NULL)
-			{
-				duk_push_global_object(ctx);
-			}
-			else
-			{
-				// Push the worker
-				duk_push_heapptr(ctx, m->receiver);
-			}
-			if (prepare_onmessage(ctx))
-			{
-				// Swap the method / this order on the stack.  For the call,
-				// the order should be method, object, args
-				duk_swap_top(ctx, -2);
-				decode_string(ctx, m->contents);
-				assert(duk_is_object_coercible(ctx, -1));
-				assert(duk_is_object(ctx, -2));
-				assert(duk_is_callable(ctx, -3));
-				if (duk_pcall_method(ctx, 1) != DUK_EXEC_SUCCESS)
-				{
-					print_error(ctx, stderr);
-				}
-				else
-				{
-					// We don't care about the return or error value.
-					duk_pop(ctx);
-				}
-			}
-			else 
-			{
-				duk_pop(ctx); // Worker / global object
-			}
+			dispatch_message(ctx, receive_port, m);
 			assert(top == duk_get_top(ctx));
-			free_message(m);
+			receive_port->collect_when_idle = true;
 		}
 		// If we've been told to exit, or there are no more event sources, then
 		// exit without trying to GC children.
@@ -623,38 +2011,260 @@ run_message_loop(duk_context *ctx)
 		{
 			break;
 		}
-		assert(top == duk_get_top(ctx));
-		LOCK_FOR_SCOPE(receive_port->lock);
-		possibly_dead = try_to_collect_workers(receive_port, ctx);
-		assert(top == duk_get_top(ctx));
-		// If all of our children are blocked and we have no parent, then exit.
-		if (possibly_dead && (w == NULL))
+		assert(top == duk_get_top(ctx));
+		LOCK_FOR_SCOPE(receive_port->lock);
+		possibly_dead = (w == NULL) ? main_thread_idle(receive_port, ctx) :
+			try_to_collect_workers(receive_port, ctx);
+		assert(top == duk_get_top(ctx));
+		// If all of our children are blocked and we have no parent, then exit.
+		if (possibly_dead && (w == NULL))
+		{
+			return;
+		}
+	} while (receive_port->refcount > 0);
+	LOG("Run loop exiting for %p\n", ctx);
+}
+
+/**
+ * Push the return value of `postMessage()` for the result of sending a
+ * message: true if the sender may keep sending, false if it should wait for
+ * `onDrain()` (or if the receiver has gone).  Raises a `RangeError` if the
+ * queue was full.
+ */
+static duk_ret_t
+push_send_result(duk_context *ctx, enum send_result result)
+{
+	if (result == SEND_FULL)
+	{
+		return DUK_RET_RANGE_ERROR;
+	}
+	duk_push_boolean(ctx, result == SEND_QUEUED);
+	return 1;
+}
+
+/**
+ * Read the queue limits from the options object at `idx` into `l`.  Returns 0
+ * on success or an error code if the options are invalid.  The properties
+ * are:
+ *
+ * - `capacity`: the maximum number of queued messages (0 or absent for no
+ *   limit).
+ * - `overflow`: what to do when the queue is full: `"block"` (the default),
+ *   `"error"` or `"drop-oldest"`.
+ * - `highWaterMark`: the queue length at which `postMessage()` returns false
+ *   (defaults to the capacity).
+ */
+static duk_ret_t
+get_queue_limit(duk_context *ctx, duk_idx_t idx, struct queue_limit *l)
+{
+	l->capacity = 0;
+	l->high_water = 0;
+	l->overflow = OVERFLOW_BLOCK;
+	if (duk_is_undefined(ctx, idx))
+	{
+		return 0;
+	}
+	if (!duk_is_object(ctx, idx))
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	duk_get_prop_string(ctx, idx, "capacity");
+	if (!duk_is_undefined(ctx, -1))
+	{
+		duk_double_t capacity = duk_get_number(ctx, -1);
+		if (!duk_is_number(ctx, -1) || !(capacity >= 0))
+		{
+			return DUK_RET_RANGE_ERROR;
+		}
+		l->capacity = capacity;
+	}
+	duk_pop(ctx);
+	l->high_water = l->capacity;
+	duk_get_prop_string(ctx, idx, "highWaterMark");
+	if (!duk_is_undefined(ctx, -1))
+	{
+		duk_double_t high_water = duk_get_number(ctx, -1);
+		if (!duk_is_number(ctx, -1) || !(high_water >= 0))
+		{
+			return DUK_RET_RANGE_ERROR;
+		}
+		l->high_water = high_water;
+	}
+	duk_pop(ctx);
+	duk_get_prop_string(ctx, idx, "overflow");
+	if (!duk_is_undefined(ctx, -1))
+	{
+		const char *overflow = duk_get_string(ctx, -1);
+		if (overflow == NULL)
+		{
+			return DUK_RET_TYPE_ERROR;
+		}
+		if (strcmp(overflow, "block") == 0)
+		{
+			l->overflow = OVERFLOW_BLOCK;
+		}
+		else if (strcmp(overflow, "error") == 0)
+		{
+			l->overflow = OVERFLOW_ERROR;
+		}
+		else if (strcmp(overflow, "drop-oldest") == 0)
+		{
+			l->overflow = OVERFLOW_DROP_OLDEST;
+		}
+		else
+		{
+			return DUK_RET_RANGE_ERROR;
+		}
+	}
+	duk_pop(ctx);
+	return 0;
+}
+
+/**
+ * Set the queue limits for a port.
+ */
+static void
+set_queue_limit(struct port *p, const struct queue_limit *l)
+{
+	LOCK_FOR_SCOPE(p->lock);
+	p->limit = *l;
+	// The new limit may let blocked senders proceed, or they may now need to
+	// fail or drop messages instead.
+	pthread_cond_broadcast(&p->space);
+}
+
+/**
+ * The global `setQueueLimit()` function.  Sets the limits on the queue of
+ * messages sent to the calling thread.
+ */
+static duk_ret_t
+set_queue_limit_global(duk_context *ctx)
+{
+	struct queue_limit l;
+	duk_ret_t ret = get_queue_limit(ctx, 0, &l);
+	if (ret != 0)
+	{
+		return ret;
+	}
+	set_queue_limit(get_thread_port(ctx), &l);
+	return 0;
+}
+
+/**
+ * Transfer the `MessagePort`s in the array at `idx` (the optional second
+ * argument to `postMessage()`) with message `m`.  The ports are detached from
+ * the calling thread and can no longer be used here.  The array may also
+ * contain `SharedArrayBuffer`s, which are shared rather than transferred and
+ * so remain usable in this thread.  `from` is the channel
+ * end that the message is being sent from, or NULL, which can't be
+ * transferred along with its peer.  Returns 0 on success or an error code.
+ */
+static duk_ret_t
+transfer_ports(duk_context *ctx, duk_idx_t idx, struct message *m,
+               struct channel_end *from)
+{
+	// Extra arguments to postMessage() used to be ignored, so anything other
+	// than an array still is.
+	if (!duk_is_array(ctx, idx))
+	{
+		return 0;
+	}
+	size_t n = duk_get_length(ctx, idx);
+	if (n == 0)
+	{
+		return 0;
+	}
+	// Check every element before detaching any of them.
+	m->ports = calloc(n, sizeof(struct channel_end *));
+	for (size_t i=0 ; i<n ; i++)
+	{
+		duk_get_prop_index(ctx, idx, i);
+		struct shared_buffer *b = get_shared_buffer(ctx, -1);
+		if (b != NULL)
+		{
+			if (m->buffers == NULL)
+			{
+				m->buffers = calloc(n, sizeof(struct shared_buffer *));
+			}
+			m->buffers[i] = b;
+			duk_pop(ctx);
+			continue;
+		}
+		duk_get_prop_string(ctx, -1, "\xFF" "end");
+		struct channel_end *e = duk_get_pointer(ctx, -1);
+		duk_pop_2(ctx);
+		if ((e == NULL) || (e == from) || ((from != NULL) && (e == peer_end(from))))
+		{
+			return DUK_RET_TYPE_ERROR;
+		}
+		for (size_t j=0 ; j<i ; j++)
+		{
+			if (m->ports[j] == e)
+			{
+				return DUK_RET_TYPE_ERROR;
+			}
+		}
+		m->ports[i] = e;
+	}
+	struct port *p = get_thread_port(ctx);
+	for (size_t i=0 ; i<n ; i++)
+	{
+		if ((m->buffers != NULL) && (m->buffers[i] != NULL))
 		{
-			return;
+			retain_shared_buffer(m->buffers[i]);
+			m->nports++;
+			continue;
 		}
-	} while (receive_port->refcount > 0);
-	LOG("Run loop exiting for %p\n", ctx);
+		duk_get_prop_index(ctx, idx, i);
+		take_message_port(ctx, -1);
+		duk_pop(ctx);
+		detach_end(m->ports[i], p);
+		m->nports++;
+	}
+	return 0;
+}
+
+/**
+ * Create a message from the arguments to a `postMessage()` function: the
+ * value to send and an optional array of `MessagePort`s to transfer and
+ * `SharedArrayBuffer`s to share.  Returns
+ * 0 on success or an error code.
+ */
+static duk_ret_t
+create_post_message(duk_context *ctx, struct message **m,
+                    struct channel_end *from)
+{
+	*m = create_message(ctx, 0);
+	if (*m == NULL)
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	duk_ret_t ret = transfer_ports(ctx, 1, *m, from);
+	if (ret != 0)
+	{
+		free_message(*m);
+	}
+	return ret;
 }
 
 static int
 post_message_global(duk_context *ctx)
 {
-	// Expect exactly one argument
-	const char *json = duk_json_encode(ctx, 0);
-	if (json == NULL)
+	struct message *m;
+	duk_ret_t ret = create_post_message(ctx, &m, NULL);
+	if (ret != 0)
 	{
-		return DUK_RET_TYPE_ERROR;
+		return ret;
 	}
 	duk_push_heap_stash(ctx);
 	duk_get_prop_string(ctx, -1, "worker_struct");
 	struct worker *w = duk_get_pointer(ctx, -1);
 	duk_pop(ctx);
-	struct message *m = malloc(sizeof(struct message));
-	m->contents = strdup(json);
 	m->receiver = w->object;
-	// FIXME: handle termination
-	send_message(w->parent_port, m);
-	return 0;
+	// Drain notifications come back to the global object in this thread.
+	struct drain_request reply = { .port = w->receive_port, .to_child = true };
+	return push_send_result(ctx,
+		send_message(w->parent_port, m, w->receive_port, &reply));
 }
 
 static duk_ret_t
@@ -670,13 +2280,13 @@ get_closing(duk_context *ctx)
 
 
 /**
- * Function passed to `pthread_create` to create a new context and run a worker.
+ * Construct a new JavaScript context for worker `w`, in the calling thread.
  */
-static void *
-run_worker(struct worker *w)
+static duk_context *
+create_worker_context(struct worker *w)
 {
-	// Construct a new JavaScript context for the 
-	duk_context *ctx = duk_create_heap_default();
+	duk_context *ctx = create_heap();
+	w->ctx = ctx;
 	init_default_objects(ctx);
 	// Store the worker object in the heap so that it can be accessed from
 	// postMessage() calls.
@@ -686,9 +2296,21 @@ run_worker(struct worker *w)
 	duk_push_pointer(ctx, w->receive_port);
 	duk_put_prop_string(ctx, -2, "default_port");
 	duk_pop(ctx);
+	return ctx;
+}
+
+/**
+ * Function passed to `pthread_create` to create a new context and run a worker.
+ */
+static void *
+run_worker(struct worker *w)
+{
+	trace_thread_name(w->file);
+	TRACE('B', "worker", 0);
+	duk_context *ctx = create_worker_context(w);
 	// Set the global postMessage() function to call back to the parent thread.
 	duk_push_global_object(ctx);
-	duk_push_c_function(ctx, post_message_global, 1);
+	duk_push_c_function(ctx, post_message_global, 2);
 	duk_put_prop_string(ctx, -2, "postMessage");
 	duk_push_string(ctx, "closing");
 	duk_push_c_function(ctx, get_closing, 0);
@@ -699,6 +2321,7 @@ run_worker(struct worker *w)
 		run_message_loop(ctx);
 	}
 	LOG("Worker %p exiting!\n", w->object);
+	TRACE('E', "worker", 0);
 	cleanup_worker(w);
 	return NULL;
 }
@@ -710,25 +2333,119 @@ run_worker(struct worker *w)
 static int
 post_message_method(duk_context *ctx)
 {
-	// Expect exactly one argument
-	const char *json = duk_json_encode(ctx, 0);
-	if (json == NULL)
+	struct message *m;
+	duk_ret_t ret = create_post_message(ctx, &m, NULL);
+	if (ret != 0)
 	{
-		return DUK_RET_TYPE_ERROR;
+		return ret;
 	}
 	duk_push_this(ctx);
 	duk_get_prop_string(ctx, -1, "\xFF" "worker_struct");
 	struct worker *w = duk_get_pointer(ctx, -1);
 	struct port *p = w->receive_port;
-	struct message *m = malloc(sizeof(struct message));
-	m->contents = strdup(json);
 	m->receiver = NULL;
 	LOG("Sending message from worker object %p to worker thread %p\n", w->object, w);
-	// FIXME: handle termination
-	send_message(p, m);
+	// The Worker object lives in the parent's heap, so the parent port is the
+	// calling thread's receive port.  Drain notifications come back to the
+	// Worker object.
+	struct drain_request reply = { .port = w->parent_port, .receiver = w->object };
+	return push_send_result(ctx, send_message(p, m, w->parent_port, &reply));
+}
+
+/**
+ * Constructor function for MessageChannel objects.  Creates a channel and sets
+ * the `port1` and `port2` properties to `MessagePort`s for its two ends.
+ */
+static duk_ret_t
+create_message_channel(duk_context *ctx)
+{
+	if (!duk_is_constructor_call(ctx))
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	struct channel *c = create_channel();
+	duk_push_this(ctx);
+	push_message_port(ctx, &c->ends[0]);
+	duk_put_prop_string(ctx, -2, "port1");
+	push_message_port(ctx, &c->ends[1]);
+	duk_put_prop_string(ctx, -2, "port2");
+	return 0;
+}
+
+/**
+ * The `MessagePort` function.  MessagePort objects are only created by
+ * `MessageChannel`, so calling this is an error.
+ */
+static duk_ret_t
+message_port_constructor(duk_context *ctx)
+{
+	return DUK_RET_TYPE_ERROR;
+}
+
+/**
+ * The `postMessage()` method on a MessagePort object.  Sends a message to the
+ * other end of the channel, in whichever thread that is.
+ */
+static duk_ret_t
+message_port_post(duk_context *ctx)
+{
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "\xFF" "end");
+	struct channel_end *e = duk_get_pointer(ctx, -1);
+	duk_pop_2(ctx);
+	if (e == NULL)
+	{
+		// Closed or transferred ports silently discard messages.
+		duk_push_false(ctx);
+		return 1;
+	}
+	struct message *m;
+	duk_ret_t ret = create_post_message(ctx, &m, e);
+	if (ret != 0)
+	{
+		return ret;
+	}
+	struct port *p = get_thread_port(ctx);
+	return push_send_result(ctx, send_to_end(peer_end(e), m, p, e));
+}
+
+/**
+ * Close the channel of the MessagePort that is `this` (or the first argument,
+ * when called as a finaliser).
+ */
+static duk_ret_t
+close_message_port(duk_context *ctx, duk_idx_t idx)
+{
+	struct channel_end *e = take_message_port(ctx, idx);
+	if (e != NULL)
+	{
+		close_channel(e);
+		release_channel(e->channel);
+	}
 	return 0;
 }
 
+/**
+ * The `close()` method on a MessagePort object.  Closes the channel, so
+ * neither end will receive any more messages.
+ */
+static duk_ret_t
+message_port_close(duk_context *ctx)
+{
+	duk_push_this(ctx);
+	return close_message_port(ctx, -1);
+}
+
+/**
+ * Finaliser for MessagePort objects.  Ports that are attached to a thread are
+ * only collected when its heap is destroyed, which closes their channels.
+ */
+static duk_ret_t
+finalise_message_port(duk_context *ctx)
+{
+	return close_message_port(ctx, 0);
+}
+
 /**
  * Method to terminate a worker.  Leaves the worker in an undefined state, but
  * will not actually garbage collect it until all of the message queues have
@@ -748,6 +2465,7 @@ terminate_method(duk_context *ctx)
 	LOCK_FOR_SCOPE(w->receive_port->lock);
 	w->receive_port->terminated = true;
 	pthread_cond_signal(&w->receive_port->cond);
+	pthread_cond_broadcast(&w->receive_port->space);
 	LOG("Set terminate flag\n");
 	return 0;
 }
@@ -763,23 +2481,27 @@ spawn_worker(duk_context *ctx)
 	{
 		return 0;
 	}
-	// Expect exactly one argument
-	if (duk_get_top(ctx) != 1)
+	// If the file name is not a string, raise an error
+	const char *fn = duk_get_string(ctx, 0);
+	if (fn == NULL)
 	{
 		return DUK_RET_TYPE_ERROR;
 	}
-	// If the argument is not a string, raise an error
-	const char *fn = duk_get_string(ctx, -1);
-	if (fn == NULL)
+	// The optional second argument sets the limits on the worker's queue.
+	struct queue_limit limit;
+	duk_ret_t ret = get_queue_limit(ctx, 1, &limit);
+	if (ret != 0)
 	{
-		return DUK_RET_TYPE_ERROR;
+		return ret;
 	}
 	struct worker *w = malloc(sizeof(struct worker));
 	w->file = strdup(fn);
 	w->ctx = NULL;
-	w->receive_port = create_port();
+	w->receive_port = create_port(fn);
 	w->receive_port->refcount = 1;
+	w->receive_port->limit = limit;
 	w->parent_port = get_thread_port(ctx);
+	w->receive_port->parent = w->parent_port;
 	duk_push_this(ctx);
 	w->object = duk_get_heapptr(ctx, -1);
 	LOG("Created worker %p in context %p\n", w->object, ctx);
@@ -788,6 +2510,7 @@ spawn_worker(duk_context *ctx)
 		cleanup_worker(w);
 		return 0;
 	}
+	TRACE('i', "spawn_worker", 0);
 	duk_push_pointer(ctx, w);
 	duk_put_prop_string(ctx, -2, "\xFF" "worker_struct");
 	duk_push_heap_stash(ctx);
@@ -820,6 +2543,369 @@ spawn_worker(duk_context *ctx)
 	return 0;
 }
 
+/**
+ * Function passed to `pthread_create` to run a shared worker.
+ */
+static void *
+run_shared_worker(struct worker *w)
+{
+	trace_thread_name(w->file);
+	duk_context *ctx = create_worker_context(w);
+	// Clients may already have been given ports for this worker, so it runs
+	// its message loop even if the script fails.  Their ports are then closed
+	// when the connection messages are discarded, because there is no
+	// `onConnect()` to receive them.
+	handle_file(ctx, w->file);
+	// The list of shared workers holds a reference to the receive port, so
+	// this never returns.
+	run_message_loop(ctx);
+	return NULL;
+}
+
+/**
+ * Returns the receive port of the main thread, given the receive port `p` of
+ * any thread.
+ */
+static struct port *
+main_thread_port(struct port *p)
+{
+	while (p->parent != NULL)
+	{
+		p = p->parent;
+	}
+	return p;
+}
+
+/**
+ * Start a shared worker running the script `file`, which it takes ownership
+ * of, and add it to the list of shared workers.  `name` is the name that the
+ * script was given as, which the thread is known by.  The worker is placed
+ * under the main thread, whose receive port is `root`, so that the main thread
+ * waits for it to become idle before exiting.  Must be called with the locks
+ * for `root` and `shared_workers_lock` held.  Returns NULL if the thread can't
+ * be created.
+ */
+static struct worker *
+start_shared_worker(struct port *root, char *file, const char *name)
+{
+	struct worker *w = calloc(sizeof(struct worker), 1);
+	w->file = file;
+	w->receive_port = create_port(name);
+	w->receive_port->refcount = 1;
+	w->receive_port->parent = root;
+	w->parent_port = root;
+	root->refcount++;
+	if (pthread_create(&w->thread, NULL, (void *(*)(void *))run_shared_worker, w))
+	{
+		root->refcount--;
+		w->receive_port->refcount = 0;
+		free_port(w->receive_port);
+		free(w->file);
+		free(w);
+		return NULL;
+	}
+	TRACE('i', "spawn_shared_worker", 0);
+	w->next_shared = shared_workers;
+	shared_workers = w;
+	return w;
+}
+
+/**
+ * Constructor function for SharedWorker objects.  There is one shared worker
+ * for each script, which is started by the first SharedWorker for it.  Each
+ * SharedWorker connects to it with a new channel: the `port` property is this
+ * thread's end, and the other end is passed to the shared worker's global
+ * `onConnect()` function.
+ */
+static duk_ret_t
+shared_worker_constructor(duk_context *ctx)
+{
+	if (!duk_is_constructor_call(ctx))
+	{
+		return 0;
+	}
+	const char *fn = duk_get_string(ctx, 0);
+	if (fn == NULL)
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	// Look up scripts by their real path, so that every name for the same
+	// file finds the same worker.
+	char *file = realpath(fn, NULL);
+	if (file == NULL)
+	{
+		file = strdup(fn);
+	}
+	struct port *root = main_thread_port(get_thread_port(ctx));
+	struct worker *w;
+	{
+		LOCK_FOR_SCOPE(root->lock);
+		{
+			LOCK_FOR_SCOPE(shared_workers_lock);
+			for (w=shared_workers ; w != NULL ; w=w->next_shared)
+			{
+				if (strcmp(w->file, file) == 0)
+				{
+					break;
+				}
+			}
+			if (w != NULL)
+			{
+				free(file);
+			}
+			else
+			{
+				w = start_shared_worker(root, file, fn);
+			}
+		}
+	}
+	if (w == NULL)
+	{
+		return DUK_RET_ERROR;
+	}
+	struct channel *c = create_channel();
+	duk_push_this(ctx);
+	push_message_port(ctx, &c->ends[0]);
+	duk_put_prop_string(ctx, -2, "port");
+	// The worker's end is in transit until the worker receives the connection
+	// message, so anything posted on the port before then waits with it.
+	struct message *m = alloc_message(0);
+	m->connect = true;
+	m->ports = malloc(sizeof(struct channel_end *));
+	m->ports[0] = &c->ends[1];
+	m->nports = 1;
+	LOCK_FOR_SCOPE(w->receive_port->lock);
+	enqueue_message(w->receive_port, m);
+	return 0;
+}
+
+/**
+ * Push an object containing the statistics `s` for the thread called `name`.
+ */
+static void
+push_stats(duk_context *ctx, const char *name, struct port_stats *s)
+{
+	duk_push_object(ctx);
+	duk_push_string(ctx, name);
+	duk_put_prop_string(ctx, -2, "name");
+#define PUSH_COUNT(field) \
+	duk_push_number(ctx, \
+		atomic_load_explicit(&s->field, memory_order_relaxed)); \
+	duk_put_prop_string(ctx, -2, #field)
+#define PUSH_MS(field, name) \
+	duk_push_number(ctx, \
+		atomic_load_explicit(&s->field, memory_order_relaxed) / 1000000.0); \
+	duk_put_prop_string(ctx, -2, name)
+	PUSH_COUNT(messages_received);
+	PUSH_COUNT(bytes_received);
+	PUSH_COUNT(queue_depth);
+	PUSH_COUNT(queue_high_water);
+	PUSH_COUNT(messages_sent);
+	PUSH_COUNT(bytes_sent);
+	PUSH_COUNT(messages_handled);
+	PUSH_MS(handler_ns, "handler_ms");
+	PUSH_MS(wait_ns, "wait_ms");
+	PUSH_COUNT(gc_count);
+	PUSH_MS(gc_ns, "gc_ms");
+	PUSH_MS(send_blocked_ns, "send_blocked_ms");
+	PUSH_COUNT(messages_dropped);
+#undef PUSH_COUNT
+#undef PUSH_MS
+}
+
+/**
+ * Print the statistics for the thread that receives from port `p`.
+ */
+static void
+print_stats(FILE *f, struct port *p)
+{
+	fprintf(f, "%s: received %" PRIu64 " messages (%" PRIu64 " bytes), "
+	        "sent %" PRIu64 " messages (%" PRIu64 " bytes), "
+	        "queue %" PRIu64 " (max %" PRIu64 "), "
+	        "onMessage %" PRIu64 " calls %.3fms, waiting %.3fms, "
+	        "%" PRIu64 " GCs %.3fms, blocked sending %.3fms, "
+	        "%" PRIu64 " dropped\n", p->name,
+	        STAT_GET(p, messages_received), STAT_GET(p, bytes_received),
+	        STAT_GET(p, messages_sent), STAT_GET(p, bytes_sent),
+	        STAT_GET(p, queue_depth), STAT_GET(p, queue_high_water),
+	        STAT_GET(p, messages_handled), STAT_GET(p, handler_ns) / 1000000.0,
+	        STAT_GET(p, wait_ns) / 1000000.0,
+	        STAT_GET(p, gc_count), STAT_GET(p, gc_ns) / 1000000.0,
+	        STAT_GET(p, send_blocked_ns) / 1000000.0,
+	        STAT_GET(p, messages_dropped));
+}
+
+/**
+ * The `stats()` method on a Worker object.  Returns the statistics for the
+ * worker's thread.
+ */
+static duk_ret_t
+stats_method(duk_context *ctx)
+{
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "\xFF" "worker_struct");
+	struct worker *w = duk_get_pointer(ctx, -1);
+	if (w == NULL)
+	{
+		return DUK_RET_TYPE_ERROR;
+	}
+	push_stats(ctx, w->receive_port->name, &w->receive_port->stats);
+	return 1;
+}
+
+/**
+ * A copy of the statistics for one thread, so that they can be reported
+ * without holding `ports_lock`.
+ */
+struct stats_copy
+{
+	/**
+	 * The name of the thread.
+	 */
+	const char *name;
+	/**
+	 * The thread's counters.
+	 */
+	struct port_stats stats;
+};
+
+/**
+ * Returns the number of bytes needed to copy the statistics of every thread,
+ * including their names.  Must be called with `ports_lock` held.
+ */
+static size_t
+stats_copy_size(void)
+{
+	size_t size = 0;
+	for (struct port *p=all_ports ; p != NULL ; p=p->next_port)
+	{
+		size += sizeof(struct stats_copy) + strlen(p->name) + 1;
+	}
+	return size;
+}
+
+/**
+ * Copy the statistics of every thread into `copies`, which is `size` bytes
+ * long.  The names are stored after the array.  Returns the number of threads,
+ * or -1 if `copies` is too small.  Must be called with `ports_lock` held.
+ */
+static ssize_t
+copy_all_stats(struct stats_copy *copies, size_t size)
+{
+	if (stats_copy_size() > size)
+	{
+		return -1;
+	}
+	size_t count = 0;
+	for (struct port *p=all_ports ; p != NULL ; p=p->next_port)
+	{
+		count++;
+	}
+	char *names = (char*)(copies + count);
+	struct stats_copy *c = copies;
+	for (struct port *p=all_ports ; p != NULL ; p=p->next_port, c++)
+	{
+		c->name = names;
+		strcpy(names, p->name);
+		names += strlen(p->name) + 1;
+#define COPY(field) atomic_init(&c->stats.field, STAT_GET(p, field))
+		COPY(messages_received);
+		COPY(bytes_received);
+		COPY(queue_depth);
+		COPY(queue_high_water);
+		COPY(messages_sent);
+		COPY(bytes_sent);
+		COPY(messages_handled);
+		COPY(handler_ns);
+		COPY(wait_ns);
+		COPY(gc_count);
+		COPY(gc_ns);
+		COPY(send_blocked_ns);
+		COPY(messages_dropped);
+#undef COPY
+	}
+	return count;
+}
+
+/**
+ * The global `workerStats()` function.  Returns an array of the statistics
+ * for every thread.
+ */
+static duk_ret_t
+worker_stats(duk_context *ctx)
+{
+	// Duktape calls can throw, which would leave `ports_lock` held, so the
+	// statistics are copied into a buffer allocated beforehand and the
+	// objects are created once the lock has been released.  The buffer is
+	// allocated again if threads were started while it was allocated.
+	struct stats_copy *copies;
+	ssize_t count;
+	do
+	{
+		size_t size;
+		{
+			LOCK_FOR_SCOPE(ports_lock);
+			size = stats_copy_size();
+		}
+		copies = duk_push_fixed_buffer(ctx, size);
+		{
+			LOCK_FOR_SCOPE(ports_lock);
+			count = copy_all_stats(copies, size);
+		}
+	} while (count < 0);
+	duk_push_array(ctx);
+	for (ssize_t i=0 ; i<count ; i++)
+	{
+		push_stats(ctx, copies[i].name, &copies[i].stats);
+		duk_put_prop_index(ctx, -2, i);
+	}
+	return 1;
+}
+
+/**
+ * Thread that prints the statistics for every thread to stderr whenever the
+ * process receives `STATS_SIGNAL`.
+ */
+static void *
+stats_thread(void *arg)
+{
+	sigset_t *set = arg;
+	for (;;)
+	{
+		int sig;
+		if (sigwait(set, &sig) != 0)
+		{
+			continue;
+		}
+		LOCK_FOR_SCOPE(ports_lock);
+		for (struct port *p=all_ports ; p != NULL ; p=p->next_port)
+		{
+			print_stats(stderr, p);
+		}
+		fflush(stderr);
+	}
+	return NULL;
+}
+
+/**
+ * Start the thread that handles `STATS_SIGNAL`.  The signal is blocked in the
+ * calling thread, so this must be called by the main thread before it starts
+ * any others, which will inherit the signal mask.
+ */
+static void
+start_stats_thread(void)
+{
+	static sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, STATS_SIGNAL);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, stats_thread, &set) == 0)
+	{
+		pthread_detach(thread);
+	}
+}
+
 static int
 finalise_worker(duk_context *ctx)
 {
@@ -860,18 +2946,51 @@ void
 init_workers(duk_context *ctx)
 {
 	duk_push_global_object(ctx);
-	duk_push_c_function(ctx, spawn_worker, 1);
+	duk_push_c_function(ctx, spawn_worker, 2);
 	// Construct the prototype object for workers
 	duk_push_object(ctx);
-	duk_push_c_function(ctx, post_message_method, 1);
+	duk_push_c_function(ctx, post_message_method, 2);
 	duk_put_prop_string(ctx, -2, "postMessage");
 	duk_push_c_function(ctx, terminate_method, 1);
 	duk_put_prop_string(ctx, -2, "terminate");
+	duk_push_c_function(ctx, stats_method, 0);
+	duk_put_prop_string(ctx, -2, "stats");
 	duk_push_c_function(ctx, finalise_worker, 1);
 	duk_set_finalizer(ctx, -2);
 	// Set the prototype property for the constructor
 	duk_put_prop_string(ctx, -2, "prototype");
 	// Name the Worker function in the global scope
 	duk_put_prop_string(ctx, -2, "Worker");
+	duk_push_c_function(ctx, worker_stats, 0);
+	duk_put_prop_string(ctx, -2, "workerStats");
+	duk_push_c_function(ctx, set_queue_limit_global, 1);
+	duk_put_prop_string(ctx, -2, "setQueueLimit");
+	duk_push_c_function(ctx, shared_worker_constructor, 1);
+	duk_push_object(ctx);
+	duk_put_prop_string(ctx, -2, "prototype");
+	duk_put_prop_string(ctx, -2, "SharedWorker");
+	duk_push_c_function(ctx, create_message_channel, 0);
+	duk_put_prop_string(ctx, -2, "MessageChannel");
+	// Construct the prototype object for message ports, which is also kept in
+	// the heap stash for creating ports that are transferred to this thread.
+	duk_push_c_function(ctx, message_port_constructor, 0);
+	duk_push_object(ctx);
+	duk_push_c_function(ctx, message_port_post, 2);
+	duk_put_prop_string(ctx, -2, "postMessage");
+	duk_push_c_function(ctx, message_port_close, 0);
+	duk_put_prop_string(ctx, -2, "close");
+	duk_push_c_function(ctx, finalise_message_port, 1);
+	duk_set_finalizer(ctx, -2);
+	duk_push_heap_stash(ctx);
+	duk_dup(ctx, -2);
+	duk_put_prop_string(ctx, -2, "message_port_prototype");
+	duk_push_object(ctx);
+	duk_put_prop_string(ctx, -2, "message_ports");
+	duk_pop(ctx); // heap stash
+	duk_put_prop_string(ctx, -2, "prototype");
+	duk_put_prop_string(ctx, -2, "MessagePort");
 	duk_pop(ctx);
+	// The first call is from the main thread, before any workers exist.
+	static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+	pthread_once(&stats_once, start_stats_thread);
 }